@@ -0,0 +1,1030 @@
+#ifndef ART_H_
+#define ART_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "KeyNormalizer.hpp"
+#include "OptimisticLock.hpp"
+#include "TID.hpp"
+
+// In-memory index on normalized keys, an Adaptive Radix Tree: every level of
+// the tree dispatches on one byte of the key, inner nodes grow and shrink
+// between 4, 16, 48 and 256 children. A node stores the bytes its keys share
+// (path compression), a key is stored in a leaf below the first byte which
+// distinguishes it from the other keys (lazy expansion). Readers and writers
+// use optimistic lock coupling like BTree.
+// Removed nodes and leaves are reused for nodes and leaves of the same type
+// and only freed with the tree, an optimistic reader which still reads them
+// fails to validate their parent afterwards
+template <class K, class LESS = std::less<K>>
+class ART {
+    // integer keys in their natural order are normalized big-endian, other
+    // keys need a KeyNormalizer
+    typedef typename std::conditional<
+        std::is_integral<K>::value && std::is_same<LESS, std::less<K>>::value,
+        IntegerNormalizer<K>, KeyNormalizer<K, LESS>>::type Normalizer;
+    static_assert(Normalizer::enabled, "ART requires a KeyNormalizer for the key type");
+
+    static const unsigned keySize = Normalizer::size;
+
+    // the normalized key and the TID of an entry
+    struct Leaf {
+        uint8_t key[keySize];
+        TID     tid;
+    };
+
+    enum class NodeType : uint8_t { Node4, Node16, Node48, Node256 };
+
+    template <unsigned capacity> class SortedNode;
+    class Node48;
+    class Node256;
+    typedef SortedNode<4>  Node4;
+    typedef SortedNode<16> Node16;
+
+    class Node : public OptimisticLock {
+      protected:
+        NodeType type;
+        uint16_t count;     // number of children
+        unsigned prefixLen;
+        uint8_t  prefix[keySize];
+
+        // the version is left untouched, see setVersion
+        Node(NodeType type) : type(type), count(0), prefixLen(0) {};
+
+      public:
+        inline NodeType getType() { return type; }
+
+        inline unsigned getCount() { return count; }
+
+        inline const uint8_t* getPrefix() { return prefix; }
+
+        inline unsigned getPrefixLen() { return prefixLen; }
+
+        // the prefix length bounded by the rest of a key below depth, which
+        // is safe to use for optimistic reads
+        inline unsigned getPrefixLen(unsigned depth) {
+            return std::min(prefixLen, keySize-1-depth);
+        }
+
+        // returns the number of leading prefix bytes which match the key at
+        // depth, up to len
+        inline unsigned matchPrefix(const uint8_t* key, unsigned depth, unsigned len) {
+            unsigned i = 0;
+            while (i < len && prefix[i] == key[depth+i]) {
+                i++;
+            }
+            return i;
+        }
+
+        inline void setPrefix(const uint8_t* bytes, unsigned len) {
+            memcpy(prefix, bytes, len);
+            prefixLen = len;
+        }
+
+        // removes the first n bytes of the prefix
+        inline void cutPrefix(unsigned n) {
+            memmove(prefix, prefix+n, prefixLen-n);
+            prefixLen -= n;
+        }
+
+        // prepends the prefix of the parent and the byte of this node in the
+        // parent, which is removed
+        inline void prependPrefix(Node* parent, uint8_t byte) {
+            unsigned len = parent->prefixLen;
+            memmove(prefix+len+1, prefix, prefixLen);
+            memcpy(prefix, parent->prefix, len);
+            prefix[len] = byte;
+            prefixLen  += len+1;
+        }
+
+        // Nodes do not have a vtable, the calls are dispatched by the node
+        // type instead
+
+        // returns the child for the byte or NULL
+        inline Node* findChild(uint8_t byte) {
+            switch (type) {
+                case NodeType::Node4:  return static_cast<Node4*>(this)->findChild(byte);
+                case NodeType::Node16: return static_cast<Node16*>(this)->findChild(byte);
+                case NodeType::Node48: return static_cast<Node48*>(this)->findChild(byte);
+                default:               return static_cast<Node256*>(this)->findChild(byte);
+            }
+        }
+
+        // adds a child for a new byte, the node must not be full
+        inline void insertChild(uint8_t byte, Node* child) {
+            switch (type) {
+                case NodeType::Node4:  static_cast<Node4*>(this)->insertChild(byte, child); break;
+                case NodeType::Node16: static_cast<Node16*>(this)->insertChild(byte, child); break;
+                case NodeType::Node48: static_cast<Node48*>(this)->insertChild(byte, child); break;
+                default:               static_cast<Node256*>(this)->insertChild(byte, child);
+            }
+        }
+
+        // replaces the child of an existing byte
+        inline void changeChild(uint8_t byte, Node* child) {
+            switch (type) {
+                case NodeType::Node4:  static_cast<Node4*>(this)->changeChild(byte, child); break;
+                case NodeType::Node16: static_cast<Node16*>(this)->changeChild(byte, child); break;
+                case NodeType::Node48: static_cast<Node48*>(this)->changeChild(byte, child); break;
+                default:               static_cast<Node256*>(this)->changeChild(byte, child);
+            }
+        }
+
+        inline void removeChild(uint8_t byte) {
+            switch (type) {
+                case NodeType::Node4:  static_cast<Node4*>(this)->removeChild(byte); break;
+                case NodeType::Node16: static_cast<Node16*>(this)->removeChild(byte); break;
+                case NodeType::Node48: static_cast<Node48*>(this)->removeChild(byte); break;
+                default:               static_cast<Node256*>(this)->removeChild(byte);
+            }
+        }
+
+        inline bool isFull() {
+            switch (type) {
+                case NodeType::Node4:  return static_cast<Node4*>(this)->isFull();
+                case NodeType::Node16: return static_cast<Node16*>(this)->isFull();
+                case NodeType::Node48: return static_cast<Node48*>(this)->isFull();
+                default:               return static_cast<Node256*>(this)->isFull();
+            }
+        }
+
+        // returns true if the node fits into the next smaller node type once
+        // a child was removed
+        inline bool isUnderfull() {
+            switch (type) {
+                case NodeType::Node4:  return static_cast<Node4*>(this)->isUnderfull();
+                case NodeType::Node16: return static_cast<Node16*>(this)->isUnderfull();
+                case NodeType::Node48: return static_cast<Node48*>(this)->isUnderfull();
+                default:               return static_cast<Node256*>(this)->isUnderfull();
+            }
+        }
+
+        // copies the children with bytes within [from, to] in byte order and
+        // returns their number
+        inline unsigned getChildren(uint8_t from, uint8_t to, uint8_t* bytes, Node** children) {
+            switch (type) {
+                case NodeType::Node4:  return static_cast<Node4*>(this)->getChildren(from, to, bytes, children);
+                case NodeType::Node16: return static_cast<Node16*>(this)->getChildren(from, to, bytes, children);
+                case NodeType::Node48: return static_cast<Node48*>(this)->getChildren(from, to, bytes, children);
+                default:               return static_cast<Node256*>(this)->getChildren(from, to, bytes, children);
+            }
+        }
+    };
+
+    // A node with up to 4 or 16 children, whose bytes are kept sorted
+    template <unsigned capacity>
+    class SortedNode : public Node {
+        uint8_t keys[capacity];
+        Node*   children[capacity];
+
+        // the count bounded by the capacity, which is safe to use for
+        // optimistic reads
+        inline unsigned getSafeCount() {
+            return std::min<unsigned>(this->count, capacity);
+        }
+
+      public:
+        static const NodeType nodeType = capacity == 4 ? NodeType::Node4 : NodeType::Node16;
+
+        SortedNode() : Node(nodeType) {};
+
+        Node* findChild(uint8_t byte) {
+            unsigned n = getSafeCount();
+#ifdef __SSE2__
+            if (capacity >= 16) {
+                // compare all bytes at once
+                __m128i cmp  = _mm_cmpeq_epi8(_mm_set1_epi8(byte),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)));
+                unsigned mask = _mm_movemask_epi8(cmp) & ((1u << n) - 1);
+                return mask == 0 ? NULL : children[__builtin_ctz(mask)];
+            }
+#endif
+            for (unsigned i = 0; i < n; i++) {
+                if (keys[i] == byte) {
+                    return children[i];
+                }
+            }
+            return NULL;
+        }
+
+        void insertChild(uint8_t byte, Node* child) {
+            unsigned i = 0;
+            while (i < this->count && keys[i] < byte) {
+                i++;
+            }
+            memmove(keys+i+1, keys+i, (this->count-i) * sizeof(uint8_t));
+            memmove(children+i+1, children+i, (this->count-i) * sizeof(Node*));
+            keys[i]     = byte;
+            children[i] = child;
+            this->count++;
+        }
+
+        void changeChild(uint8_t byte, Node* child) {
+            for (unsigned i = 0; i < this->count; i++) {
+                if (keys[i] == byte) {
+                    children[i] = child;
+                    return;
+                }
+            }
+        }
+
+        void removeChild(uint8_t byte) {
+            for (unsigned i = 0; i < this->count; i++) {
+                if (keys[i] == byte) {
+                    memmove(keys+i, keys+i+1, (this->count-i-1) * sizeof(uint8_t));
+                    memmove(children+i, children+i+1, (this->count-i-1) * sizeof(Node*));
+                    this->count--;
+                    return;
+                }
+            }
+        }
+
+        inline bool isFull() {
+            return this->count == capacity;
+        }
+
+        inline bool isUnderfull() {
+            return capacity > 4 && this->count <= 4;
+        }
+
+        unsigned getChildren(uint8_t from, uint8_t to, uint8_t* bytes, Node** result) {
+            unsigned n     = getSafeCount();
+            unsigned found = 0;
+            for (unsigned i = 0; i < n; i++) {
+                if (keys[i] >= from && keys[i] <= to) {
+                    bytes[found]  = keys[i];
+                    result[found] = children[i];
+                    found++;
+                }
+            }
+            return found;
+        }
+    };
+
+    // A node with up to 48 children, which are found through an index on the
+    // byte
+    class Node48 : public Node {
+        static const uint8_t emptyIndex = 48;
+
+        uint8_t childIndex[256];
+        Node*   children[48];
+
+      public:
+        static const NodeType nodeType = NodeType::Node48;
+
+        Node48() : Node(nodeType) {
+            memset(childIndex, emptyIndex, sizeof(childIndex));
+            memset(children, 0, sizeof(children));
+        };
+
+        inline Node* findChild(uint8_t byte) {
+            uint8_t i = childIndex[byte];
+            return i < emptyIndex ? children[i] : NULL;
+        }
+
+        void insertChild(uint8_t byte, Node* child) {
+            // removed children leave gaps
+            unsigned i = 0;
+            while (children[i] != NULL) {
+                i++;
+            }
+            children[i]      = child;
+            childIndex[byte] = i;
+            this->count++;
+        }
+
+        inline void changeChild(uint8_t byte, Node* child) {
+            children[childIndex[byte]] = child;
+        }
+
+        inline void removeChild(uint8_t byte) {
+            children[childIndex[byte]] = NULL;
+            childIndex[byte] = emptyIndex;
+            this->count--;
+        }
+
+        inline bool isFull() {
+            return this->count == 48;
+        }
+
+        inline bool isUnderfull() {
+            return this->count <= 13;
+        }
+
+        unsigned getChildren(uint8_t from, uint8_t to, uint8_t* bytes, Node** result) {
+            unsigned found = 0;
+            for (unsigned byte = from; byte <= to; byte++) {
+                Node* child = findChild(byte);
+                if (child != NULL) {
+                    bytes[found]  = byte;
+                    result[found] = child;
+                    found++;
+                }
+            }
+            return found;
+        }
+    };
+
+    // A node with a child for every byte
+    class Node256 : public Node {
+        Node* children[256];
+
+      public:
+        static const NodeType nodeType = NodeType::Node256;
+
+        Node256() : Node(nodeType) {
+            memset(children, 0, sizeof(children));
+        };
+
+        inline Node* findChild(uint8_t byte) {
+            return children[byte];
+        }
+
+        inline void insertChild(uint8_t byte, Node* child) {
+            children[byte] = child;
+            this->count++;
+        }
+
+        inline void changeChild(uint8_t byte, Node* child) {
+            children[byte] = child;
+        }
+
+        inline void removeChild(uint8_t byte) {
+            children[byte] = NULL;
+            this->count--;
+        }
+
+        inline bool isFull() {
+            return false;
+        }
+
+        inline bool isUnderfull() {
+            return this->count <= 38;
+        }
+
+        unsigned getChildren(uint8_t from, uint8_t to, uint8_t* bytes, Node** result) {
+            unsigned found = 0;
+            for (unsigned byte = from; byte <= to; byte++) {
+                if (children[byte] != NULL) {
+                    bytes[found]  = byte;
+                    result[found] = children[byte];
+                    found++;
+                }
+            }
+            return found;
+        }
+    };
+
+    // Children are inner nodes or leaves, pointers to leaves are tagged in
+    // their lowest bit
+    inline static bool isLeaf(Node* child) {
+        return (reinterpret_cast<uintptr_t>(child) & 1) != 0;
+    }
+
+    inline static Leaf* getLeaf(Node* child) {
+        return reinterpret_cast<Leaf*>(reinterpret_cast<uintptr_t>(child) & ~static_cast<uintptr_t>(1));
+    }
+
+    inline static Node* asChild(Leaf* leaf) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(leaf) | 1);
+    }
+
+  public:
+    // Iterates over the entries within a key range in ascending or descending
+    // order. The entries are copied in batches, each of them by an optimistic
+    // scan from the root, thus no latches are held between the calls
+    class RangeIterator {
+      public:
+        // Moves to the next entry. Returns false when the range is exhausted
+        bool next() {
+            while (pos == entries.size()) {
+                if (done) {
+                    return false;
+                }
+                load();
+            }
+            pos++;
+            return true;
+        }
+
+        K getKey() {
+            return Normalizer::denormalize(entries[pos-1].key);
+        }
+
+        TID getTID() {
+            return entries[pos-1].tid;
+        }
+
+      private:
+        static const size_t batchSize = 64;
+
+        RangeIterator(ART& tree, K lo, K hi, bool reverse) :
+            tree(tree), reverse(reverse), done(false), pos(0) {
+            Normalizer::normalize(lo, this->lo);
+            Normalizer::normalize(hi, this->hi);
+        }
+
+        // Copies the next batch of entries, the remaining range starts after
+        // the last of them
+        void load() {
+            entries.clear();
+            pos = 0;
+            while (!tree.scan(lo, hi, reverse, batchSize, entries)) {
+                entries.clear();
+            }
+
+            if (entries.size() < batchSize) {
+                done = true;
+            } else if (reverse) {
+                memcpy(hi, entries.back().key, keySize);
+                done = !decrement(hi);
+            } else {
+                memcpy(lo, entries.back().key, keySize);
+                done = !increment(lo);
+            }
+        }
+
+        // Moves the key to its successor, returns false if it has none
+        static bool increment(uint8_t* key) {
+            for (unsigned i = keySize; i-- > 0;) {
+                if (++key[i] != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Moves the key to its predecessor, returns false if it has none
+        static bool decrement(uint8_t* key) {
+            for (unsigned i = keySize; i-- > 0;) {
+                if (key[i]-- != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        ART&     tree;
+        uint8_t  lo[keySize]; // remaining range, normalized
+        uint8_t  hi[keySize];
+        bool     reverse;
+        bool     done;        // the range holds no further entries
+
+        std::vector<Leaf> entries; // current batch
+        size_t   pos;         // next entry to return
+
+      friend class ART;
+    };
+
+    // Creates an empty tree, the root is a Node256 which is never replaced
+    ART() {
+        root = newNode<Node256>();
+    }
+
+    ART(const ART&) = delete;
+    ART& operator=(const ART&) = delete;
+
+    ~ART() {
+        destroy(root);
+        for (auto& nodes : freeNodes) {
+            for (Node* node : nodes) {
+                deleteNode(node);
+            }
+        }
+        for (Leaf* leaf : freeLeaves) {
+            delete leaf;
+        }
+    }
+
+    /*
+    Lookup:
+    1. start with the root node
+    2. compare the prefix of the node with the key, stop on a mismatch
+    3. go to the child for the next byte of the key, stop if there is none
+    4. is the child a leaf?
+        > if yes, compare its key with the search key
+    5. continue with 2
+    */
+    bool lookup(K key, TID& tid) {
+        uint8_t nkey[keySize];
+        Normalizer::normalize(key, nkey);
+
+        bool found;
+        while (!tryLookup(nkey, tid, found)) {}
+        return found;
+    }
+
+    /*
+    Insert:
+    1. descend like a lookup
+    2. does the key mismatch the prefix of a node?
+        > if yes, insert a new node with the common part of the prefix
+          above it, whose children are the node and the new leaf
+    3. is there no child for the next byte?
+        > if yes, insert the leaf, a full node is replaced by a larger one
+    4. is the child a leaf with another key?
+        > if yes, replace it by a new node whose prefix is the common part
+          of both keys, whose children are both leaves
+    */
+    // Inserts the entry, the TID of an existing key is overwritten
+    void insert(K key, TID tid) {
+        uint8_t nkey[keySize];
+        Normalizer::normalize(key, nkey);
+
+        while (!tryInsert(nkey, tid)) {}
+    }
+
+    /*
+    Erase:
+    1. descend like a lookup to the node holding the leaf
+    2. does the node keep a single child only?
+        > if yes, replace the node by the child, an inner child takes over
+          the prefix of the node
+    3. is the node underfull?
+        > if yes, replace it by a smaller one without the leaf
+    4. otherwise remove the leaf from the node
+    */
+    // Returns false if the key was not found
+    bool erase(K key) {
+        uint8_t nkey[keySize];
+        Normalizer::normalize(key, nkey);
+
+        bool found;
+        while (!tryErase(nkey, found)) {}
+        return found;
+    }
+
+    // Returns an iterator over the entries with keys within [lo, hi]
+    RangeIterator lookupRange(K lo, K hi, bool reverse = false) {
+        return RangeIterator(*this, lo, hi, reverse);
+    }
+
+  private:
+    Node256* root;
+
+    // removed nodes by type and removed leaves, which are reused
+    std::vector<Node*> freeNodes[4];
+    std::vector<Leaf*> freeLeaves;
+    std::mutex         freeMutex;
+
+    // Returns false if the lookup must be restarted
+    bool tryLookup(const uint8_t* key, TID& tid, bool& found) {
+        Node*    node  = root;
+        unsigned depth = 0;
+        uint64_t v;
+        if (!node->readLock(v)) {
+            return false;
+        }
+
+        while (true) {
+            unsigned len = node->getPrefixLen(depth);
+            if (node->matchPrefix(key, depth, len) != len) {
+                found = false;
+                return node->validate(v);
+            }
+            depth += len;
+
+            Node* child = node->findChild(key[depth]);
+            if (child == NULL) {
+                found = false;
+                return node->validate(v);
+            }
+
+            if (isLeaf(child)) {
+                // the TID is only returned once it was read consistently
+                Leaf* leaf   = getLeaf(child);
+                TID   result = leaf->tid;
+                found = memcmp(leaf->key, key, keySize) == 0;
+                if (!node->validate(v)) {
+                    return false;
+                }
+                if (found) {
+                    tid = result;
+                }
+                return true;
+            }
+
+            // lock coupling: read the child before validating the parent
+            uint64_t childV;
+            if (!child->readLock(childV) || !node->validate(v)) {
+                return false;
+            }
+            node   = child;
+            v      = childV;
+            depth += 1;
+        }
+    }
+
+    // Descends optimistically, only the nodes which are modified are locked.
+    // Returns false if the insert must be restarted
+    bool tryInsert(const uint8_t* key, TID tid) {
+        Node*    node  = root;
+        unsigned depth = 0;
+        uint64_t v;
+
+        // parent, the root has none
+        Node*    parent    = NULL;
+        uint64_t parentV   = 0;
+        uint8_t  parentKey = 0;
+
+        if (!node->readLock(v)) {
+            return false;
+        }
+
+        while (true) {
+            unsigned len   = node->getPrefixLen(depth);
+            unsigned match = node->matchPrefix(key, depth, len);
+            if (match != len) {
+                // the key leaves the path of the node within its prefix, the
+                // root has no prefix and thus a parent exists
+                if (!parent->upgrade(parentV)) {
+                    return false;
+                }
+                if (!node->upgrade(v)) {
+                    parent->writeUnlock();
+                    return false;
+                }
+
+                Node4* split = newNode<Node4>();
+                split->setPrefix(node->getPrefix(), match);
+                split->insertChild(node->getPrefix()[match], node);
+                split->insertChild(key[depth+match], newLeaf(key, tid));
+                node->cutPrefix(match+1);
+                parent->changeChild(parentKey, split);
+
+                node->writeUnlock();
+                parent->writeUnlock();
+                return true;
+            }
+            depth += len;
+
+            uint8_t byte  = key[depth];
+            Node*   child = node->findChild(byte);
+            if (!node->validate(v)) {
+                return false;
+            }
+
+            if (child == NULL) {
+                if (node->isFull()) {
+                    // the root never is full and thus a parent exists
+                    if (!parent->upgrade(parentV)) {
+                        return false;
+                    }
+                    if (!node->upgrade(v)) {
+                        parent->writeUnlock();
+                        return false;
+                    }
+
+                    Node* grown = grow(node);
+                    grown->insertChild(byte, newLeaf(key, tid));
+                    parent->changeChild(parentKey, grown);
+
+                    node->writeUnlockObsolete();
+                    freeNode(node);
+                    parent->writeUnlock();
+                    return true;
+                }
+
+                if (!node->upgrade(v)) {
+                    return false;
+                }
+                node->insertChild(byte, newLeaf(key, tid));
+                node->writeUnlock();
+                return true;
+            }
+
+            if (isLeaf(child)) {
+                // find the first byte which distinguishes the keys
+                Leaf*    other = getLeaf(child);
+                unsigned diff  = depth+1;
+                while (diff < keySize && other->key[diff] == key[diff]) {
+                    diff++;
+                }
+                uint8_t otherByte = diff < keySize ? other->key[diff] : 0;
+                if (!node->upgrade(v)) {
+                    return false;
+                }
+
+                if (diff == keySize) {
+                    other->tid = tid; // overwrite existing value
+                    node->writeUnlock();
+                    return true;
+                }
+
+                // lazy expansion: both leaves move to a new node below the
+                // bytes they share
+                Node4* split = newNode<Node4>();
+                split->setPrefix(key+depth+1, diff-depth-1);
+                split->insertChild(otherByte, child);
+                split->insertChild(key[diff], newLeaf(key, tid));
+                node->changeChild(byte, split);
+
+                node->writeUnlock();
+                return true;
+            }
+
+            // lock coupling: read the child before validating the parent
+            uint64_t childV;
+            if (!child->readLock(childV) || !node->validate(v)) {
+                return false;
+            }
+
+            parent    = node;
+            parentV   = v;
+            parentKey = byte;
+            node      = child;
+            v         = childV;
+            depth    += 1;
+        }
+    }
+
+    // Descends optimistically like tryInsert. Returns false if the erase must
+    // be restarted
+    bool tryErase(const uint8_t* key, bool& found) {
+        Node*    node  = root;
+        unsigned depth = 0;
+        uint64_t v;
+
+        // parent, the root has none
+        Node*    parent    = NULL;
+        uint64_t parentV   = 0;
+        uint8_t  parentKey = 0;
+
+        if (!node->readLock(v)) {
+            return false;
+        }
+
+        while (true) {
+            unsigned len = node->getPrefixLen(depth);
+            if (node->matchPrefix(key, depth, len) != len) {
+                found = false;
+                return node->validate(v);
+            }
+            depth += len;
+
+            uint8_t byte  = key[depth];
+            Node*   child = node->findChild(byte);
+            if (child == NULL) {
+                found = false;
+                return node->validate(v);
+            }
+
+            if (isLeaf(child)) {
+                Leaf* leaf = getLeaf(child);
+                found = memcmp(leaf->key, key, keySize) == 0;
+                if (!found) {
+                    return node->validate(v);
+                }
+
+                if (node != root && (node->getCount() == 2 || node->isUnderfull())) {
+                    // the node is replaced, which requires the parent
+                    if (!parent->upgrade(parentV)) {
+                        return false;
+                    }
+                    if (!node->upgrade(v)) {
+                        parent->writeUnlock();
+                        return false;
+                    }
+
+                    Node* replacement;
+                    if (node->getCount() == 2) {
+                        // path collapse: the other child takes the place of
+                        // the node
+                        uint8_t bytes[2];
+                        Node*   children[2];
+                        node->getChildren(0, 255, bytes, children);
+                        unsigned other = bytes[0] == byte ? 1 : 0;
+                        replacement = children[other];
+                        if (!isLeaf(replacement)) {
+                            replacement->writeLock();
+                            replacement->prependPrefix(node, bytes[other]);
+                            replacement->writeUnlock();
+                        }
+                    } else {
+                        replacement = shrink(node, byte);
+                    }
+                    parent->changeChild(parentKey, replacement);
+
+                    node->writeUnlockObsolete();
+                    freeNode(node);
+                    parent->writeUnlock();
+                } else {
+                    if (!node->upgrade(v)) {
+                        return false;
+                    }
+                    node->removeChild(byte);
+                    node->writeUnlock();
+                }
+
+                freeLeaf(leaf);
+                return true;
+            }
+
+            // lock coupling: read the child before validating the parent
+            uint64_t childV;
+            if (!child->readLock(childV) || !node->validate(v)) {
+                return false;
+            }
+
+            parent    = node;
+            parentV   = v;
+            parentKey = byte;
+            node      = child;
+            v         = childV;
+            depth    += 1;
+        }
+    }
+
+    // Copies the entries within [lo, hi] in key order, or in reverse order,
+    // until out holds limit entries. Returns false if the scan must be
+    // restarted
+    bool scan(const uint8_t* lo, const uint8_t* hi, bool reverse, size_t limit, std::vector<Leaf>& out) {
+        uint64_t v;
+        if (!root->readLock(v)) {
+            return false;
+        }
+        return scan(root, v, 0, lo, hi, true, true, reverse, limit, out);
+    }
+
+    // Scans the locked node at depth. loTight (hiTight) tells whether the keys
+    // below the node share the bytes before depth with lo (hi), only then the
+    // bound restricts the children
+    bool scan(Node* node, uint64_t v, unsigned depth, const uint8_t* lo, const uint8_t* hi,
+            bool loTight, bool hiTight, bool reverse, size_t limit, std::vector<Leaf>& out) {
+        // skip the node if its prefix lies outside of the bounds
+        unsigned len = node->getPrefixLen(depth);
+        for (unsigned i = 0; i < len && (loTight || hiTight); i++) {
+            uint8_t byte = node->getPrefix()[i];
+            if ((loTight && byte < lo[depth+i]) || (hiTight && byte > hi[depth+i])) {
+                return node->validate(v);
+            }
+            loTight = loTight && byte == lo[depth+i];
+            hiTight = hiTight && byte == hi[depth+i];
+        }
+        depth += len;
+
+        uint8_t  bytes[256];
+        Node*    children[256];
+        unsigned count = node->getChildren(loTight ? lo[depth] : 0, hiTight ? hi[depth] : 255,
+            bytes, children);
+        if (!node->validate(v)) {
+            return false;
+        }
+
+        for (unsigned j = 0; j < count && out.size() < limit; j++) {
+            unsigned i     = reverse ? count-1-j : j;
+            Node*    child = children[i];
+
+            if (isLeaf(child)) {
+                Leaf leaf = *getLeaf(child);
+                if (!node->validate(v)) {
+                    return false;
+                }
+                if (memcmp(leaf.key, lo, keySize) >= 0 && memcmp(leaf.key, hi, keySize) <= 0) {
+                    out.push_back(leaf);
+                }
+                continue;
+            }
+
+            // lock coupling: read the child before validating the parent
+            uint64_t childV;
+            if (!child->readLock(childV) || !node->validate(v)) {
+                return false;
+            }
+            if (!scan(child, childV, depth+1, lo, hi, loTight && bytes[i] == lo[depth],
+                    hiTight && bytes[i] == hi[depth], reverse, limit, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns a copy of the node with the next larger type
+    Node* grow(Node* node) {
+        switch (node->getType()) {
+            case NodeType::Node4:  return copyNode<Node16>(node, -1);
+            case NodeType::Node16: return copyNode<Node48>(node, -1);
+            default:               return copyNode<Node256>(node, -1);
+        }
+    }
+
+    // Returns a copy of the node with the next smaller type, without the
+    // child for the byte
+    Node* shrink(Node* node, uint8_t byte) {
+        switch (node->getType()) {
+            case NodeType::Node16: return copyNode<Node4>(node, byte);
+            case NodeType::Node48: return copyNode<Node16>(node, byte);
+            default:               return copyNode<Node48>(node, byte);
+        }
+    }
+
+    // Copies the prefix and the children but the one for skip, if any
+    template <class T>
+    T* copyNode(Node* node, int skip) {
+        T* copy = newNode<T>();
+        copy->setPrefix(node->getPrefix(), node->getPrefixLen());
+
+        uint8_t  bytes[256];
+        Node*    children[256];
+        unsigned count = node->getChildren(0, 255, bytes, children);
+        for (unsigned i = 0; i < count; i++) {
+            if (bytes[i] != skip) {
+                copy->insertChild(bytes[i], children[i]);
+            }
+        }
+        return copy;
+    }
+
+    // Returns a node of the given type, a removed one is reused with a
+    // greater version
+    template <class T>
+    T* newNode() {
+        Node* node = NULL;
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            std::vector<Node*>& nodes = freeNodes[static_cast<unsigned>(T::nodeType)];
+            if (!nodes.empty()) {
+                node = nodes.back();
+                nodes.pop_back();
+            }
+        }
+
+        if (node == NULL) {
+            T* created = new T();
+            created->setVersion(0);
+            return created;
+        }
+
+        uint64_t v      = Node::nextVersion(node->getVersion());
+        T*       reused = new (node) T();
+        reused->setVersion(v);
+        return reused;
+    }
+
+    // The node must be unlocked as obsolete
+    void freeNode(Node* node) {
+        std::lock_guard<std::mutex> lock(freeMutex);
+        freeNodes[static_cast<unsigned>(node->getType())].push_back(node);
+    }
+
+    // Returns a leaf for the entry as child, a removed one is reused
+    Node* newLeaf(const uint8_t* key, TID tid) {
+        Leaf* leaf = NULL;
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            if (!freeLeaves.empty()) {
+                leaf = freeLeaves.back();
+                freeLeaves.pop_back();
+            }
+        }
+        if (leaf == NULL) {
+            leaf = new Leaf();
+        }
+
+        memcpy(leaf->key, key, keySize);
+        leaf->tid = tid;
+        return asChild(leaf);
+    }
+
+    void freeLeaf(Leaf* leaf) {
+        std::lock_guard<std::mutex> lock(freeMutex);
+        freeLeaves.push_back(leaf);
+    }
+
+    // Frees the node and everything below it
+    void destroy(Node* node) {
+        uint8_t  bytes[256];
+        Node*    children[256];
+        unsigned count = node->getChildren(0, 255, bytes, children);
+        for (unsigned i = 0; i < count; i++) {
+            if (isLeaf(children[i])) {
+                delete getLeaf(children[i]);
+            } else {
+                destroy(children[i]);
+            }
+        }
+        deleteNode(node);
+    }
+
+    static void deleteNode(Node* node) {
+        switch (node->getType()) {
+            case NodeType::Node4:  delete static_cast<Node4*>(node); break;
+            case NodeType::Node16: delete static_cast<Node16*>(node); break;
+            case NodeType::Node48: delete static_cast<Node48*>(node); break;
+            default:               delete static_cast<Node256*>(node);
+        }
+    }
+};
+
+#endif  // ART_H_
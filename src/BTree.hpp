@@ -2,31 +2,81 @@
 #define BTREE_H_
 
 #include <algorithm>
-
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "BloomFilter.hpp"
+#include "KeyNormalizer.hpp"
+#include "NodeSearch.hpp"
+#include "OptimisticLock.hpp"
 #include "Segment.hpp"
 #include "TID.hpp"
 
+// Tells whether the TID of an entry is part of its key, like for the
+// entries of a MultiBTree. Leaves then store the keys only and the TID is
+// taken from the key
+template <class K>
+struct EmbeddedTID {
+    static const bool enabled = false;
+
+    static TID get(const K&) {
+        return TID();
+    }
+};
+
 template <class K, class LESS = std::less<K>>
 class BTree : public Segment {
     // compare less function
     LESS less;
 
-    class Node {
+    class Node : public OptimisticLock {
       protected:
-        // LSN for recovery
         bool     leaf;  // node is a leaf; TODO: borrow a bit somewhere?
         unsigned count; // number of entries
 
+        // the version is left untouched, see setVersion
         Node(bool leaf) : leaf(leaf), count(0) {};
 
       public:
         inline bool isLeaf() { return leaf; }
 
-        // pure virtual method
-        virtual bool isFull() = 0;
+        inline unsigned getCount() { return count; }
+
+        // Nodes are stored on pages and must not have a vtable, the calls are
+        // dispatched by the node type instead
+        inline bool isFull() {
+            return leaf ? static_cast<LeafNode*>(this)->isFull() :
+                static_cast<InnerNode*>(this)->isFull();
+        }
+
+        inline bool isUnderfull() {
+            return leaf ? static_cast<LeafNode*>(this)->isUnderfull() :
+                static_cast<InnerNode*>(this)->isUnderfull();
+        }
     };
 
-    class InnerNode : public Node {
+    // size of the TID stored with a key in the leaves
+    static const bool   embeddedTIDs = EmbeddedTID<K>::enabled;
+    static const size_t tidSize      = embeddedTIDs ? 0 : sizeof(TID);
+
+    // keys of varying size are stored in slotted nodes, which compare them
+    // like memcmp
+    static const bool varKeys = std::is_same<K, std::string>::value;
+    static_assert(!varKeys || std::is_same<LESS, std::less<std::string>>::value,
+        "string keys must be compared with std::less");
+
+    class PlainInnerNode;
+    class SlottedInnerNode;
+    typedef typename std::conditional<varKeys,
+        SlottedInnerNode, PlainInnerNode>::type InnerNode;
+
+    // An inner node which stores the keys as they are
+    class PlainInnerNode : public Node {
         // calculate tree order n = 2k from page size
         static const size_t order =
             (blocksize - sizeof(Node) - sizeof(uint64_t)) /
@@ -35,10 +85,16 @@ class BTree : public Segment {
         K        keys[order];
         uint64_t children[order+1];
 
-        InnerNode() : Node(false) {};
+        PlainInnerNode() : Node(false) {};
 
       public:
-        InnerNode(uint64_t leftChild, uint64_t rightChild, K sep) : Node(false) {
+        // constructs a node with a single child, see append
+        PlainInnerNode(uint64_t child) : Node(false) {
+            children[0] = child;
+            this->count = 1;
+        };
+
+        PlainInnerNode(uint64_t leftChild, uint64_t rightChild, K sep) : Node(false) {
             keys[0]     = sep;
             children[0] = leftChild;
             children[1] = rightChild;
@@ -49,20 +105,119 @@ class BTree : public Segment {
             return this->count == order+1;
         }
 
+        inline bool isUnderfull() {
+            return this->count < (order+1)/4;
+        }
+
+        // maximum number of children, independent of the keys of the level
+        // the nodes are built from
+        inline static size_t getCapacity(const std::vector<std::pair<K, uint64_t>>&) {
+            return order+1;
+        }
+
+        // returns true if the node filled up to the fill factor can take
+        // another child
+        inline bool canAppend(K, double fillFactor) {
+            return this->count < std::max<size_t>(3, (order+1) * fillFactor);
+        }
+
+        // appends a child whose keys are all greater than sep, which is the
+        // maximum key of the current last child
+        inline void append(K sep, uint64_t child) {
+            keys[this->count-1]   = sep;
+            children[this->count] = child;
+            this->count++;
+        }
+
         inline K maxKey() {
             return keys[this->count-2];
         }
 
         unsigned getKeyIndex(K key) {
-            // compare less function
-            LESS less;
-            return std::lower_bound(keys, keys+this->count-1, key, less)-keys;
+            // an optimistic reader might see an inconsistent count
+            unsigned n = std::min<unsigned>(this->count, order+1);
+            n = n == 0 ? 0 : n-1;
+            return NodeSearch<K, LESS>::lowerBound(keys, n, key);
         }
 
         uint64_t getChild(K key) {
             return children[getKeyIndex(key)];
         }
 
+        inline uint64_t getChildAt(unsigned i) {
+            return children[i];
+        }
+
+        inline K getKey(unsigned i) {
+            return keys[i];
+        }
+
+        inline bool canSetKey(unsigned, K) {
+            return true;
+        }
+
+        inline void setKey(unsigned i, K key) {
+            keys[i] = key;
+        }
+
+        // removes the i-th child and the separator to its left neighbor
+        void removeChild(unsigned i) {
+            std::copy(keys+i, keys+this->count-1, keys+i-1);
+            std::copy(children+i+1, children+this->count, children+i);
+            this->count--;
+        }
+
+        // returns true if merging the right neighbor into this node leaves it
+        // at most half full
+        inline bool canMerge(PlainInnerNode* right, K) {
+            return this->count + right->count <= (order+1)/2;
+        }
+
+        // moves all children of the right neighbor to this node, sep is the
+        // separator of both nodes in the parent
+        void merge(PlainInnerNode* right, K sep) {
+            keys[this->count-1] = sep;
+            std::copy(right->keys, right->keys+right->count-1, keys+this->count);
+            std::copy(right->children, right->children+right->count, children+this->count);
+            this->count += right->count;
+        }
+
+        // distributes the children evenly between this node and its right
+        // neighbor and replaces their separator, the i-th key of the parent.
+        // Returns false if the children do not fit, which never happens for
+        // plain nodes
+        bool balance(PlainInnerNode* right, InnerNode* parent, unsigned i) {
+            unsigned leftCount = (this->count + right->count) / 2;
+            K        sep       = parent->getKey(i);
+
+            if (this->count < leftCount) {
+                // move the first children of the right neighbor
+                unsigned move = leftCount - this->count;
+                keys[this->count-1] = sep;
+                std::copy(right->keys, right->keys+move-1, keys+this->count);
+                std::copy(right->children, right->children+move, children+this->count);
+                sep = right->keys[move-1];
+
+                std::copy(right->keys+move, right->keys+right->count-1, right->keys);
+                std::copy(right->children+move, right->children+right->count, right->children);
+                right->count -= move;
+            } else {
+                // move the last children to the right neighbor
+                unsigned move = this->count - leftCount;
+                std::copy_backward(right->keys, right->keys+right->count-1, right->keys+right->count-1+move);
+                std::copy_backward(right->children, right->children+right->count, right->children+right->count+move);
+                right->keys[move-1] = sep;
+                std::copy(keys+leftCount, keys+this->count-1, right->keys);
+                std::copy(children+leftCount, children+this->count, right->children);
+                sep = keys[leftCount-1];
+                right->count += move;
+            }
+
+            this->count = leftCount;
+            parent->setKey(i, sep);
+            return true;
+        }
+
         void insert(K key, uint64_t child) {
             unsigned i = getKeyIndex(key);
 
@@ -87,7 +242,7 @@ class BTree : public Segment {
 
         // returns the separator key
         K split(BufferFrame& bf) {
-            InnerNode* newInner = new (bf.getData()) InnerNode();
+            PlainInnerNode* newInner = new (bf.getData()) PlainInnerNode();
 
             unsigned middle  = this->count / 2;
             this->count     -= middle;
@@ -101,33 +256,97 @@ class BTree : public Segment {
         }
     };
 
-    class LeafNode : public Node {
+    // A leaf which stores the keys as they are
+    class PlainLeafNode : public Node {
         // calculate tree order n = 2k from page size
         static const size_t order =
-            (blocksize - sizeof(Node)) /
-            (sizeof(K) + sizeof(TID));
+            (blocksize - sizeof(Node) - 2*sizeof(uint64_t) - (embeddedTIDs ? sizeof(TID) : 0)) /
+            (sizeof(K) + tidSize);
 
-        // TODO: next / prev leaf node
+        // neighboring leaves in key order or noPage
+        uint64_t prev;
+        uint64_t next;
 
+        // the TIDs are only stored if they are not part of the keys
         K   keys[order];
-        TID tids[order];
+        TID tids[embeddedTIDs ? 1 : order];
+
+        inline void setTID(unsigned i, TID tid) {
+            if (!embeddedTIDs) {
+                tids[i] = tid;
+            }
+        }
 
       public:
-        LeafNode() : Node(true) {};
+        PlainLeafNode() : Node(true), prev(noPage), next(noPage) {};
+
+        inline static bool isValidKey(const K&) {
+            return true;
+        }
+
+        inline K getKey(unsigned i) {
+            return keys[i];
+        }
+
+        inline TID getTIDAt(unsigned i) {
+            return embeddedTIDs ? EmbeddedTID<K>::get(keys[i]) : tids[i];
+        }
+
+        inline uint64_t getPrev() {
+            return prev;
+        }
+
+        inline uint64_t getNext() {
+            return next;
+        }
+
+        inline void setPrev(uint64_t pageID) {
+            prev = pageID;
+        }
+
+        inline void setNext(uint64_t pageID) {
+            next = pageID;
+        }
 
         inline bool isFull() {
             return this->count == order;
         }
 
+        inline bool isUnderfull() {
+            return this->count < order/4;
+        }
+
+        // the capacity of plain leaves does not depend on the keys
+        inline bool canInsert(K) {
+            return !isFull();
+        }
+
+        // returns true if the leaf filled up to the fill factor can take
+        // another entry
+        inline bool canAppend(K, double fillFactor) {
+            return this->count < std::max<size_t>(1, order * fillFactor);
+        }
+
+        // appends an entry with a key greater than all existing keys
+        inline void append(K key, TID tid) {
+            keys[this->count] = key;
+            setTID(this->count, tid);
+            this->count++;
+        }
+
+        // the count bounded by the order, which is safe to use for
+        // optimistic reads
+        inline unsigned getSafeCount() {
+            return std::min<unsigned>(this->count, order);
+        }
+
         inline K maxKey() {
             return keys[this->count-1];
         }
 
         // returns index of first existing key >= input key
         unsigned getKeyIndex(K key) {
-            // compare less function
-            LESS less;
-            return std::lower_bound(keys, keys+this->count, key, less)-keys;
+            return NodeSearch<K, LESS>::lowerBound(keys, getSafeCount(), key);
         }
 
         bool getTID(K key, TID& tid) {
@@ -136,11 +355,11 @@ class BTree : public Segment {
             // compare less function
             LESS less;
 
-            if(i == this->count || less(key, keys[i])) {
+            if(i == getSafeCount() || less(key, keys[i])) {
                 return false;
             }
 
-            tid = tids[i];
+            tid = getTIDAt(i);
             return true;
         }
 
@@ -150,244 +369,2211 @@ class BTree : public Segment {
                 // compare less function
                 LESS less;
                 if (!less(key, keys[i])) { // existing key? (checks other direction)
-                    tids[i] = tid; // overwrite existing value
+                    setTID(i, tid); // overwrite existing value
                     return;
                 } else {
                     // move existing entries
                     memmove(keys+i+1, keys+i, (this->count-i) * sizeof(K));
-                    memmove(tids+i+1, tids+i, (this->count-i) * sizeof(TID));
+                    memmove(tids+i+1, tids+i, (this->count-i) * tidSize);
                 }
             }
 
             // insert new entry
             keys[i] = key;
-            tids[i] = tid;
+            setTID(i, tid);
             this->count++;
         }
 
         // returns false if the key was not found
         bool remove(K key) {
             unsigned i = getKeyIndex(key);
-            if (i == this->count)
+
+            // compare less function
+            LESS less;
+            if (i == this->count || less(key, keys[i]))
                 return false;
 
             // move remaining entries
             memmove(keys+i, keys+i+1, (this->count-i-1) * sizeof(K));
-            memmove(tids+i, tids+i+1, (this->count-i-1) * sizeof(TID));
+            memmove(tids+i, tids+i+1, (this->count-i-1) * tidSize);
             this->count--;
             return true;
         }
 
-        K split(BufferFrame& bf) {
-            LeafNode* newLeaf = new (bf.getData()) LeafNode();
+        // returns true if merging the right neighbor into this leaf leaves it
+        // at most half full
+        inline bool canMerge(PlainLeafNode* right) {
+            return this->count + right->count <= order/2;
+        }
+
+        // moves all entries of the right neighbor to this leaf, which takes
+        // over its right link. The caller must link the new right neighbor
+        // back to this leaf
+        void merge(PlainLeafNode* right) {
+            std::copy(right->keys, right->keys+right->count, keys+this->count);
+            if (!embeddedTIDs)
+                std::copy(right->tids, right->tids+right->count, tids+this->count);
+            this->count += right->count;
+            next = right->next;
+        }
+
+        // distributes the entries evenly between this leaf and its right
+        // neighbor and replaces their separator, the i-th key of the parent.
+        // Returns false if the entries do not fit, which never happens for
+        // plain leaves
+        bool balance(PlainLeafNode* right, InnerNode* parent, unsigned i) {
+            unsigned leftCount = (this->count + right->count) / 2;
+
+            if (this->count < leftCount) {
+                // move the first entries of the right neighbor
+                unsigned move = leftCount - this->count;
+                std::copy(right->keys, right->keys+move, keys+this->count);
+                std::copy(right->keys+move, right->keys+right->count, right->keys);
+                if (!embeddedTIDs) {
+                    std::copy(right->tids, right->tids+move, tids+this->count);
+                    std::copy(right->tids+move, right->tids+right->count, right->tids);
+                }
+                right->count -= move;
+            } else {
+                // move the last entries to the right neighbor
+                unsigned move = this->count - leftCount;
+                std::copy_backward(right->keys, right->keys+right->count, right->keys+right->count+move);
+                std::copy(keys+leftCount, keys+this->count, right->keys);
+                if (!embeddedTIDs) {
+                    std::copy_backward(right->tids, right->tids+right->count, right->tids+right->count+move);
+                    std::copy(tids+leftCount, tids+this->count, right->tids);
+                }
+                right->count += move;
+            }
+
+            this->count = leftCount;
+            parent->setKey(i, maxKey());
+            return true;
+        }
+
+        // moves the upper half of the entries to a new leaf on the given page,
+        // which becomes the right neighbor of this leaf. The caller must link
+        // the former right neighbor back to the new leaf
+        K split(BufferFrame& bf, uint64_t pageID) {
+            PlainLeafNode* newLeaf = new (bf.getData()) PlainLeafNode();
+            newLeaf->prev = pageID;
+            newLeaf->next = next;
+            next          = getPageID(bf);
 
             unsigned middle = this->count / 2;
             this->count    -= middle;
             newLeaf->count  = middle;
 
             // move keys and TIDs to the new leaf
-            K*   keyStart = keys+this->count;
-            TID* tidStart = tids+this->count;
+            K* keyStart = keys+this->count;
             std::copy(keyStart, keyStart+middle, newLeaf->keys);
-            std::copy(tidStart, tidStart+middle, newLeaf->tids);
+            if (!embeddedTIDs) {
+                TID* tidStart = tids+this->count;
+                std::copy(tidStart, tidStart+middle, newLeaf->tids);
+            }
 
             return maxKey();
         }
     };
 
-  public:
-    BTree(BufferManager& bm, uint64_t id) : Segment(bm, id), root(0) {
-        // TODO: pageID  | (&SegmentID + shiften n stuff)
+    // A leaf which stores the keys normalized (see KeyNormalizer) without the
+    // prefix all of its keys share. The first 4 bytes after the prefix are
+    // stored as integer heads, which are searched first, the remaining bytes
+    // of a key only break ties. The longer the common prefix, the more
+    // entries fit into the leaf, thus the capacity depends on the keys.
+    // The data area holds the TIDs, unless they are part of the keys, the
+    // heads and the remaining bytes
+    class PrefixLeafNode : public Node {
+        typedef KeyNormalizer<K, LESS> Normalizer;
+
+        static const unsigned keySize  = Normalizer::size;
+        static const unsigned headSize = sizeof(uint32_t);
+        static const size_t   dataSize =
+            blocksize - sizeof(Node) - 2*sizeof(uint64_t) - sizeof(uint32_t) - keySize;
+
+        // neighboring leaves in key order or noPage
+        uint64_t prev;
+        uint64_t next;
+
+        uint32_t prefixLen;
+        uint8_t  data[dataSize];
+        uint8_t  prefix[keySize];
+
+        // bytes of a key stored after its head
+        inline static unsigned getRestSize(unsigned prefixLen) {
+            unsigned suffix = keySize - (prefixLen < keySize ? prefixLen : keySize);
+            return suffix > headSize ? suffix - headSize : 0;
+        }
 
-        static_assert(sizeof(LeafNode) <= blocksize, "LeafNode size exceeds page size");
-        static_assert(sizeof(InnerNode) <= blocksize, "InnerNode size exceeds page size");
+        inline static size_t getCapacity(unsigned prefixLen) {
+            return dataSize / (headSize + tidSize + getRestSize(prefixLen));
+        }
 
-        // init root node
-        BufferFrame&  bf      = bm.fixPage(root, true);
-        void*         dataPtr = bf.getData();
-        new (dataPtr) LeafNode();
-        bm.unfixPage(bf, true);
-        size = 1;
-    };
+        // the prefix length bounded by the key size, which is safe to use
+        // for optimistic reads
+        inline unsigned getPrefixLen() {
+            return (prefixLen < keySize ? prefixLen : keySize);
+        }
 
-    /*
-    Lookup:
-    1. start with the root node
-    2. is the current node a leaf?
-        > if yes, return the current page (locate the entry on it)
-    3. find the first entry ≥ search key (binary search)
-    4. if no such entry is found, go the upper, otherwise go to the corresponding page
-    5. continue with 2
-    */
-    bool lookup(K key, TID& tid) {
-        LeafNode*    leaf;
-        BufferFrame& bf = findLeaf(key, false, &leaf);
+        inline TID* tids() {
+            return reinterpret_cast<TID*>(data);
+        }
 
-        bool found = leaf->getTID(key, tid);
-        bm.unfixPage(bf, false);
-        return found;
-    }
+        inline uint32_t* heads() {
+            return reinterpret_cast<uint32_t*>(data + getCapacity(getPrefixLen()) * tidSize);
+        }
 
+        inline uint8_t* rest(unsigned i) {
+            size_t capacity = getCapacity(getPrefixLen());
+            return data + capacity * (headSize + tidSize) + i * getRestSize(getPrefixLen());
+        }
 
-    /*
-    Insert:
-    1. lookup the appropriate leaf page
-    2. is there free space on the leaf
-        > if yes, insert entry and stop
-    3. split the leaf into two, insert entry on proper side
-    4. insert maximum of left page as separator into parent
-    5. if the parent overflow, split parent and continue with 4
-    6. create a new root if needed
-    */
-    void insert(K key, TID tid) {
-        BufferFrame* bf      = &bm.fixPage(root, true);
-        bool         bfDirty = false;
-        Node*        node    = static_cast<Node*>(bf->getData());
+        inline void setTID(unsigned i, TID tid) {
+            if (!embeddedTIDs) {
+                tids()[i] = tid;
+            }
+        }
 
-        // parent
-        BufferFrame* bfPar    = NULL;  // root has no parent
-        bool         parDirty = false; // was the page modified?
+        // the head of a normalized key is the big-endian integer of the
+        // first bytes after the prefix, padded with zeros
+        inline static uint32_t getHead(const uint8_t* key, unsigned prefixLen) {
+            uint32_t head = 0;
+            for (unsigned i = prefixLen; i < prefixLen + headSize; i++) {
+                head = (head << 8) | (i < keySize ? key[i] : 0);
+            }
+            return head;
+        }
 
-        // uses "safe" inner pages: split all full nodes on the way down
-        while(true) {
-            if (node->isFull()) { // must split current node
-                // open a new page where the new node will be written to
-                uint64_t     newID = reservePage();
-                BufferFrame* bfNew = &bm.fixPage(newID, true);
-
-                K separator;
-                if (node->isLeaf()) {
-                    // construct new leaf and move half of the entries
-                    LeafNode* oldLeaf = reinterpret_cast<LeafNode*>(node);
-                    separator = oldLeaf->split(*bfNew);
-                } else {
-                    // construct new inner node and move half of the entries
-                    InnerNode* oldInner = reinterpret_cast<InnerNode*>(node);
-                    separator = oldInner->split(*bfNew);
-                }
+        // length of the common prefix of two normalized keys
+        inline static unsigned commonPrefix(const uint8_t* a, const uint8_t* b, unsigned len) {
+            unsigned i = 0;
+            while (i < len && a[i] == b[i]) {
+                i++;
+            }
+            return i;
+        }
+
+        // restores the i-th normalized key
+        void decode(unsigned i, uint8_t* key) {
+            unsigned len  = getPrefixLen();
+            uint32_t head = heads()[i];
+            memcpy(key, prefix, len);
+            for (unsigned j = 0; j < headSize && len+j < keySize; j++) {
+                key[len+j] = static_cast<uint8_t>(head >> ((headSize-1-j) * 8));
+            }
+            memcpy(key + len + headSize, rest(i), getRestSize(len));
+        }
 
-                // check if splitted node is the root
-                if (bfPar == NULL) {
-                    // reserve another page to move the old root to
-                    uint64_t     moveID = reservePage();
-                    BufferFrame* bfMove = &bm.fixPage(moveID, true);
+        // stores the normalized key at position i, it must share the prefix
+        void encode(unsigned i, const uint8_t* key) {
+            heads()[i] = getHead(key, getPrefixLen());
+            memcpy(rest(i), key + getPrefixLen() + headSize, getRestSize(getPrefixLen()));
+        }
 
-                    // move current root node to the new page
-                    memcpy(bfMove->getData(), bf->getData(), blocksize);
+        // Compares the normalized key with the i-th key after the prefix
+        int compare(unsigned i, const uint8_t* key) {
+            uint32_t head = getHead(key, getPrefixLen());
+            if (head != heads()[i]) {
+                return head < heads()[i] ? -1 : 1;
+            }
+            return memcmp(key + getPrefixLen() + headSize, rest(i), getRestSize(getPrefixLen()));
+        }
 
-                    // init new root and insert old root as leftmost child
-                    new (bf->getData()) InnerNode(moveID, bfNew->getID(), separator);
+        // Replaces all entries by the given sorted entries and derives the
+        // prefix from them
+        void rebuild(const uint8_t* keys, const TID* entryTIDs, unsigned count) {
+            prefixLen = count == 0 ? 0 :
+                commonPrefix(keys, keys + (count-1)*keySize, keySize);
+            memcpy(prefix, keys, prefixLen);
+
+            this->count = count;
+            for (unsigned i = 0; i < count; i++) {
+                encode(i, keys + i*keySize);
+                setTID(i, entryTIDs[i]);
+            }
+        }
 
-                    bfPar    = bf;
-                    bf       = bfMove;
-                    bfDirty  = true;
-                    parDirty = true;
-                } else {
-                    // update parent
-                    InnerNode* parent = static_cast<InnerNode*>(bfPar->getData());
+        // Copies all normalized keys and TIDs to the given buffers, offset
+        // entries into them
+        void decodeAll(std::vector<uint8_t>& keys, std::vector<TID>& entryTIDs, unsigned offset = 0) {
+            keys.resize((offset + this->count) * keySize);
+            entryTIDs.resize(offset + this->count);
+            for (unsigned i = 0; i < this->count; i++) {
+                decode(i, &keys[(offset+i) * keySize]);
+                entryTIDs[offset+i] = embeddedTIDs ? TID() : tids()[i];
+            }
+        }
 
-                    parent->insert(separator, bfNew->getID());
-                    bfDirty  = true;
-                    parDirty = true;
-                }
+        // the prefix length after adding the normalized key
+        inline unsigned getPrefixLen(const uint8_t* key) {
+            return this->count == 0 ? keySize : commonPrefix(prefix, key, getPrefixLen());
+        }
+
+      public:
+        PrefixLeafNode() : Node(true), prev(noPage), next(noPage), prefixLen(0) {};
+
+        inline static bool isValidKey(const K&) {
+            return true;
+        }
+
+        inline K getKey(unsigned i) {
+            uint8_t key[keySize];
+            decode(i, key);
+            return Normalizer::denormalize(key);
+        }
+
+        inline TID getTIDAt(unsigned i) {
+            return embeddedTIDs ? EmbeddedTID<K>::get(getKey(i)) : tids()[i];
+        }
+
+        inline uint64_t getPrev() {
+            return prev;
+        }
+
+        inline uint64_t getNext() {
+            return next;
+        }
+
+        inline void setPrev(uint64_t pageID) {
+            prev = pageID;
+        }
+
+        inline void setNext(uint64_t pageID) {
+            next = pageID;
+        }
+
+        inline bool isFull() {
+            return this->count == getCapacity(getPrefixLen());
+        }
+
+        inline bool isUnderfull() {
+            return this->count < getCapacity(getPrefixLen())/4;
+        }
+
+        // returns true if the key fits into the leaf without splitting it
+        bool canInsert(K key) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            return this->count < getCapacity(getPrefixLen(nkey));
+        }
+
+        // returns true if the leaf filled up to the fill factor can take
+        // another entry
+        bool canAppend(K key, double fillFactor) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            return this->count < std::max<size_t>(1, getCapacity(getPrefixLen(nkey)) * fillFactor);
+        }
+
+        // appends an entry with a key greater than all existing keys
+        void append(K key, TID tid) {
+            insert(key, tid);
+        }
+
+        // the count bounded by the capacity, which is safe to use for
+        // optimistic reads
+        inline unsigned getSafeCount() {
+            return std::min<size_t>(this->count, getCapacity(getPrefixLen()));
+        }
+
+        inline K maxKey() {
+            return getKey(this->count-1);
+        }
+
+        // returns index of first existing key >= input key
+        unsigned getKeyIndex(K key) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            return getKeyIndex(nkey);
+        }
+
+        unsigned getKeyIndex(const uint8_t* key) {
+            unsigned n   = getSafeCount();
+            int      cmp = memcmp(key, prefix, getPrefixLen());
+            if (cmp != 0) {
+                return cmp < 0 ? 0 : n;
+            }
+
+            // find the keys with the same head, only they are compared in full
+            typedef NodeSearch<uint32_t, std::less<uint32_t>> HeadSearch;
+            uint32_t head = getHead(key, getPrefixLen());
+            unsigned lo   = HeadSearch::lowerBound(heads(), n, head);
+            if (getRestSize(getPrefixLen()) == 0) {
+                return lo;
+            }
 
-                // insert entry
-                if (!less(separator, key)) { // key <= oldMax
-                    bm.unfixPage(*bfNew, true);
-                    bfNew = NULL;
+            unsigned hi = head == UINT32_MAX ? n : HeadSearch::lowerBound(heads(), n, head+1);
+            while (lo < hi) {
+                unsigned middle = lo + (hi - lo) / 2;
+                if (compare(middle, key) > 0) {
+                    lo = middle + 1;
                 } else {
-                    bm.unfixPage(*bf, true);
-                    bf = bfNew;
+                    hi = middle;
                 }
-                node  = static_cast<Node*>(bf->getData());
+            }
+            return lo;
+        }
 
-            } else { // enough space
-                if (node->isLeaf()) {
-                    // found the leaf where the entry must be inserted
-                    LeafNode* leaf = reinterpret_cast<LeafNode*>(node);
-                    leaf->insert(key, tid);
+        bool getTID(K key, TID& tid) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            unsigned i = getKeyIndex(nkey);
 
-                    if (bfPar != NULL) {
-                        bm.unfixPage(*bfPar, parDirty);
-                    }
+            if (i == getSafeCount() || memcmp(nkey, prefix, getPrefixLen()) != 0 || compare(i, nkey) != 0) {
+                return false;
+            }
 
-                    bm.unfixPage(*bf, true);
-                    return;
-                } else {
-                    // traverse without splitting
-                    InnerNode* inner  = reinterpret_cast<InnerNode*>(node);
-                    uint64_t   nextID = inner->getChild(key);
-
-                    // lock coupling: fix child before releasing parent
-                    BufferFrame* bfNew = &bm.fixPage(nextID, true);
-                    if (bfPar != NULL) {
-                        bm.unfixPage(*bfPar, parDirty);
-                    }
+            tid = embeddedTIDs ? EmbeddedTID<K>::get(key) : tids()[i];
+            return true;
+        }
 
-                    bfPar    = bf;
-                    bf       = bfNew;
-                    parDirty = bfDirty;
-                    bfDirty  = false;
+        void insert(K key, TID tid) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            unsigned i = getKeyIndex(nkey);
 
-                    node = static_cast<Node*>(bf->getData());
-                }
+            if (i < this->count && memcmp(nkey, prefix, getPrefixLen()) == 0 && compare(i, nkey) == 0) {
+                setTID(i, tid); // overwrite existing value
+                return;
             }
+
+            if (getPrefixLen(nkey) < getPrefixLen()) {
+                // the key does not share the prefix, the shorter prefix
+                // changes the layout of all entries
+                std::vector<uint8_t> keys;
+                std::vector<TID>     entryTIDs;
+                decodeAll(keys, entryTIDs);
+                keys.insert(keys.begin() + i*keySize, nkey, nkey + keySize);
+                entryTIDs.insert(entryTIDs.begin() + i, tid);
+                rebuild(keys.data(), entryTIDs.data(), this->count + 1);
+                return;
+            }
+            if (this->count == 0) {
+                prefixLen = keySize;
+                memcpy(prefix, nkey, keySize);
+            }
+
+            // move existing entries
+            unsigned restSize = getRestSize(getPrefixLen());
+            std::copy_backward(heads()+i, heads()+this->count, heads()+this->count+1);
+            memmove(tids()+i+1, tids()+i, (this->count-i) * tidSize);
+            memmove(rest(i+1), rest(i), (this->count-i) * restSize);
+
+            // insert new entry
+            encode(i, nkey);
+            setTID(i, tid);
+            this->count++;
         }
-    };
 
+        // returns false if the key was not found
+        bool remove(K key) {
+            uint8_t nkey[keySize];
+            Normalizer::normalize(key, nkey);
+            unsigned i = getKeyIndex(nkey);
 
-    /*
-    Delete
-    1. lookup the appropriate leaf page
-    2. remove the entry from the current page
-    3. is the current page at least half full?
-        > if yes, stop
-    4. is the neighboring page more than half full?
-        > if yes, balance both pages, update separator, and stop
-    5. merge neighboring page into current page
-    6. remove the separator from the parent, continue with 3
-    */
-    bool erase(K key) {
-        LeafNode*    leaf;
-        BufferFrame& bf   = findLeaf(key, true, &leaf);
+            if (i == this->count || memcmp(nkey, prefix, getPrefixLen()) != 0 || compare(i, nkey) != 0)
+                return false;
 
-        bool found = leaf->remove(key);
-        bm.unfixPage(bf, found);
-        // TODO: re-balancing
-        return found;
-    };
+            // move remaining entries, the prefix stays valid
+            unsigned restSize = getRestSize(getPrefixLen());
+            std::copy(heads()+i+1, heads()+this->count, heads()+i);
+            memmove(tids()+i, tids()+i+1, (this->count-i-1) * tidSize);
+            memmove(rest(i), rest(i+1), (this->count-i-1) * restSize);
+            this->count--;
+            return true;
+        }
 
-  private:
-    uint64_t root;
+        // returns true if merging the right neighbor into this leaf leaves it
+        // at most half full
+        bool canMerge(PrefixLeafNode* right) {
+            if (this->count == 0 || right->count == 0) {
+                return this->count + right->count <= getCapacity(keySize)/2;
+            }
 
-    // Finds the leaf for the given key
-    // Returns the respective BufferFrame containing the leaf
-    BufferFrame& findLeaf(K& key, bool exclusive, LeafNode** leafPtr) {
-        // get root node
-        BufferFrame* bf     = &bm.fixPage(root, exclusive);
-        Node*        node   = static_cast<Node*>(bf->getData());
+            uint8_t first[keySize];
+            uint8_t last[keySize];
+            decode(0, first);
+            right->decode(right->count-1, last);
+            unsigned len = commonPrefix(first, last, keySize);
+            return this->count + right->count <= getCapacity(len)/2;
+        }
 
-        // find leaf
-        while(!node->isLeaf()) {
-            InnerNode* inner  = reinterpret_cast<InnerNode*>(node);
-            uint64_t   nextID = inner->getChild(key);
+        // moves all entries of the right neighbor to this leaf, which takes
+        // over its right link. The caller must link the new right neighbor
+        // back to this leaf
+        void merge(PrefixLeafNode* right) {
+            std::vector<uint8_t> keys;
+            std::vector<TID>     entryTIDs;
+            decodeAll(keys, entryTIDs);
+            right->decodeAll(keys, entryTIDs, this->count);
+            rebuild(keys.data(), entryTIDs.data(), entryTIDs.size());
+            next = right->next;
+        }
+
+        // distributes the entries evenly between this leaf and its right
+        // neighbor and replaces their separator, the i-th key of the parent.
+        // Returns false and leaves all nodes unchanged if the halves would not
+        // fit or stay underfull, as the capacity of each half depends on its
+        // prefix
+        bool balance(PrefixLeafNode* right, InnerNode* parent, unsigned i) {
+            std::vector<uint8_t> keys;
+            std::vector<TID>     entryTIDs;
+            decodeAll(keys, entryTIDs);
+            right->decodeAll(keys, entryTIDs, this->count);
+
+            unsigned total     = entryTIDs.size();
+            unsigned leftCount = total / 2;
+            const uint8_t* k   = keys.data();
+
+            unsigned leftLen  = commonPrefix(k, k + (leftCount-1)*keySize, keySize);
+            unsigned rightLen = commonPrefix(k + leftCount*keySize, k + (total-1)*keySize, keySize);
+            if (leftCount > getCapacity(leftLen) || total - leftCount > getCapacity(rightLen) ||
+                    leftCount < getCapacity(leftLen)/4 || total - leftCount < getCapacity(rightLen)/4) {
+                return false;
+            }
 
-            // lock coupling: fix child before releasing parent
-            BufferFrame* bfNew = &bm.fixPage(nextID, exclusive);
-            bm.unfixPage(*bf, false);
-            bf = bfNew;
+            K sep = Normalizer::denormalize(k + (leftCount-1)*keySize);
+            if (!parent->canSetKey(i, sep)) {
+                return false;
+            }
 
-            node = static_cast<Node*>(bf->getData());
+            rebuild(k, entryTIDs.data(), leftCount);
+            right->rebuild(k + leftCount*keySize, entryTIDs.data() + leftCount, total - leftCount);
+            parent->setKey(i, sep);
+            return true;
         }
 
-        *leafPtr = reinterpret_cast<LeafNode*>(node);
-        return *bf;
-    }
+        // moves the upper half of the entries to a new leaf on the given page,
+        // which becomes the right neighbor of this leaf. The caller must link
+        // the former right neighbor back to the new leaf
+        K split(BufferFrame& bf, uint64_t pageID) {
+            PrefixLeafNode* newLeaf = new (bf.getData()) PrefixLeafNode();
+            newLeaf->prev = pageID;
+            newLeaf->next = next;
+            next          = getPageID(bf);
 
-    uint64_t reservePage() {
-        // size is atomic
-        // TODO: | segmentID + shiften
-        return size++;
+            std::vector<uint8_t> keys;
+            std::vector<TID>     entryTIDs;
+            decodeAll(keys, entryTIDs);
+
+            // both halves get their own, possibly longer prefix
+            unsigned middle = this->count / 2;
+            unsigned left   = this->count - middle;
+            rebuild(keys.data(), entryTIDs.data(), left);
+            newLeaf->rebuild(keys.data() + left*keySize, entryTIDs.data() + left, middle);
+
+            return maxKey();
+        }
+    };
+
+    // Keys of varying size are stored in slotted nodes: the slots grow from
+    // the front of the data area, the key bytes from its end. Besides the
+    // offset and the size of its key, a slot holds the first 4 bytes of the
+    // key as integer head, which decides most comparisons without touching
+    // the key bytes, and the payload of the entry. Removed keys leave holes,
+    // which are compacted once the space in between is exhausted
+    template <class Payload, size_t dataSize>
+    class SlottedNode : public Node {
+      protected:
+        struct Slot {
+            uint32_t head;
+            uint16_t offset;
+            uint16_t size;
+            Payload  payload;
+        };
+
+        uint32_t heapStart; // offset of the first key byte
+        uint32_t heapSize;  // bytes of all keys
+
+        alignas(Slot) uint8_t data[dataSize];
+
+        SlottedNode(bool leaf) : Node(leaf), heapStart(dataSize), heapSize(0) {};
+
+        inline Slot* slots() {
+            return reinterpret_cast<Slot*>(data);
+        }
+
+        // the head of a key is the big-endian integer of its first bytes,
+        // padded with zeros
+        inline static uint32_t getHead(const std::string& key) {
+            uint32_t head = 0;
+            for (unsigned i = 0; i < sizeof(uint32_t); i++) {
+                head = (head << 8) | (i < key.size() ? static_cast<uint8_t>(key[i]) : 0);
+            }
+            return head;
+        }
+
+        // the bytes of the i-th key, bounded by the data area, which is safe
+        // to use for optimistic reads
+        inline const uint8_t* getKeyData(unsigned i, size_t& size) {
+            size_t offset = std::min<size_t>(slots()[i].offset, dataSize);
+            size = std::min<size_t>(slots()[i].size, dataSize - offset);
+            return data + offset;
+        }
+
+        // Compares the key with the i-th key like memcmp
+        int compare(unsigned i, const std::string& key) {
+            uint32_t head = getHead(key);
+            if (head != slots()[i].head) {
+                return head < slots()[i].head ? -1 : 1;
+            }
+
+            size_t         size;
+            const uint8_t* bytes = getKeyData(i, size);
+            int cmp = memcmp(key.data(), bytes, std::min(key.size(), size));
+            if (cmp != 0) {
+                return cmp;
+            }
+            return key.size() < size ? -1 : (key.size() > size ? 1 : 0);
+        }
+
+        // returns index of the first of the first n keys >= input key
+        unsigned lowerBound(const std::string& key, unsigned n) {
+            unsigned lo = 0;
+            while (lo < n) {
+                unsigned middle = lo + (n - lo) / 2;
+                if (compare(middle, key) > 0) {
+                    lo = middle + 1;
+                } else {
+                    n = middle;
+                }
+            }
+            return lo;
+        }
+
+        // bytes used by the slots and the keys
+        inline size_t getUsedSpace() {
+            return this->count * sizeof(Slot) + heapSize;
+        }
+
+        inline size_t getFreeSpace() {
+            return dataSize - getUsedSpace();
+        }
+
+        // returns true if an entry with a key of the given size fits
+        inline bool fits(size_t keySize) {
+            return getFreeSpace() >= sizeof(Slot) + keySize;
+        }
+
+        // moves all keys to the end of the data area, closing the holes
+        void compact() {
+            uint8_t  buffer[dataSize];
+            uint32_t start = dataSize;
+            for (unsigned i = 0; i < this->count; i++) {
+                Slot& slot = slots()[i];
+                start -= slot.size;
+                memcpy(buffer + start, data + slot.offset, slot.size);
+                slot.offset = start;
+            }
+            memcpy(data + start, buffer + start, dataSize - start);
+            heapStart = start;
+        }
+
+        // makes sure that the given number of bytes is free between the slots
+        // and the keys, the bytes must fit
+        void reserve(size_t size) {
+            if (heapStart < this->count * sizeof(Slot) + size) {
+                compact();
+            }
+        }
+
+        // stores the key bytes in front of the other keys, the space must be
+        // reserved
+        uint16_t store(const std::string& key) {
+            heapStart -= key.size();
+            heapSize  += key.size();
+            memcpy(data + heapStart, key.data(), key.size());
+            return heapStart;
+        }
+
+        // inserts an entry at position i, it must fit
+        void insertAt(unsigned i, const std::string& key, Payload payload) {
+            reserve(sizeof(Slot) + key.size());
+            memmove(slots()+i+1, slots()+i, (this->count-i) * sizeof(Slot));
+            this->count++;
+            Slot& slot   = slots()[i];
+            slot.offset  = store(key);
+            slot.size    = key.size();
+            slot.head    = getHead(key);
+            slot.payload = payload;
+        }
+
+        void removeAt(unsigned i) {
+            heapSize -= slots()[i].size;
+            memmove(slots()+i, slots()+i+1, (this->count-i-1) * sizeof(Slot));
+            this->count--;
+        }
+
+        // replaces the i-th key, the new key must fit
+        void setKeyAt(unsigned i, const std::string& key) {
+            // the former key bytes are not kept by a compaction
+            Slot& slot  = slots()[i];
+            heapSize   -= slot.size;
+            slot.size   = 0;
+            reserve(key.size());
+            slot.offset = store(key);
+            slot.size   = key.size();
+            slot.head   = getHead(key);
+        }
+
+        inline std::string getKeyAt(unsigned i) {
+            size_t         size;
+            const uint8_t* bytes = getKeyData(i, size);
+            return std::string(reinterpret_cast<const char*>(bytes), size);
+        }
+
+        // appends all entries to the given vector
+        void getEntries(std::vector<std::pair<std::string, Payload>>& entries) {
+            for (unsigned i = 0; i < this->count; i++) {
+                entries.push_back(std::make_pair(getKeyAt(i), slots()[i].payload));
+            }
+        }
+
+        // replaces all entries by the given ones, which must fit
+        void setEntries(typename std::vector<std::pair<std::string, Payload>>::const_iterator begin,
+                typename std::vector<std::pair<std::string, Payload>>::const_iterator end) {
+            this->count = 0;
+            heapStart   = dataSize;
+            heapSize    = 0;
+            for (auto it = begin; it != end; ++it) {
+                insertAt(this->count, it->first, it->second);
+            }
+        }
+
+        // bytes the given entries use in a node
+        inline static size_t getEntriesSize(typename std::vector<std::pair<std::string, Payload>>::const_iterator begin,
+                typename std::vector<std::pair<std::string, Payload>>::const_iterator end) {
+            size_t size = 0;
+            for (auto it = begin; it != end; ++it) {
+                size += sizeof(Slot) + it->first.size();
+            }
+            return size;
+        }
+
+        // returns the number of the first entries, which use about half of
+        // the space of all entries, but at least one and not all of them
+        static unsigned getMiddle(const std::vector<std::pair<std::string, Payload>>& entries) {
+            size_t   half = getEntriesSize(entries.begin(), entries.end()) / 2;
+            size_t   size = 0;
+            unsigned i    = 0;
+            while (i+2 < entries.size() && size + sizeof(Slot) + entries[i].first.size() <= half) {
+                size += sizeof(Slot) + entries[i].first.size();
+                i++;
+            }
+            return std::max(i, 1u);
+        }
+
+      public:
+        // maximum size of a key, a node which is not full can take any key
+        static const size_t maxKeySize = blocksize / 16;
+
+        // the count bounded by the data area, which is safe to use for
+        // optimistic reads
+        inline unsigned getSafeCount() {
+            return std::min<size_t>(this->count, dataSize / sizeof(Slot));
+        }
+
+        inline bool isFull() {
+            return !fits(maxKeySize);
+        }
+
+        inline bool isUnderfull() {
+            return getUsedSpace() < dataSize/4;
+        }
+    };
+
+    static const size_t slottedInnerSize = blocksize - sizeof(Node) - 2*sizeof(uint32_t);
+
+    // An inner node for keys of varying size. The i-th slot holds the i-th
+    // child and the separator to its right neighbor, the last separator is
+    // empty
+    class SlottedInnerNode : public SlottedNode<uint64_t, slottedInnerSize> {
+        typedef SlottedNode<uint64_t, slottedInnerSize> Base;
+        typedef std::vector<std::pair<std::string, uint64_t>> Entries;
+
+        SlottedInnerNode() : Base(false) {};
+
+      public:
+        // constructs a node with a single child, see append
+        SlottedInnerNode(uint64_t child) : Base(false) {
+            this->insertAt(0, std::string(), child);
+        };
+
+        SlottedInnerNode(uint64_t leftChild, uint64_t rightChild, const K& sep) : Base(false) {
+            this->insertAt(0, sep, leftChild);
+            this->insertAt(1, std::string(), rightChild);
+        };
+
+        // estimated number of children, from the average size of the keys of
+        // the level the nodes are built from
+        static size_t getCapacity(const std::vector<std::pair<K, uint64_t>>& level) {
+            size_t keys = 0;
+            for (auto& entry : level) {
+                keys += entry.first.size();
+            }
+            return slottedInnerSize / (sizeof(typename Base::Slot) + keys / level.size());
+        }
+
+        // returns true if the node filled up to the fill factor can take
+        // another child
+        inline bool canAppend(const K& sep, double fillFactor) {
+            size_t size = this->getUsedSpace() + sizeof(typename Base::Slot) + sep.size();
+            return this->fits(sep.size()) &&
+                (this->count < 3 || size <= slottedInnerSize * fillFactor);
+        }
+
+        // appends a child whose keys are all greater than sep, which is the
+        // maximum key of the current last child
+        inline void append(const K& sep, uint64_t child) {
+            this->setKeyAt(this->count-1, sep);
+            this->insertAt(this->count, std::string(), child);
+        }
+
+        inline K maxKey() {
+            return this->getKeyAt(this->count-2);
+        }
+
+        unsigned getKeyIndex(const K& key) {
+            unsigned n = this->getSafeCount();
+            return this->lowerBound(key, n == 0 ? 0 : n-1);
+        }
+
+        uint64_t getChild(const K& key) {
+            return this->slots()[getKeyIndex(key)].payload;
+        }
+
+        inline uint64_t getChildAt(unsigned i) {
+            return this->slots()[i].payload;
+        }
+
+        inline K getKey(unsigned i) {
+            return this->getKeyAt(i);
+        }
+
+        inline bool canSetKey(unsigned i, const K& key) {
+            return this->getFreeSpace() + this->slots()[i].size >= key.size();
+        }
+
+        inline void setKey(unsigned i, const K& key) {
+            this->setKeyAt(i, key);
+        }
+
+        // removes the i-th child and the separator to its left neighbor
+        void removeChild(unsigned i) {
+            this->slots()[i].payload = this->slots()[i-1].payload;
+            this->removeAt(i-1);
+        }
+
+        // returns true if merging the right neighbor into this node leaves it
+        // at most half full
+        inline bool canMerge(SlottedInnerNode* right, const K& sep) {
+            return this->getUsedSpace() + right->getUsedSpace() + sep.size() <= slottedInnerSize/2;
+        }
+
+        // moves all children of the right neighbor to this node, sep is the
+        // separator of both nodes in the parent
+        void merge(SlottedInnerNode* right, const K& sep) {
+            this->setKeyAt(this->count-1, sep);
+            for (unsigned i = 0; i < right->count; i++) {
+                this->insertAt(this->count, right->getKeyAt(i), right->slots()[i].payload);
+            }
+        }
+
+        // distributes the children evenly between this node and its right
+        // neighbor and replaces their separator, the i-th key of the parent.
+        // Returns false and leaves all nodes unchanged if the separators do
+        // not fit or a node would stay underfull
+        bool balance(SlottedInnerNode* right, InnerNode* parent, unsigned i) {
+            Entries entries;
+            this->getEntries(entries);
+            entries.back().first = parent->getKey(i);
+            right->getEntries(entries);
+
+            // the separator of the last child on the left moves up
+            unsigned middle = Base::getMiddle(entries);
+            K        sep    = entries[middle-1].first;
+            entries[middle-1].first.clear();
+
+            size_t leftSize  = Base::getEntriesSize(entries.begin(), entries.begin()+middle);
+            size_t rightSize = Base::getEntriesSize(entries.begin()+middle, entries.end());
+            if (leftSize > slottedInnerSize || rightSize > slottedInnerSize ||
+                    leftSize < slottedInnerSize/4 || rightSize < slottedInnerSize/4 ||
+                    !parent->canSetKey(i, sep)) {
+                return false;
+            }
+
+            this->setEntries(entries.begin(), entries.begin()+middle);
+            right->setEntries(entries.begin()+middle, entries.end());
+            parent->setKey(i, sep);
+            return true;
+        }
+
+        void insert(const K& key, uint64_t child) {
+            unsigned i = getKeyIndex(key);
+
+            if (i < this->count-1 && this->compare(i, key) == 0) {
+                this->slots()[i].payload = child; // overwrite existing value
+                return;
+            }
+
+            // the new key separates the former child at i from the new one
+            this->insertAt(i, key, this->slots()[i].payload);
+            this->slots()[i+1].payload = child;
+        }
+
+        // returns the separator key
+        K split(BufferFrame& bf) {
+            SlottedInnerNode* newInner = new (bf.getData()) SlottedInnerNode();
+
+            Entries entries;
+            this->getEntries(entries);
+            unsigned middle = Base::getMiddle(entries);
+            K        sep    = entries[middle-1].first;
+            entries[middle-1].first.clear();
+
+            this->setEntries(entries.begin(), entries.begin()+middle);
+            newInner->setEntries(entries.begin()+middle, entries.end());
+            return sep;
+        }
+    };
+
+    static const size_t slottedLeafSize = blocksize - sizeof(Node) - 2*sizeof(uint32_t) - 2*sizeof(uint64_t);
+
+    // A leaf for keys of varying size
+    class SlottedLeafNode : public SlottedNode<TID, slottedLeafSize> {
+        typedef SlottedNode<TID, slottedLeafSize> Base;
+        typedef std::vector<std::pair<std::string, TID>> Entries;
+
+        // neighboring leaves in key order or noPage
+        uint64_t prev;
+        uint64_t next;
+
+      public:
+        SlottedLeafNode() : Base(true), prev(noPage), next(noPage) {};
+
+        // returns false if the key exceeds the maximum key size
+        inline static bool isValidKey(const K& key) {
+            return key.size() <= Base::maxKeySize;
+        }
+
+        inline K getKey(unsigned i) {
+            return this->getKeyAt(i);
+        }
+
+        inline TID getTIDAt(unsigned i) {
+            return this->slots()[i].payload;
+        }
+
+        inline uint64_t getPrev() {
+            return prev;
+        }
+
+        inline uint64_t getNext() {
+            return next;
+        }
+
+        inline void setPrev(uint64_t pageID) {
+            prev = pageID;
+        }
+
+        inline void setNext(uint64_t pageID) {
+            next = pageID;
+        }
+
+        // returns true if the key fits into the leaf without splitting it
+        inline bool canInsert(const K& key) {
+            return this->fits(key.size());
+        }
+
+        // returns true if the leaf filled up to the fill factor can take
+        // another entry
+        inline bool canAppend(const K& key, double fillFactor) {
+            size_t size = this->getUsedSpace() + sizeof(typename Base::Slot) + key.size();
+            return this->fits(key.size()) &&
+                (this->count == 0 || size <= slottedLeafSize * fillFactor);
+        }
+
+        // appends an entry with a key greater than all existing keys
+        inline void append(const K& key, TID tid) {
+            this->insertAt(this->count, key, tid);
+        }
+
+        inline K maxKey() {
+            return this->getKeyAt(this->count-1);
+        }
+
+        // returns index of first existing key >= input key
+        unsigned getKeyIndex(const K& key) {
+            return this->lowerBound(key, this->getSafeCount());
+        }
+
+        bool getTID(const K& key, TID& tid) {
+            unsigned i = getKeyIndex(key);
+            if (i == this->getSafeCount() || this->compare(i, key) != 0) {
+                return false;
+            }
+
+            tid = this->slots()[i].payload;
+            return true;
+        }
+
+        void insert(const K& key, TID tid) {
+            unsigned i = getKeyIndex(key);
+            if (i < this->count && this->compare(i, key) == 0) {
+                this->slots()[i].payload = tid; // overwrite existing value
+                return;
+            }
+            this->insertAt(i, key, tid);
+        }
+
+        // returns false if the key was not found
+        bool remove(const K& key) {
+            unsigned i = getKeyIndex(key);
+            if (i == this->count || this->compare(i, key) != 0)
+                return false;
+
+            this->removeAt(i);
+            return true;
+        }
+
+        // returns true if merging the right neighbor into this leaf leaves it
+        // at most half full
+        inline bool canMerge(SlottedLeafNode* right) {
+            return this->getUsedSpace() + right->getUsedSpace() <= slottedLeafSize/2;
+        }
+
+        // moves all entries of the right neighbor to this leaf, which takes
+        // over its right link. The caller must link the new right neighbor
+        // back to this leaf
+        void merge(SlottedLeafNode* right) {
+            for (unsigned i = 0; i < right->count; i++) {
+                this->insertAt(this->count, right->getKeyAt(i), right->slots()[i].payload);
+            }
+            next = right->next;
+        }
+
+        // distributes the entries evenly between this leaf and its right
+        // neighbor and replaces their separator, the i-th key of the parent.
+        // Returns false and leaves all nodes unchanged if the separator does
+        // not fit or a leaf would stay underfull
+        bool balance(SlottedLeafNode* right, InnerNode* parent, unsigned i) {
+            Entries entries;
+            this->getEntries(entries);
+            right->getEntries(entries);
+
+            unsigned middle    = Base::getMiddle(entries);
+            size_t   leftSize  = Base::getEntriesSize(entries.begin(), entries.begin()+middle);
+            size_t   rightSize = Base::getEntriesSize(entries.begin()+middle, entries.end());
+            if (leftSize > slottedLeafSize || rightSize > slottedLeafSize ||
+                    leftSize < slottedLeafSize/4 || rightSize < slottedLeafSize/4 ||
+                    !parent->canSetKey(i, entries[middle-1].first)) {
+                return false;
+            }
+
+            this->setEntries(entries.begin(), entries.begin()+middle);
+            right->setEntries(entries.begin()+middle, entries.end());
+            parent->setKey(i, maxKey());
+            return true;
+        }
+
+        // moves the upper half of the entries to a new leaf on the given page,
+        // which becomes the right neighbor of this leaf. The caller must link
+        // the former right neighbor back to the new leaf
+        K split(BufferFrame& bf, uint64_t pageID) {
+            SlottedLeafNode* newLeaf = new (bf.getData()) SlottedLeafNode();
+            newLeaf->prev = pageID;
+            newLeaf->next = next;
+            next          = getPageID(bf);
+
+            Entries entries;
+            this->getEntries(entries);
+            unsigned middle = Base::getMiddle(entries);
+            this->setEntries(entries.begin(), entries.begin()+middle);
+            newLeaf->setEntries(entries.begin()+middle, entries.end());
+
+            return maxKey();
+        }
+    };
+
+    // keys with a normalizer are stored prefix truncated
+    typedef typename std::conditional<varKeys, SlottedLeafNode,
+        typename std::conditional<KeyNormalizer<K, LESS>::enabled,
+            PrefixLeafNode, PlainLeafNode>::type>::type LeafNode;
+
+  public:
+    // Iterates over the entries within a key range in ascending or descending
+    // order. The entries of one leaf at a time are copied under an optimistic
+    // read, thus no latches are held between the calls
+    class RangeIterator {
+      public:
+        // Moves to the next entry. Returns false when the range is exhausted
+        bool next() {
+            while (pos == entries.size()) {
+                if (leafID == noPage) {
+                    return false;
+                }
+                load();
+            }
+
+            last    = entries[pos].first;
+            hasLast = true;
+            pos++;
+            return true;
+        }
+
+        K getKey() {
+            return entries[pos-1].first;
+        }
+
+        TID getTID() {
+            return entries[pos-1].second;
+        }
+
+      private:
+        RangeIterator(BTree& tree, K lo, K hi, bool reverse) :
+            tree(tree), lo(lo), hi(hi), reverse(reverse), hasLast(false),
+            pos(0), leafID(noPage), fromID(noPage) {
+            seek();
+        }
+
+        // Descends to the leaf of the last returned key, or of the bound the
+        // iteration starts at, and copies its entries. The leaf must be copied
+        // without releasing it, otherwise a split could move the entries away
+        void seek() {
+            K key = hasLast ? last : (reverse ? hi : lo);
+            while (true) {
+                BufferFrame* bf;
+                LeafNode*    leaf;
+                uint64_t     v;
+                if (!tree.findLeaf(key, &bf, &leaf, v)) {
+                    continue;
+                }
+
+                bool valid = copy(*bf, leaf, v);
+                tree.bm.unpinPage(*bf, false);
+                if (valid) {
+                    return;
+                }
+            }
+        }
+
+        // Copies the entries of the next leaf
+        void load() {
+            while (true) {
+                BufferFrame& bf   = tree.pinPage(leafID);
+                LeafNode*    leaf = static_cast<LeafNode*>(bf.getData());
+                uint64_t     v;
+                if (!leaf->readLock(v)) {
+                    tree.bm.unpinPage(bf, false);
+                    if (Node::isObsolete(v)) {
+                        // the leaf was merged into a neighbor meanwhile
+                        seek();
+                        return;
+                    }
+                    continue;
+                }
+
+                if (reverse) {
+                    // the left neighbor might have been split since its link
+                    // was read, the leaves in between are found through their
+                    // right links. If the leaf the iteration came from was
+                    // merged meanwhile, the walk stops at the first leaf with
+                    // keys which were already returned
+                    uint64_t nextID = leaf->getNext();
+                    unsigned count  = leaf->getSafeCount();
+                    bool     walk   = nextID != fromID && nextID != noPage &&
+                        (count == 0 || !isReturned(leaf->getKey(count-1)));
+                    if (!leaf->validate(v)) {
+                        tree.bm.unpinPage(bf, false);
+                        continue;
+                    }
+                    if (walk) {
+                        tree.bm.unpinPage(bf, false);
+                        leafID = nextID;
+                        continue;
+                    }
+                }
+
+                bool valid = copy(bf, leaf, v);
+                tree.bm.unpinPage(bf, false);
+                if (valid) {
+                    return;
+                }
+            }
+        }
+
+        // Copies the entries of the leaf which are within the range and were
+        // not returned yet. Returns false if the leaf was modified meanwhile
+        bool copy(BufferFrame& bf, LeafNode* leaf, uint64_t v) {
+            entries.clear();
+            pos = 0;
+
+            // a key beyond the range ends the iteration after this leaf
+            bool     beyond = false;
+            unsigned count  = leaf->getSafeCount();
+            for (unsigned i = 0; i < count; i++) {
+                K key = leaf->getKey(i);
+                if (tree.less(key, lo)) {
+                    beyond |= reverse;
+                } else if (tree.less(hi, key)) {
+                    beyond |= !reverse;
+                } else if (!isReturned(key)) {
+                    entries.push_back(std::make_pair(key, leaf->getTIDAt(i)));
+                }
+            }
+            uint64_t neighbor = reverse ? leaf->getPrev() : leaf->getNext();
+
+            if (!leaf->validate(v)) {
+                entries.clear();
+                return false;
+            }
+
+            if (reverse) {
+                std::reverse(entries.begin(), entries.end());
+            }
+            fromID = getPageID(bf);
+            leafID = beyond ? noPage : neighbor;
+            return true;
+        }
+
+        // returns true if the iteration already passed the key
+        inline bool isReturned(const K& key) {
+            return hasLast && (reverse ? !tree.less(key, last) : !tree.less(last, key));
+        }
+
+        BTree&   tree;
+        K        lo;
+        K        hi;
+        bool     reverse;
+        K        last;     // last returned key
+        bool     hasLast;
+
+        std::vector<std::pair<K, TID>> entries; // copied from the current leaf
+        unsigned pos;      // next entry to return
+        uint64_t leafID;   // leaf to continue with or noPage
+        uint64_t fromID;   // leaf the entries were copied from
+
+      friend class BTree;
+    };
+
+    // Creates an empty tree on the segment or opens the tree stored on it.
+    // Opening only reads the metadata page, which is written back by flush
+    // and when the tree is destroyed. If a filter is given, lookups of keys which are not
+    // in the filter do not descend the tree. The filter is cleared for a new
+    // tree, an opened tree must be given the filter it was stored with. Only
+    // keys which have a KeyHash can be filtered
+    BTree(BufferManager& bm, uint64_t id, TreeMode mode = TreeMode::Create,
+            BloomFilter* filter = NULL) :
+            Segment(bm, id), root(1), filter(filter) {
+        static_assert(sizeof(LeafNode) <= blocksize, "LeafNode size exceeds page size");
+        static_assert(sizeof(InnerNode) <= blocksize, "InnerNode size exceeds page size");
+        static_assert(sizeof(Metadata) <= blocksize, "Metadata size exceeds page size");
+        static_assert(sizeof(FreeList) <= blocksize, "FreeList size exceeds page size");
+
+        if (filter != NULL && !KeyHash<K, LESS>::enabled) {
+            throw std::invalid_argument("Keys without a KeyHash can not be filtered");
+        }
+
+        if (mode == TreeMode::Open) {
+            readMetadata();
+            return;
+        }
+
+        if (filter != NULL) {
+            filter->clear();
+        }
+
+        // init root node
+        BufferFrame&  bf      = pinPage(root);
+        void*         dataPtr = bf.getData();
+        new (dataPtr) LeafNode();
+        static_cast<Node*>(dataPtr)->setVersion(0);
+        bm.unpinPage(bf, true);
+        size = 2;
+        writeMetadata();
+    };
+
+    ~BTree() {
+        writeMetadata();
+    }
+
+    // Writes the metadata, so that the tree can be opened again as it is now
+    // even if this object is never destroyed. May be called concurrently
+    // with other operations; a filter must be stored on its own
+    void flush() {
+        writeMetadata();
+    }
+
+    /*
+    Lookup:
+    1. start with the root node
+    2. is the current node a leaf?
+        > if yes, return the current page (locate the entry on it)
+    3. find the first entry ≥ search key (binary search)
+    4. if no such entry is found, go the upper, otherwise go to the corresponding page
+    5. continue with 2
+    */
+    bool lookup(K key, TID& tid) {
+        if (!mayContain(key)) {
+            return false;
+        }
+
+        while (true) {
+            BufferFrame* bf;
+            LeafNode*    leaf;
+            uint64_t     v;
+            if (!findLeaf(key, &bf, &leaf, v)) {
+                continue;
+            }
+
+            // the TID is only returned once it was read consistently
+            TID  result = TID();
+            bool found  = leaf->getTID(key, result);
+            bool valid  = leaf->validate(v);
+            bm.unpinPage(*bf, false);
+            if (valid) {
+                if (found) {
+                    tid = result;
+                }
+                return found;
+            }
+        }
+    }
+
+
+    /*
+    Insert:
+    1. lookup the appropriate leaf page
+    2. is there free space on the leaf
+        > if yes, insert entry and stop
+    3. split the leaf into two, insert entry on proper side
+    4. insert maximum of left page as separator into parent
+    5. if the parent overflow, split parent and continue with 4
+    6. create a new root if needed
+    */
+    void insert(K key, TID tid) {
+        if (!LeafNode::isValidKey(key)) {
+            throw std::length_error("Key exceeds the maximum key size");
+        }
+
+        // the key is added to the filter first, so that it is never missing
+        // from the filter while it is in the tree
+        addToFilter(key);
+
+        // restart from the root until the descent was not interfered with
+        std::pair<K, TID> entry(key, tid);
+        size_t            done = 0;
+        while (!tryInsert(&entry, 1, done)) {}
+    };
+
+    /*
+    Batch insert:
+    1. sort the entries by key
+    2. descend to the leaf of the first pending entry like a single insert
+       and remember the separator bounding the leaf
+    3. insert the pending entries up to the bound under the same latch, as
+       long as they fit into the leaf
+    4. continue with 2 until all entries are inserted
+    */
+    // Inserts all entries, like insert for every entry. The last one of
+    // several entries with the same key is kept
+    void insertBatch(std::vector<std::pair<K, TID>> entries) {
+        for (auto& entry : entries) {
+            if (!LeafNode::isValidKey(entry.first)) {
+                throw std::length_error("Key exceeds the maximum key size");
+            }
+        }
+        for (auto& entry : entries) {
+            addToFilter(entry.first);
+        }
+
+        // a stable sort keeps the order of entries with the same key
+        std::stable_sort(entries.begin(), entries.end(),
+            [this](const std::pair<K, TID>& a, const std::pair<K, TID>& b) {
+                return less(a.first, b.first);
+            });
+
+        size_t done = 0;
+        while (done < entries.size()) {
+            tryInsert(entries.data(), entries.size(), done);
+        }
+    }
+
+    // Looks up all keys, found[i] tells whether keys[i] exists and tids[i] is
+    // its TID then. The keys are looked up in key order, the keys of a leaf
+    // are read in a single pass. Returns the number of keys found
+    size_t lookupBatch(const std::vector<K>& keys, std::vector<TID>& tids, std::vector<bool>& found) {
+        // keys which are not in the filter are not looked up
+        std::vector<size_t> order;
+        order.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (mayContain(keys[i])) {
+                order.push_back(i);
+            }
+        }
+        std::sort(order.begin(), order.end(), [this, &keys](size_t a, size_t b) {
+            return less(keys[a], keys[b]);
+        });
+
+        tids.assign(keys.size(), TID());
+        found.assign(keys.size(), false);
+
+        // results of the current leaf, they are only kept once the leaf was
+        // read consistently
+        std::vector<std::pair<bool, TID>> results;
+        size_t                            pos   = 0;
+        size_t                            count = 0;
+        while (pos < order.size()) {
+            BufferFrame* bf;
+            LeafNode*    leaf;
+            uint64_t     v;
+            K            upper;
+            bool         hasUpper = false;
+            if (!findLeaf(keys[order[pos]], &bf, &leaf, v, &upper, &hasUpper)) {
+                continue;
+            }
+
+            results.clear();
+            size_t end = pos;
+            do {
+                TID  tid = TID();
+                bool res = leaf->getTID(keys[order[end]], tid);
+                results.push_back(std::make_pair(res, tid));
+                end++;
+            } while (end < order.size() && (!hasUpper || !less(upper, keys[order[end]])));
+
+            bool valid = leaf->validate(v);
+            bm.unpinPage(*bf, false);
+            if (!valid) {
+                continue;
+            }
+
+            for (size_t i = pos; i < end; i++) {
+                found[order[i]] = results[i-pos].first;
+                tids[order[i]]  = results[i-pos].second;
+                count += results[i-pos].first;
+            }
+            pos = end;
+        }
+        return count;
+    }
+
+
+    /*
+    Bulk load:
+    1. fill the leaves from left to right with the sorted entries up to the
+       fill factor and link them
+    2. remember the maximum key and the page of every node of the level
+    3. build the next level from them, the children are distributed evenly
+    4. continue with 3 until a single node remains, which becomes the root
+    */
+    // Builds the tree from the entries of [begin, end), which must be sorted
+    // by key without duplicates. Iterators must yield std::pair<K, TID>, they
+    // are only passed once. The tree must still be empty, otherwise
+    // std::logic_error is thrown, and must not be accessed concurrently until
+    // the load is done. Nodes are written to sequential pages, level by
+    // level. The filter is rebuilt from the entries
+    template <class Iterator>
+    void bulkLoad(Iterator begin, Iterator end, double fillFactor = 1.0) {
+        if (!isEmpty()) {
+            throw std::logic_error("Bulk load requires an empty tree");
+        }
+        if (filter != NULL) {
+            filter->clear();
+        }
+
+        // maximum key and page of every node of the current level
+        std::vector<std::pair<K, uint64_t>> level;
+
+        BufferFrame* bf   = NULL;
+        LeafNode*    leaf = NULL;
+        for (Iterator it = begin; it != end; ++it) {
+            if (!LeafNode::isValidKey(it->first)) {
+                throw std::length_error("Key exceeds the maximum key size");
+            }
+            addToFilter(it->first);
+            if (leaf == NULL || !leaf->canAppend(it->first, fillFactor)) {
+                // continue with a new leaf on the next page
+                uint64_t     version;
+                uint64_t     pageID  = reservePage(version);
+                BufferFrame* bfNew   = &pinPage(pageID);
+                LeafNode*    newLeaf = new (bfNew->getData()) LeafNode();
+                newLeaf->setVersion(version);
+
+                if (leaf != NULL) {
+                    leaf->setNext(pageID);
+                    newLeaf->setPrev(getPageID(*bf));
+                    level.push_back(std::make_pair(leaf->maxKey(), getPageID(*bf)));
+                    bm.unpinPage(*bf, true);
+                }
+
+                bf   = bfNew;
+                leaf = newLeaf;
+            }
+
+            leaf->append(it->first, it->second);
+        }
+
+        if (leaf == NULL) {
+            return;
+        }
+
+        if (level.empty()) {
+            // a single leaf becomes the root
+            bm.unpinPage(*bf, true);
+            moveToRoot(getPageID(*bf));
+            return;
+        }
+
+        level.push_back(std::make_pair(leaf->maxKey(), getPageID(*bf)));
+        bm.unpinPage(*bf, true);
+
+        while (level.size() > 1) {
+            std::vector<std::pair<K, uint64_t>> upper;
+            size_t innerCapacity = std::max<size_t>(3, InnerNode::getCapacity(level) * fillFactor);
+
+            size_t pos = 0;
+            while (pos < level.size()) {
+                // distribute the children evenly, so that the last node does
+                // not underflow
+                size_t nodes    = (level.size() - pos + innerCapacity-1) / innerCapacity;
+                size_t children = (level.size() - pos) / nodes;
+
+                uint64_t     version;
+                uint64_t     pageID  = reservePage(version);
+                BufferFrame& bfInner = pinPage(pageID);
+                InnerNode*   inner   = new (bfInner.getData()) InnerNode(level[pos].second);
+                inner->setVersion(version);
+
+                // the capacity is only estimated for keys of varying size
+                size_t j = 1;
+                while (j < children && inner->canAppend(level[pos+j-1].first, fillFactor)) {
+                    inner->append(level[pos+j-1].first, level[pos+j].second);
+                    j++;
+                }
+                bm.unpinPage(bfInner, true);
+
+                upper.push_back(std::make_pair(level[pos+j-1].first, pageID));
+                pos += j;
+            }
+
+            level.swap(upper);
+        }
+
+        // the topmost node replaces the root, which keeps its version
+        moveToRoot(level[0].second);
+    }
+
+    /*
+    Range lookup:
+    1. lookup the leaf of the lower (upper) bound
+    2. return the entries within the range from the current leaf
+    3. continue with the right (left) neighbor until a key beyond the range
+       is reached
+    */
+    RangeIterator lookupRange(K lo, K hi, bool reverse = false) {
+        return RangeIterator(*this, lo, hi, reverse);
+    }
+
+    /*
+    Delete
+    1. lookup the appropriate leaf page, on the way down make sure that no
+       node but the root is underfull ("safe" pages, like for inserts):
+    2. is the node at least a quarter full?
+        > if yes, continue with the child
+    3. is the neighboring node of the same parent large enough to share?
+        > if yes, balance both nodes, update the separator in the parent
+    4. otherwise merge the neighboring node into the left one and remove
+       the separator and the right node from the parent
+    5. a root with a single child is replaced by the child
+    6. remove the entry from the leaf
+    */
+    bool erase(K key) {
+        // restart from the root until the descent was not interfered with
+        bool found = false;
+        while (!tryErase(key, found)) {}
+        return found;
+    };
+
+  private:
+    // marks a missing neighbor leaf
+    static const uint64_t noPage = ~(uint64_t) 0;
+
+    // the first page of the segment holds the metadata
+    static const uint64_t metadataPage = 0;
+
+    // identifies the metadata page of a tree
+    static const uint64_t magic = 0x4254726565000002ull;
+
+    // the layouts of the keys in leaves
+    enum class KeyLayout : uint32_t { Plain, Prefix, Slotted, PlainNoTIDs, PrefixNoTIDs };
+
+    struct Metadata {
+        uint64_t  magic;
+        uint32_t  blocksize;
+        uint32_t  keySize;   // 0 for keys of varying size
+        KeyLayout layout;
+        uint32_t  freeCount; // number of the free pages stored here
+        uint64_t  root;
+        uint64_t  size;      // size in pages
+        uint64_t  freeChain; // first page of the free list, metadataPage if none
+
+        // free pages and the versions to continue with
+        static const size_t maxFree = (::blocksize - 48) / (2*sizeof(uint64_t));
+        uint64_t free[maxFree][2];
+    };
+
+    // The free pages which do not fit into the metadata page are stored in a
+    // list, whose pages are free pages themselves. The node header is kept,
+    // so that optimistic readers still find the removed node obsolete
+    struct FreeList {
+        uint8_t  node[(sizeof(Node) + 7) & ~(size_t) 7];
+        uint64_t next;  // metadataPage for the last page
+        uint64_t count;
+
+        static const size_t maxFree = (::blocksize - sizeof(node) - 16) / (2*sizeof(uint64_t));
+        uint64_t free[maxFree][2];
+    };
+
+    uint64_t root;
+
+    // pages of removed nodes and the versions to continue with
+    std::vector<std::pair<uint64_t, uint64_t>> freePages;
+    std::mutex freeMutex;
+
+    // keys of the tree, erased keys are not removed, or NULL
+    BloomFilter* filter;
+
+    // returns false if the key is certainly not in the tree
+    inline bool mayContain(const K& key) {
+        return filter == NULL || filter->mayContain(KeyHash<K, LESS>::hash(key));
+    }
+
+    inline void addToFilter(const K& key) {
+        if (filter != NULL) {
+            filter->add(KeyHash<K, LESS>::hash(key));
+        }
+    }
+
+    // Finds the leaf for the given key with optimistic lock coupling: the
+    // version of a node is validated after the version of its child was read.
+    // Returns false if the descent must be restarted, otherwise the leaf is
+    // pinned and v is the version it was read at. If upper is given, it is
+    // set to the bound of the leaf, see getChild
+    bool findLeaf(const K& key, BufferFrame** bfPtr, LeafNode** leafPtr, uint64_t& v,
+            K* upper = NULL, bool* hasUpper = NULL) {
+        // get root node
+        BufferFrame* bf   = &pinPage(root);
+        Node*        node = static_cast<Node*>(bf->getData());
+        if (!node->readLock(v)) {
+            return restart(bf, NULL);
+        }
+
+        // find leaf
+        while(!node->isLeaf()) {
+            InnerNode* inner  = reinterpret_cast<InnerNode*>(node);
+            uint64_t   nextID = getChild(inner, key, upper, hasUpper);
+            if (!node->validate(v)) {
+                return restart(bf, NULL);
+            }
+
+            // lock coupling: read the child before validating the parent
+            BufferFrame* bfNew = &pinPage(nextID);
+            Node*        child = static_cast<Node*>(bfNew->getData());
+            uint64_t     childV;
+            if (!child->readLock(childV) || !node->validate(v)) {
+                return restart(bfNew, bf);
+            }
+            bm.unpinPage(*bf, false);
+
+            bf   = bfNew;
+            node = child;
+            v    = childV;
+        }
+
+        *bfPtr   = bf;
+        *leafPtr = reinterpret_cast<LeafNode*>(node);
+        return true;
+    }
+
+    // Returns the child of the inner node for the key. If upper is given, it
+    // is set to the separator to the right of the child, which is the
+    // greatest key that belongs below the child, and hasUpper to true. The
+    // last child is bounded by the separator of an ancestor, if any, which
+    // was set before
+    inline static uint64_t getChild(InnerNode* inner, const K& key, K* upper, bool* hasUpper) {
+        unsigned i = inner->getKeyIndex(key);
+        if (upper != NULL && i+1 < inner->getCount()) {
+            *upper    = inner->getKey(i);
+            *hasUpper = true;
+        }
+        return inner->getChildAt(i);
+    }
+
+    // Pages of the tree are stored in the segment file
+    // Returns true if the root is an empty leaf and no other node is in use
+    bool isEmpty() {
+        {
+            std::lock_guard<std::mutex> guard(freeMutex);
+            if (size - freePages.size() > 2) {
+                return false;
+            }
+        }
+        BufferFrame& bf    = pinPage(root);
+        Node*        node  = static_cast<Node*>(bf.getData());
+        bool         empty = node->isLeaf() && node->getCount() == 0;
+        bm.unpinPage(bf, false);
+        return empty;
+    }
+
+    inline BufferFrame& pinPage(uint64_t pageID) {
+        return bm.pinPage((id << 48) | pageID);
+    }
+
+    // returns the page within the segment
+    inline static uint64_t getPageID(BufferFrame& bf) {
+        return bf.getID() & 0x0000FFFFFFFFFFFF;
+    }
+
+    // the layout of the keys, which must not change between the runs
+    inline static KeyLayout getKeyLayout() {
+        if (varKeys) {
+            return KeyLayout::Slotted;
+        }
+        if (embeddedTIDs) {
+            return KeyNormalizer<K, LESS>::enabled ? KeyLayout::PrefixNoTIDs : KeyLayout::PlainNoTIDs;
+        }
+        return KeyNormalizer<K, LESS>::enabled ? KeyLayout::Prefix : KeyLayout::Plain;
+    }
+
+    inline static uint32_t getKeySize() {
+        if (varKeys) {
+            return 0;
+        }
+        return KeyNormalizer<K, LESS>::enabled ? KeyNormalizer<K, LESS>::size : sizeof(K);
+    }
+
+    // Reads the root, the size and the free pages of the tree, after checking
+    // that the segment holds a tree with the same key layout
+    void readMetadata() {
+        BufferFrame& bf   = pinPage(metadataPage);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        bool valid = meta->magic == magic && meta->blocksize == blocksize &&
+            meta->keySize == getKeySize() && meta->layout == getKeyLayout() &&
+            meta->freeCount <= Metadata::maxFree;
+        uint64_t next = meta->freeChain;
+        if (valid) {
+            root = meta->root;
+            size = meta->size;
+            for (uint32_t i = 0; i < meta->freeCount; i++) {
+                freePages.push_back(std::make_pair(meta->free[i][0], meta->free[i][1]));
+            }
+        }
+        bm.unpinPage(bf, false);
+
+        if (!valid) {
+            throw std::runtime_error("Segment does not hold a tree with this key layout");
+        }
+
+        while (next != metadataPage) {
+            if (next >= size) {
+                throw std::runtime_error("Free list of the tree is corrupted");
+            }
+            BufferFrame& bfList = pinPage(next);
+            FreeList*    list   = static_cast<FreeList*>(bfList.getData());
+            uint64_t     count  = list->count;
+            if (count > FreeList::maxFree) {
+                bm.unpinPage(bfList, false);
+                throw std::runtime_error("Free list of the tree is corrupted");
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                freePages.push_back(std::make_pair(list->free[i][0], list->free[i][1]));
+            }
+            next = list->next;
+            bm.unpinPage(bfList, false);
+        }
+    }
+
+    // Writes the metadata and the free list. The free pages are not reused
+    // meanwhile, the root always stays on the same page
+    void writeMetadata() {
+        std::lock_guard<std::mutex> lock(freeMutex);
+
+        BufferFrame& bf   = pinPage(metadataPage);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        meta->magic     = magic;
+        meta->blocksize = blocksize;
+        meta->keySize   = getKeySize();
+        meta->layout    = getKeyLayout();
+        meta->root      = root;
+        meta->size      = size;
+
+        size_t maxFree  = Metadata::maxFree;
+        meta->freeCount = std::min(freePages.size(), maxFree);
+        for (uint32_t i = 0; i < meta->freeCount; i++) {
+            meta->free[i][0] = freePages[i].first;
+            meta->free[i][1] = freePages[i].second;
+        }
+
+        // the remaining free pages are listed on the first free pages
+        size_t listPages = (freePages.size() - meta->freeCount + FreeList::maxFree-1) / FreeList::maxFree;
+        meta->freeChain  = listPages > 0 ? freePages[0].first : metadataPage;
+        bm.unpinPage(bf, true);
+
+        size_t stored  = meta->freeCount;
+        size_t perList = FreeList::maxFree;
+        for (size_t page = 0; page < listPages; page++) {
+            BufferFrame& bfList = pinPage(freePages[page].first);
+            FreeList*    list   = static_cast<FreeList*>(bfList.getData());
+            list->next  = page+1 < listPages ? freePages[page+1].first : metadataPage;
+            list->count = std::min(freePages.size() - stored, perList);
+            for (uint64_t i = 0; i < list->count; i++, stored++) {
+                list->free[i][0] = freePages[stored].first;
+                list->free[i][1] = freePages[stored].second;
+            }
+            bm.unpinPage(bfList, true);
+        }
+    }
+
+    // Unpins the given frames, which may be NULL, and returns false
+    bool restart(BufferFrame* bf, BufferFrame* bfPar) {
+        if (bf != NULL) {
+            bm.unpinPage(*bf, false);
+        }
+        if (bfPar != NULL) {
+            bm.unpinPage(*bfPar, false);
+        }
+        return false;
+    }
+
+    // Descends optimistically and splits the first full node on the way down
+    // ("safe" inner pages), only the split node and its parent are locked.
+    // Returns false if the insert must be restarted, which is also the case
+    // after a split. Inserts the sorted entries from done on which belong to
+    // the same leaf and fit into it, done is advanced past them
+    bool tryInsert(const std::pair<K, TID>* entries, size_t count, size_t& done) {
+        const K& key = entries[done].first;
+
+        // the bound of the leaf is only needed for further entries
+        K     upper;
+        bool  hasUpper = false;
+        K*    bound    = done+1 < count ? &upper : NULL;
+
+        BufferFrame* bf   = &pinPage(root);
+        Node*        node = static_cast<Node*>(bf->getData());
+        uint64_t     v;
+
+        // parent
+        BufferFrame* bfPar  = NULL;  // root has no parent
+        Node*        parent = NULL;
+        uint64_t     parV   = 0;
+
+        if (!node->readLock(v)) {
+            return restart(bf, bfPar);
+        }
+
+        while(true) {
+            // leaves might only be full for some keys
+            bool full = node->isLeaf() ?
+                !reinterpret_cast<LeafNode*>(node)->canInsert(key) : node->isFull();
+            if (full) { // must split current node
+                if (parent != NULL && !parent->upgrade(parV)) {
+                    return restart(bf, bfPar);
+                }
+                if (!node->upgrade(v)) {
+                    if (parent != NULL) {
+                        parent->writeUnlock();
+                    }
+                    return restart(bf, bfPar);
+                }
+
+                split(bf, bfPar);
+
+                node->writeUnlock();
+                bm.unpinPage(*bf, true);
+                if (parent != NULL) {
+                    parent->writeUnlock();
+                    bm.unpinPage(*bfPar, true);
+                }
+                return false;
+
+            } else if (node->isLeaf()) {
+                // found the leaf where the entry must be inserted
+                if (!node->upgrade(v)) {
+                    return restart(bf, bfPar);
+                }
+
+                // the leaf was not modified since the bound was read, the
+                // following entries up to the bound belong to it as well
+                LeafNode* leaf = reinterpret_cast<LeafNode*>(node);
+                do {
+                    leaf->insert(entries[done].first, entries[done].second);
+                    done++;
+                } while (done < count && (!hasUpper || !less(upper, entries[done].first)) &&
+                    leaf->canInsert(entries[done].first));
+                node->writeUnlock();
+
+                bm.unpinPage(*bf, true);
+                if (bfPar != NULL) {
+                    bm.unpinPage(*bfPar, false);
+                }
+                return true;
+
+            } else {
+                // traverse without splitting
+                InnerNode* inner  = reinterpret_cast<InnerNode*>(node);
+                uint64_t   nextID = getChild(inner, key, bound, &hasUpper);
+                if (!node->validate(v)) {
+                    return restart(bf, bfPar);
+                }
+
+                // lock coupling: read the child before validating the parent
+                BufferFrame* bfNew = &pinPage(nextID);
+                Node*        child = static_cast<Node*>(bfNew->getData());
+                uint64_t     childV;
+                if (!child->readLock(childV) || !node->validate(v)) {
+                    bm.unpinPage(*bfNew, false);
+                    return restart(bf, bfPar);
+                }
+
+                if (bfPar != NULL) {
+                    bm.unpinPage(*bfPar, false);
+                }
+
+                bfPar  = bf;
+                parent = node;
+                parV   = v;
+                bf     = bfNew;
+                node   = child;
+                v      = childV;
+            }
+        }
+    }
+
+    // Splits the full node on the given page. The node and its parent, which
+    // receives the separator, must be locked. The root has no parent, it is
+    // moved to a new page instead and replaced by a new root
+    void split(BufferFrame* bf, BufferFrame* bfPar) {
+        Node* node = static_cast<Node*>(bf->getData());
+
+        // open a new page where the new node will be written to
+        uint64_t     newVersion;
+        uint64_t     newID = reservePage(newVersion);
+        BufferFrame* bfNew = &pinPage(newID);
+
+        K separator;
+        if (node->isLeaf()) {
+            // construct new leaf and move half of the entries
+            LeafNode* oldLeaf = reinterpret_cast<LeafNode*>(node);
+            separator = oldLeaf->split(*bfNew, getPageID(*bf));
+            static_cast<Node*>(bfNew->getData())->setVersion(newVersion);
+
+            // link the former right neighbor to the new leaf. Leaves are only
+            // locked from left to right, thus waiting for it cannot deadlock
+            LeafNode* newLeaf = static_cast<LeafNode*>(bfNew->getData());
+            if (newLeaf->getNext() != noPage) {
+                BufferFrame& bfNext = pinPage(newLeaf->getNext());
+                LeafNode*    next   = static_cast<LeafNode*>(bfNext.getData());
+                next->writeLock();
+                next->setPrev(newID);
+                next->writeUnlock();
+                bm.unpinPage(bfNext, true);
+            }
+        } else {
+            // construct new inner node and move half of the entries
+            InnerNode* oldInner = reinterpret_cast<InnerNode*>(node);
+            separator = oldInner->split(*bfNew);
+            static_cast<Node*>(bfNew->getData())->setVersion(newVersion);
+        }
+
+        // check if splitted node is the root
+        if (bfPar == NULL) {
+            // reserve another page to move the old root to
+            uint64_t     moveVersion;
+            uint64_t     moveID = reservePage(moveVersion);
+            BufferFrame* bfMove = &pinPage(moveID);
+
+            // move current root node to the new page
+            memcpy(bfMove->getData(), bf->getData(), blocksize);
+            static_cast<Node*>(bfMove->getData())->setVersion(moveVersion);
+            if (node->isLeaf()) {
+                static_cast<LeafNode*>(bfNew->getData())->setPrev(moveID);
+            }
+
+            // init new root and insert old root as leftmost child, the root
+            // stays locked
+            new (bf->getData()) InnerNode(moveID, newID, separator);
+
+            bm.unpinPage(*bfMove, true);
+        } else {
+            // update parent
+            InnerNode* parent = static_cast<InnerNode*>(bfPar->getData());
+            parent->insert(separator, newID);
+        }
+
+        bm.unpinPage(*bfNew, true);
+    }
+
+    // Descends optimistically like tryInsert, but rebalances the first
+    // underfull node on the way down, which locks the node, its parent and a
+    // neighbor, and replaces a root with a single child by the child. A node
+    // which cannot be rebalanced stays underfull, the descent continues.
+    // Returns false if the erase must be restarted, which is also the case
+    // after rebalancing. Otherwise found tells if the key was removed
+    bool tryErase(K& key, bool& found) {
+        BufferFrame* bf   = &pinPage(root);
+        Node*        node = static_cast<Node*>(bf->getData());
+        uint64_t     v;
+
+        // parent
+        BufferFrame* bfPar  = NULL;  // root has no parent
+        Node*        parent = NULL;
+        uint64_t     parV   = 0;
+
+        if (!node->readLock(v)) {
+            return restart(bf, bfPar);
+        }
+
+        bool keepUnderfull = false;
+        while(true) {
+            if (parent == NULL && !node->isLeaf() && node->getCount() == 1) {
+                // the root has a single child
+                if (!node->upgrade(v)) {
+                    return restart(bf, bfPar);
+                }
+
+                shrinkRoot(bf);
+                return false;
+
+            } else if (parent != NULL && !keepUnderfull && node->isUnderfull()) {
+                if (!parent->upgrade(parV)) {
+                    return restart(bf, bfPar);
+                }
+                if (!node->upgrade(v)) {
+                    parent->writeUnlock();
+                    return restart(bf, bfPar);
+                }
+
+                if (rebalance(bf, bfPar, key)) {
+                    return false;
+                }
+
+                // the node was not modified, it continues with the version
+                // following the lock
+                node->writeUnlock();
+                v             = Node::nextVersion(v);
+                keepUnderfull = true;
+
+            } else if (node->isLeaf()) {
+                // found the leaf where the entry must be removed from
+                if (!node->upgrade(v)) {
+                    return restart(bf, bfPar);
+                }
+
+                LeafNode* leaf = reinterpret_cast<LeafNode*>(node);
+                found = leaf->remove(key);
+                node->writeUnlock();
+
+                bm.unpinPage(*bf, found);
+                if (bfPar != NULL) {
+                    bm.unpinPage(*bfPar, false);
+                }
+                return true;
+
+            } else {
+                // traverse without rebalancing
+                InnerNode* inner  = reinterpret_cast<InnerNode*>(node);
+                uint64_t   nextID = inner->getChild(key);
+                if (!node->validate(v)) {
+                    return restart(bf, bfPar);
+                }
+
+                // lock coupling: read the child before validating the parent
+                BufferFrame* bfNew = &pinPage(nextID);
+                Node*        child = static_cast<Node*>(bfNew->getData());
+                uint64_t     childV;
+                if (!child->readLock(childV) || !node->validate(v)) {
+                    bm.unpinPage(*bfNew, false);
+                    return restart(bf, bfPar);
+                }
+
+                if (bfPar != NULL) {
+                    bm.unpinPage(*bfPar, false);
+                }
+
+                bfPar  = bf;
+                parent = node;
+                parV   = v;
+                bf     = bfNew;
+                node   = child;
+                v      = childV;
+
+                keepUnderfull = false;
+            }
+        }
+    }
+
+    // Balances or merges the locked, underfull node on the given page with a
+    // neighbor of the same parent, which must be locked as well. The key
+    // identifies the node within the parent. Returns true if the nodes were
+    // restructured, all of them are unlocked and unpinned then. Otherwise,
+    // if the neighbor is locked or the entries do not fit, only the parent
+    // is unlocked and the node stays locked. So is a node without neighbor,
+    // whose parent is left underfull by a failed balance of slotted nodes
+    bool rebalance(BufferFrame* bf, BufferFrame* bfPar, K& key) {
+        Node*      node   = static_cast<Node*>(bf->getData());
+        InnerNode* parent = static_cast<InnerNode*>(bfPar->getData());
+        if (parent->getCount() < 2) {
+            parent->writeUnlock();
+            return false;
+        }
+
+        // prefer the left neighbor, the leftmost child takes the right one
+        unsigned i     = parent->getKeyIndex(key);
+        unsigned left  = i > 0 ? i-1 : i;
+        uint64_t sibID = parent->getChildAt(i > 0 ? i-1 : i+1);
+
+        // the neighbor is only tried to be locked, waiting for it could
+        // deadlock with a leaf split waiting for this node
+        BufferFrame& bfSib = pinPage(sibID);
+        Node*        sib   = static_cast<Node*>(bfSib.getData());
+        uint64_t     sibV;
+        if (!sib->readLock(sibV) || !sib->upgrade(sibV)) {
+            parent->writeUnlock();
+            bm.unpinPage(bfSib, false);
+            return false;
+        }
+
+        BufferFrame* bfLeft  = i > 0 ? &bfSib : bf;
+        BufferFrame* bfRight = i > 0 ? bf : &bfSib;
+        Node*        leftNode  = static_cast<Node*>(bfLeft->getData());
+        Node*        rightNode = static_cast<Node*>(bfRight->getData());
+
+        bool merge;
+        bool balanced = true;
+        if (node->isLeaf()) {
+            LeafNode* leftLeaf  = reinterpret_cast<LeafNode*>(leftNode);
+            LeafNode* rightLeaf = reinterpret_cast<LeafNode*>(rightNode);
+
+            merge = leftLeaf->canMerge(rightLeaf);
+            if (merge) {
+                leftLeaf->merge(rightLeaf);
+
+                // link the new right neighbor back, from left to right like
+                // a split does
+                if (leftLeaf->getNext() != noPage) {
+                    BufferFrame& bfNext = pinPage(leftLeaf->getNext());
+                    LeafNode*    next   = static_cast<LeafNode*>(bfNext.getData());
+                    next->writeLock();
+                    next->setPrev(getPageID(*bfLeft));
+                    next->writeUnlock();
+                    bm.unpinPage(bfNext, true);
+                }
+            } else {
+                balanced = leftLeaf->balance(rightLeaf, parent, left);
+            }
+        } else {
+            InnerNode* leftInner  = reinterpret_cast<InnerNode*>(leftNode);
+            InnerNode* rightInner = reinterpret_cast<InnerNode*>(rightNode);
+
+            merge = leftInner->canMerge(rightInner, parent->getKey(left));
+            if (merge) {
+                leftInner->merge(rightInner, parent->getKey(left));
+            } else {
+                balanced = leftInner->balance(rightInner, parent, left);
+            }
+        }
+
+        if (!balanced) {
+            sib->writeUnlock();
+            parent->writeUnlock();
+            bm.unpinPage(bfSib, false);
+            return false;
+        }
+
+        leftNode->writeUnlock();
+        if (merge) {
+            parent->removeChild(left+1);
+            rightNode->writeUnlockObsolete();
+            freePage(getPageID(*bfRight), rightNode->getVersion());
+        } else {
+            rightNode->writeUnlock();
+        }
+        parent->writeUnlock();
+
+        bm.unpinPage(*bf, true);
+        bm.unpinPage(bfSib, true);
+        bm.unpinPage(*bfPar, true);
+        return true;
+    }
+
+    // Replaces the locked root, which has a single child, by the child.
+    // Unlocks and unpins the root
+    void shrinkRoot(BufferFrame* bf) {
+        InnerNode* node    = static_cast<InnerNode*>(bf->getData());
+        uint64_t   childID = node->getChildAt(0);
+
+        BufferFrame& bfChild = pinPage(childID);
+        Node*        child   = static_cast<Node*>(bfChild.getData());
+        uint64_t     childV;
+        if (!child->readLock(childV) || !child->upgrade(childV)) {
+            node->writeUnlock();
+            bm.unpinPage(bfChild, false);
+            bm.unpinPage(*bf, false);
+            return;
+        }
+
+        // the only child has no neighbors, the root keeps its version
+        uint64_t v = node->getVersion();
+        memcpy(bf->getData(), bfChild.getData(), blocksize);
+        node->setVersion(v);
+        node->writeUnlock();
+
+        child->writeUnlockObsolete();
+        freePage(childID, child->getVersion());
+
+        bm.unpinPage(bfChild, false);
+        bm.unpinPage(*bf, true);
+    }
+
+    // Replaces the root by the node on the given page, whose page is not
+    // needed anymore. The tree must not be accessed concurrently
+    void moveToRoot(uint64_t pageID) {
+        BufferFrame& bfRoot  = pinPage(root);
+        BufferFrame& bf      = pinPage(pageID);
+        Node*        oldRoot = static_cast<Node*>(bfRoot.getData());
+        uint64_t     version = oldRoot->getVersion();
+        memcpy(bfRoot.getData(), bf.getData(), blocksize);
+        oldRoot->setVersion(version);
+        bm.unpinPage(bfRoot, true);
+
+        freePage(pageID, static_cast<Node*>(bf.getData())->getVersion());
+        bm.unpinPage(bf, false);
+    }
+
+    // Returns a page for a new node and the version the node must start
+    // with. Pages of removed nodes are reused
+    uint64_t reservePage(uint64_t& version) {
+        {
+            std::lock_guard<std::mutex> guard(freeMutex);
+            if (!freePages.empty()) {
+                uint64_t pageID = freePages.back().first;
+                version         = freePages.back().second;
+                freePages.pop_back();
+                return pageID;
+            }
+        }
+
+        version = 0;
+        // size is atomic
+        return size++;
+    }
+
+    // Remembers the page of a removed node for reuse, version is the last
+    // version of the node
+    void freePage(uint64_t pageID, uint64_t version) {
+        std::lock_guard<std::mutex> guard(freeMutex);
+        freePages.push_back(std::make_pair(pageID, Node::nextVersion(version)));
     }
 };
 
@@ -0,0 +1,250 @@
+#ifndef BLOOMFILTER_H_
+#define BLOOMFILTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "KeyNormalizer.hpp"
+#include "Segment.hpp"
+
+// Approximate set of key hashes, which tells for most keys which were never
+// added that they are not contained. It is kept in memory, thus a test does
+// not fix any page, and is stored on its segment when it is destroyed.
+// The filter is blocked: all bits of a hash are set within a single block of
+// one cache line, so that a test touches a single cache line. Hashes can not
+// be removed, removed keys only increase the rate of false positives
+class BloomFilter : public Segment {
+    static const unsigned wordsPerBlock = 8;
+    static const unsigned bitsPerBlock  = wordsPerBlock * 64;
+    static const unsigned maxHashCount  = 7; // 9 bits per bit position
+
+    // the first page of the segment holds the metadata
+    static const uint64_t metadataPage = 0;
+
+    // identifies the metadata page of a filter
+    static const uint64_t magic = 0x426C6F6F6D000001ull;
+
+    struct Metadata {
+        uint64_t magic;
+        uint32_t blocksize;
+        uint32_t hashCount;
+        uint64_t blockCount;
+    };
+
+  public:
+    // Creates an empty filter sized for the expected number of keys or opens
+    // the filter stored on the segment. The rate of false positives is about
+    // 1% for 10 bits per key until more keys than expected are added
+    BloomFilter(BufferManager& bm, uint64_t id, size_t expectedKeys,
+            TreeMode mode = TreeMode::Create, unsigned bitsPerKey = 10) :
+            Segment(bm, id) {
+        static_assert(sizeof(Metadata) <= blocksize, "Metadata size exceeds page size");
+        static_assert(blocksize % (wordsPerBlock * sizeof(uint64_t)) == 0,
+            "Blocks must not span pages");
+
+        if (mode == TreeMode::Open) {
+            readFilter();
+            return;
+        }
+
+        blockCount = std::max<uint64_t>(1, (expectedKeys * bitsPerKey + bitsPerBlock-1) / bitsPerBlock);
+        // k = ln(2) * bits per key hash functions are optimal
+        hashCount  = (bitsPerKey * 7 + 5) / 10;
+        hashCount  = hashCount < 1 ? 1 : (hashCount > maxHashCount ? maxHashCount : hashCount);
+        words.reset(new std::atomic<uint64_t>[blockCount * wordsPerBlock]);
+        clear();
+        size = 1 + getPageCount();
+    }
+
+    ~BloomFilter() {
+        writeFilter();
+    }
+
+    // Adds the hash, may be called concurrently with add and mayContain
+    void add(uint64_t hash) {
+        std::atomic<uint64_t>* block = getBlock(hash);
+        uint64_t               bits  = getBits(hash);
+        for (unsigned i = 0; i < hashCount; i++, bits >>= 9) {
+            block[(bits >> 6) & (wordsPerBlock-1)].fetch_or(1ull << (bits & 63), std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the hash was certainly not added since the last clear
+    bool mayContain(uint64_t hash) const {
+        const std::atomic<uint64_t>* block = getBlock(hash);
+        uint64_t                     bits  = getBits(hash);
+        for (unsigned i = 0; i < hashCount; i++, bits >>= 9) {
+            uint64_t word = block[(bits >> 6) & (wordsPerBlock-1)].load(std::memory_order_relaxed);
+            if ((word & (1ull << (bits & 63))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Removes all hashes, must not be called concurrently
+    void clear() {
+        for (uint64_t i = 0; i < blockCount * wordsPerBlock; i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Hashes the given bytes. The hashes are stored, so they must not differ
+    // between runs, which std::hash does not promise
+    static uint64_t hashBytes(const void* data, size_t length) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t       hash  = length * 0x9E3779B97F4A7C15ull;
+        for (; length >= 8; length -= 8, bytes += 8) {
+            uint64_t word;
+            memcpy(&word, bytes, 8);
+            hash = mix(hash ^ word);
+        }
+        if (length > 0) {
+            uint64_t word = 0;
+            memcpy(&word, bytes, length);
+            hash = mix(hash ^ word);
+        }
+        return mix(hash);
+    }
+
+  private:
+    uint64_t blockCount;
+    unsigned hashCount;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+    // murmur3 finalizer
+    inline static uint64_t mix(uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // the upper half of the hash picks the block without a division
+    inline std::atomic<uint64_t>* getBlock(uint64_t hash) const {
+        return &words[((hash >> 32) * blockCount >> 32) * wordsPerBlock];
+    }
+
+    // 9 bits for every bit position within the block, which are taken from
+    // the lower half of the hash and a multiple of it
+    inline static uint64_t getBits(uint64_t hash) {
+        return (hash & 0xFFFFFFFFull) | ((hash * 0x9E3779B97F4A7C15ull) & ~0xFFFFFFFFull);
+    }
+
+    inline BufferFrame& fixPage(uint64_t pageID, bool exclusive) {
+        return bm.fixPage((id << 48) | pageID, exclusive);
+    }
+
+    inline uint64_t getPageCount() const {
+        uint64_t wordsPerPage = blocksize / sizeof(uint64_t);
+        return (blockCount * wordsPerBlock + wordsPerPage-1) / wordsPerPage;
+    }
+
+    // Reads the metadata and the bits, after checking that the segment
+    // holds a filter
+    void readFilter() {
+        BufferFrame& bf   = fixPage(metadataPage, false);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        bool valid = meta->magic == magic && meta->blocksize == blocksize &&
+            meta->hashCount >= 1 && meta->hashCount <= maxHashCount && meta->blockCount > 0;
+        blockCount = meta->blockCount;
+        hashCount  = meta->hashCount;
+        bm.unfixPage(bf, false);
+
+        if (!valid) {
+            throw std::runtime_error("Segment does not hold a filter");
+        }
+
+        words.reset(new std::atomic<uint64_t>[blockCount * wordsPerBlock]);
+        uint64_t wordsPerPage = blocksize / sizeof(uint64_t);
+        uint64_t wordCount    = blockCount * wordsPerBlock;
+        for (uint64_t page = 0; page < getPageCount(); page++) {
+            BufferFrame& bfBits = fixPage(1 + page, false);
+            uint64_t*    data   = static_cast<uint64_t*>(bfBits.getData());
+            for (uint64_t i = 0; i < wordsPerPage && page*wordsPerPage + i < wordCount; i++) {
+                words[page*wordsPerPage + i].store(data[i], std::memory_order_relaxed);
+            }
+            bm.unfixPage(bfBits, false);
+        }
+        size = 1 + getPageCount();
+    }
+
+    void writeFilter() {
+        BufferFrame& bf   = fixPage(metadataPage, true);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        meta->magic      = magic;
+        meta->blocksize  = blocksize;
+        meta->hashCount  = hashCount;
+        meta->blockCount = blockCount;
+        bm.unfixPage(bf, true);
+
+        uint64_t wordsPerPage = blocksize / sizeof(uint64_t);
+        uint64_t wordCount    = blockCount * wordsPerBlock;
+        for (uint64_t page = 0; page < getPageCount(); page++) {
+            BufferFrame& bfBits = fixPage(1 + page, true);
+            uint64_t*    data   = static_cast<uint64_t*>(bfBits.getData());
+            for (uint64_t i = 0; i < wordsPerPage && page*wordsPerPage + i < wordCount; i++) {
+                data[i] = words[page*wordsPerPage + i].load(std::memory_order_relaxed);
+            }
+            bm.unfixPage(bfBits, true);
+        }
+    }
+};
+
+// Hashes keys for a BloomFilter. Keys which are equal by LESS must have the
+// same hash, thus the bytes of a key are only hashed if LESS tells keys with
+// other bytes apart and the key has no padding. This holds for normalized
+// keys, and for strings and integers ordered by std::less. Other keys need a
+// specialization providing:
+//   static const bool enabled = true;
+//   static uint64_t   hash(const K& key);
+// BTree refuses a filter for keys which can not be hashed
+template <class K, class LESS, bool normalized = KeyNormalizer<K, LESS>::enabled, class Enable = void>
+struct KeyHash {
+    static const bool enabled = false;
+
+    static uint64_t hash(const K&) {
+        return 0;
+    }
+};
+
+template <class K, class LESS>
+struct KeyHash<K, LESS, true> {
+    static const bool enabled = true;
+
+    static uint64_t hash(const K& key) {
+        uint8_t bytes[KeyNormalizer<K, LESS>::size];
+        KeyNormalizer<K, LESS>::normalize(key, bytes);
+        return BloomFilter::hashBytes(bytes, sizeof(bytes));
+    }
+};
+
+template <>
+struct KeyHash<std::string, std::less<std::string>, false> {
+    static const bool enabled = true;
+
+    static uint64_t hash(const std::string& key) {
+        return BloomFilter::hashBytes(key.data(), key.size());
+    }
+};
+
+template <class K>
+struct KeyHash<K, std::less<K>, false, typename std::enable_if<std::is_integral<K>::value>::type> {
+    static const bool enabled = true;
+
+    static uint64_t hash(const K& key) {
+        return BloomFilter::hashBytes(&key, sizeof(K));
+    }
+};
+
+#endif  // BLOOMFILTER_H_
@@ -4,6 +4,7 @@
 #include <stdexcept>
 #include <tuple>
 #include <unistd.h>
+#include <vector>
 
 
 #include "BufferManager.hpp"
@@ -38,6 +39,21 @@ BufferManager::~BufferManager() {
 
 
 BufferFrame& BufferManager::fixPage(uint64_t pageID, bool exclusive) {
+    BufferFrame* bf = pin(pageID);
+
+    // acquire lock on the frame
+    bf->lock(exclusive);
+
+    // return frame reference
+    return *bf;
+}
+
+BufferFrame& BufferManager::pinPage(uint64_t pageID) {
+    return *pin(pageID);
+}
+
+// Returns the frame of the page and protects it from being unloaded
+BufferFrame* BufferManager::pin(uint64_t pageID) {
     // acquire map lock
     rdlock();
 
@@ -91,17 +107,17 @@ BufferFrame& BufferManager::fixPage(uint64_t pageID, bool exclusive) {
             bf = &ret.first->second;
 
             bf->currentUsers++;
+
+            // load the data right away, pinned frames are accessed without
+            // the frame lock
+            bf->getData();
         }
     }
 
     // release the lock on the map
     unlock();
 
-    // acquire lock on the frame
-    bf->lock(exclusive);
-
-    // return frame reference
-    return *bf;
+    return bf;
 }
 
 // must be protected by locks
@@ -132,6 +148,56 @@ int BufferManager::getSegmentFd(unsigned segmentID) {
     return fd;
 }
 
+void BufferManager::unpinPage(BufferFrame& frame, bool isDirty) {
+    if(isDirty)
+        frame.markDirty();
+
+    putLRU(&frame);
+}
+
+void BufferManager::prefetchPages(uint64_t pageID, size_t count) {
+    // only look at the map, like pin does for buffered pages, so that
+    // concurrent fixes are not blocked
+    rdlock();
+    int  fd      = -1;
+    auto segment = segments.find(pageID >> 48);
+    if (segment != segments.end())
+        fd = segment->second;
+
+    // collect the runs of pages which are not buffered
+    std::vector<std::pair<off_t, off_t>> runs;
+    for (size_t i = 0; i < count; i++) {
+        if (frames.find(pageID+i) != frames.end())
+            continue;
+
+        off_t offset = blocksize * ((pageID+i) & 0x0000FFFFFFFFFFFF);
+        if (!runs.empty() && runs.back().first+runs.back().second == offset)
+            runs.back().second += blocksize;
+        else
+            runs.push_back(std::make_pair(offset, (off_t) blocksize));
+    }
+
+    unlock();
+
+    if (runs.empty())
+        return;
+
+    // the segment file might have to be opened first
+    if (fd < 0) {
+        wrlock();
+        try {
+            fd = getSegmentFd(pageID >> 48);
+        } catch (...) {
+            unlock();
+            throw;
+        }
+        unlock();
+    }
+
+    for (auto& run : runs)
+        posix_fadvise(fd, run.first, run.second, POSIX_FADV_WILLNEED);
+}
+
 void BufferManager::unfixPage(BufferFrame& frame, bool isDirty) {
     if(isDirty)
         frame.markDirty();
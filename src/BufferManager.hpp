@@ -29,11 +29,26 @@ class BufferManager {
     // is called.
     void unfixPage(BufferFrame& frame, bool isDirty);
 
+    // Like fixPage, but without acquiring the lock of the frame. The frame is
+    // only protected from being unloaded; synchronizing the accesses to the
+    // page is up to the caller, e.g. with latches stored on the page itself
+    BufferFrame& pinPage(uint64_t pageID);
+
+    // Returns a frame pinned with pinPage
+    void unpinPage(BufferFrame& frame, bool isDirty);
+
+    // Hints that count pages starting at pageID will be fixed soon. The pages
+    // which are not buffered yet are read ahead by the operating system in
+    // the background, so that fixing them later does not wait for the disk
+    void prefetchPages(uint64_t pageID, size_t count);
+
   private:
     inline void rdlock() { pthread_rwlock_rdlock(&latch); }
     inline void wrlock() { pthread_rwlock_wrlock(&latch); }
     inline void unlock() { pthread_rwlock_unlock(&latch); }
 
+    BufferFrame* pin(uint64_t pageID);
+
     int getSegmentFd(unsigned segmentID);
 
     void putLRU(BufferFrame* fp);
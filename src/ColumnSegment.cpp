@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "ColumnSegment.hpp"
+
+// upper bound for the number of values per block
+static const size_t maxBlockValues = 1 << 16;
+
+// number of bits needed to store v
+static inline uint8_t bitsNeeded(uint64_t v) {
+    return (v == 0) ? 0 : 64 - __builtin_clzll(v);
+}
+
+ColumnSegment::ColumnSegment(BufferManager& bm, uint64_t id, const Schema::Relation& rel, TreeMode mode) :
+    Segment(bm, id), rowLen(0), rowCount(0) {
+    for (auto& attr : rel.attributes) {
+        Column col;
+        col.type = attr.type;
+        col.len  = attr.len;
+        columns.push_back(col);
+        rowLen += attr.len;
+    }
+
+    if (sizeof(Metadata) + columns.size()*sizeof(ColumnInfo) > blocksize)
+        throw std::length_error("Too many attributes for the metadata page");
+
+    if (mode == TreeMode::Open) {
+        readMetadata();
+    } else {
+        size = 1;
+        writeMetadata();
+    }
+}
+
+// Appends count rows stored back to back in rows
+void ColumnSegment::append(const char* rows, size_t count) {
+    size_t offset = 0;
+    for (Column& col : columns) {
+        // extract the column from the rows
+        if (col.type == Types::Tag::Integer) {
+            std::vector<int64_t> values(count);
+            for (size_t i = 0; i < count; i++)
+                memcpy(&values[i], rows + i*rowLen + offset, sizeof(int64_t));
+            appendInts(col, values);
+
+        } else if (col.type == Types::Tag::Char) {
+            std::vector<std::string> values;
+            values.reserve(count);
+            for (size_t i = 0; i < count; i++)
+                values.push_back(std::string(rows + i*rowLen + offset, col.len));
+            appendChars(col, values);
+
+        } else {
+            throw std::logic_error("Unknown type");
+        }
+
+        offset += col.len;
+    }
+
+    rowCount += count;
+    writeMetadata();
+}
+
+void ColumnSegment::appendInts(Column& col, const std::vector<int64_t>& values) {
+    size_t start = 0;
+    while (start < values.size()) {
+        BufferFrame& bf   = appendPage(col);
+        char*        page = static_cast<char*>(bf.getData());
+
+        // shrink the block until it fits into the page
+        size_t count = std::min(values.size()-start, maxBlockValues);
+        size_t needed;
+        while (!encode(page, sizeof(Header), &values[start], count, needed)) {
+            size_t estimate = count * blocksize / needed;
+            count = (estimate < count) ? estimate : count-1;
+        }
+
+        bm.unfixPage(bf, true);
+        start += count;
+    }
+}
+
+void ColumnSegment::appendChars(Column& col, const std::vector<std::string>& values) {
+    size_t start = 0;
+    while (start < values.size()) {
+        BufferFrame& bf     = appendPage(col);
+        char*        page   = static_cast<char*>(bf.getData());
+        Header*      header = reinterpret_cast<Header*>(page);
+
+        size_t count = std::min(values.size()-start, maxBlockValues);
+        while (true) {
+            // build the sorted dictionary of the block
+            std::vector<std::string> dict(values.begin()+start, values.begin()+start+count);
+            std::sort(dict.begin(), dict.end());
+            dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+
+            size_t offset = sizeof(Header) + dict.size()*col.len;
+            offset = (offset + 7) & ~(size_t) 7;
+
+            // replace the values by their codes
+            size_t needed = offset;
+            if (offset <= blocksize) {
+                std::vector<int64_t> codes(count);
+                for (size_t i = 0; i < count; i++)
+                    codes[i] = std::lower_bound(dict.begin(), dict.end(), values[start+i]) - dict.begin();
+
+                if (encode(page, offset, codes.data(), count, needed)) {
+                    header->dictCount = dict.size();
+                    for (size_t i = 0; i < dict.size(); i++)
+                        memcpy(page + sizeof(Header) + i*col.len, dict[i].data(), col.len);
+                    break;
+                }
+            }
+
+            // shrink the block until it fits into the page
+            size_t estimate = count * blocksize / needed;
+            count = (estimate < count) ? estimate : count-1;
+        }
+
+        bm.unfixPage(bf, true);
+        start += count;
+    }
+}
+
+// Encodes values[0..count) after offset, choosing the smaller encoding
+bool ColumnSegment::encode(char* page, size_t offset, const int64_t* values, size_t count, size_t& needed) {
+    // frame of reference + bit-packing
+    int64_t min = *std::min_element(values, values+count);
+    int64_t max = *std::max_element(values, values+count);
+    uint8_t width = bitsNeeded((uint64_t) max - (uint64_t) min);
+    size_t  packedSize = ((count*width + 63) / 64) * 8;
+
+    // run-length encoding
+    uint32_t runs = 1;
+    for (size_t i = 1; i < count; i++)
+        if (values[i] != values[i-1])
+            runs++;
+    size_t rleSize = runs * (sizeof(int64_t) + sizeof(uint32_t));
+
+    Header* header = reinterpret_cast<Header*>(page);
+    header->count     = count;
+    header->dictCount = 0;
+    header->runCount  = 0;
+    header->base      = 0;
+    header->width     = 0;
+
+    if (rleSize < packedSize) {
+        needed = offset + rleSize;
+        if (needed > blocksize)
+            return false;
+
+        header->encoding = Encoding::RunLength;
+        header->runCount = runs;
+
+        // run values followed by run lengths
+        int64_t*  runValues  = reinterpret_cast<int64_t*>(page+offset);
+        uint32_t* runLengths = reinterpret_cast<uint32_t*>(runValues+runs);
+        uint32_t  run = 0;
+        runValues[0]  = values[0];
+        runLengths[0] = 1;
+        for (size_t i = 1; i < count; i++) {
+            if (values[i] != values[i-1]) {
+                run++;
+                runValues[run]  = values[i];
+                runLengths[run] = 0;
+            }
+            runLengths[run]++;
+        }
+
+    } else {
+        needed = offset + packedSize;
+        if (needed > blocksize)
+            return false;
+
+        header->encoding = Encoding::BitPacked;
+        header->base     = min;
+        header->width    = width;
+
+        uint64_t* words = reinterpret_cast<uint64_t*>(page+offset);
+        memset(words, 0, packedSize);
+        if (width > 0) {
+            for (size_t i = 0; i < count; i++) {
+                uint64_t v     = (uint64_t) values[i] - (uint64_t) min;
+                size_t   bit   = i * width;
+                size_t   word  = bit / 64;
+                size_t   shift = bit % 64;
+
+                words[word] |= v << shift;
+                if (shift + width > 64)
+                    words[word+1] |= v >> (64 - shift);
+            }
+        }
+    }
+
+    return true;
+}
+
+// Decodes the integers of the block stored after offset
+void ColumnSegment::decode(const char* page, size_t offset, std::vector<int64_t>& out) {
+    const Header* header = reinterpret_cast<const Header*>(page);
+    out.resize(header->count);
+
+    if (header->encoding == Encoding::RunLength) {
+        const int64_t*  runValues  = reinterpret_cast<const int64_t*>(page+offset);
+        const uint32_t* runLengths = reinterpret_cast<const uint32_t*>(runValues+header->runCount);
+        size_t i = 0;
+        for (uint32_t run = 0; run < header->runCount; run++) {
+            std::fill(out.begin()+i, out.begin()+i+runLengths[run], runValues[run]);
+            i += runLengths[run];
+        }
+        return;
+    }
+
+    uint8_t  width = header->width;
+    uint64_t base  = header->base;
+    if (width == 0) {
+        std::fill(out.begin(), out.end(), header->base);
+        return;
+    }
+
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(page+offset);
+    uint64_t        mask  = (width == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << width) - 1;
+    for (size_t i = 0; i < out.size(); i++) {
+        size_t   bit   = i * width;
+        size_t   word  = bit / 64;
+        size_t   shift = bit % 64;
+        uint64_t v     = words[word] >> shift;
+        if (shift + width > 64)
+            v |= words[word+1] << (64 - shift);
+        out[i] = base + (v & mask);
+    }
+}
+
+// Decodes a block of an Integer column
+void ColumnSegment::decodeBlock(unsigned attr, size_t block, std::vector<int64_t>& out) {
+    Column& col = columns[attr];
+    if (col.type != Types::Tag::Integer)
+        throw std::invalid_argument("not an Integer column");
+
+    BufferFrame& bf = bm.fixPage((id << 48) | col.pages[block], false);
+    decode(static_cast<char*>(bf.getData()), sizeof(Header), out);
+    bm.unfixPage(bf, false);
+}
+
+// Decodes a block of a Char column. Values end at the first '\0' like in
+// Register::load
+void ColumnSegment::decodeBlock(unsigned attr, size_t block, std::vector<std::string>& out) {
+    Column& col = columns[attr];
+    if (col.type != Types::Tag::Char)
+        throw std::invalid_argument("not a Char column");
+
+    BufferFrame& bf     = bm.fixPage((id << 48) | col.pages[block], false);
+    const char*  page   = static_cast<char*>(bf.getData());
+    auto         header = reinterpret_cast<const Header*>(page);
+
+    size_t offset = sizeof(Header) + header->dictCount*col.len;
+    offset = (offset + 7) & ~(size_t) 7;
+
+    // decode the dictionary once, then the codes
+    std::vector<std::string> dict;
+    dict.reserve(header->dictCount);
+    for (uint32_t i = 0; i < header->dictCount; i++) {
+        const char* entry = page + sizeof(Header) + i*col.len;
+        dict.push_back(std::string(entry, strnlen(entry, col.len)));
+    }
+
+    std::vector<int64_t> codes;
+    decode(page, offset, codes);
+    bm.unfixPage(bf, false);
+
+    out.resize(codes.size());
+    for (size_t i = 0; i < codes.size(); i++)
+        out[i] = dict[codes[i]];
+}
+
+// Fixes a new page and links it to the end of the column's page chain
+BufferFrame& ColumnSegment::appendPage(Column& col) {
+    uint32_t pageID = size++;
+
+    if (!col.pages.empty()) {
+        BufferFrame& last = bm.fixPage((id << 48) | col.pages.back(), true);
+        reinterpret_cast<Header*>(last.getData())->next = pageID;
+        bm.unfixPage(last, true);
+    }
+    col.pages.push_back(pageID);
+
+    BufferFrame& bf = bm.fixPage((id << 48) | pageID, true);
+    Header* header = new (bf.getData()) Header();
+    header->next = none;
+    return bf;
+}
+
+void ColumnSegment::readMetadata() {
+    BufferFrame& bf    = bm.fixPage((id << 48) | metadataPage, false);
+    const char*  page  = static_cast<char*>(bf.getData());
+    auto         meta  = reinterpret_cast<const Metadata*>(page);
+    auto         infos = reinterpret_cast<const ColumnInfo*>(page + sizeof(Metadata));
+
+    bool valid = meta->magic == magic && meta->blocksize == blocksize &&
+        meta->columnCount == columns.size();
+    for (size_t i = 0; valid && i < columns.size(); i++)
+        valid = infos[i].type == (uint32_t) columns[i].type && infos[i].len == columns[i].len;
+
+    std::vector<uint32_t> firsts;
+    if (valid) {
+        rowCount = meta->rowCount;
+        for (size_t i = 0; i < columns.size(); i++)
+            firsts.push_back(infos[i].first);
+    }
+    bm.unfixPage(bf, false);
+
+    if (!valid)
+        throw std::runtime_error("Segment does not hold the columns of this relation");
+
+    // every page belongs to a single chain, the segment ends behind the last
+    size = 1;
+    for (size_t i = 0; i < columns.size(); i++) {
+        uint64_t values = 0;
+        for (uint32_t pageID = firsts[i]; pageID != none;) {
+            if (pageID == metadataPage || columns[i].pages.size() > rowCount)
+                throw std::runtime_error("Page chain of the column is corrupted");
+
+            BufferFrame& bfPage = bm.fixPage((id << 48) | pageID, false);
+            auto         header = static_cast<const Header*>(bfPage.getData());
+            values += header->count;
+            uint32_t next = header->next;
+            bm.unfixPage(bfPage, false);
+
+            columns[i].pages.push_back(pageID);
+            size  = std::max<size_t>(size, pageID+1);
+            pageID = next;
+        }
+
+        if (values != rowCount)
+            throw std::runtime_error("Page chain of the column is corrupted");
+    }
+}
+
+void ColumnSegment::writeMetadata() {
+    BufferFrame& bf    = bm.fixPage((id << 48) | metadataPage, true);
+    char*        page  = static_cast<char*>(bf.getData());
+    auto         meta  = reinterpret_cast<Metadata*>(page);
+    auto         infos = reinterpret_cast<ColumnInfo*>(page + sizeof(Metadata));
+
+    meta->magic       = magic;
+    meta->blocksize   = blocksize;
+    meta->columnCount = columns.size();
+    meta->rowCount    = rowCount;
+    for (size_t i = 0; i < columns.size(); i++) {
+        infos[i].type     = (uint32_t) columns[i].type;
+        infos[i].len      = columns[i].len;
+        infos[i].first    = columns[i].pages.empty() ? none : columns[i].pages[0];
+        infos[i].reserved = 0;
+    }
+    bm.unfixPage(bf, true);
+}
@@ -0,0 +1,120 @@
+#ifndef COLUMNSEGMENT_H_
+#define COLUMNSEGMENT_H_
+
+#include <string>
+#include <vector>
+
+#include "Schema.hpp"
+#include "Segment.hpp"
+
+// A column store segment: every attribute of a relation is stored in its own
+// chain of pages, so scans only read the columns they need.
+// Each page holds one compressed block of consecutive values of a column.
+// Integer values are encoded with frame of reference + bit-packing or with
+// run-length encoding, whichever is smaller. Char values are replaced by codes
+// into an order-preserving per-block dictionary, which are then encoded like
+// integers.
+// The segment is append-only; rows are passed in row format, i.e. the values
+// of all attributes concatenated. The first page holds the metadata: the row
+// count and the first page of every column, which is written by every append
+// so that the segment can be opened again
+class ColumnSegment : public Segment {
+  public:
+    enum class Encoding : uint8_t {BitPacked, RunLength};
+
+    struct Header {
+        // LSN for recovery
+        uint32_t next;      // next page of the column, none if last
+        uint32_t count;     // number of values in this block
+        uint32_t dictCount; // number of dictionary entries (Char only)
+        uint32_t runCount;  // number of runs (RunLength only)
+        int64_t  base;      // frame of reference (BitPacked only)
+        Encoding encoding;
+        uint8_t  width;     // bits per value (BitPacked only)
+    };
+
+    static const uint32_t none = ~0u;
+
+    // Creates an empty segment for the relation or opens the segment stored
+    // for it, whose page chains are read then
+    ColumnSegment(BufferManager& bm, uint64_t id, const Schema::Relation& rel,
+        TreeMode mode = TreeMode::Create);
+
+    // Appends count rows stored back to back in rows. Each column gets new
+    // blocks, thus rows should be appended in large batches
+    void append(const char* rows, size_t count);
+
+    // Returns the number of rows
+    uint64_t getRowCount() {
+        return rowCount;
+    }
+
+    // Returns the number of blocks of the given attribute
+    size_t getBlockCount(unsigned attr) {
+        return columns[attr].pages.size();
+    }
+
+    Types::Tag getType(unsigned attr) {
+        return columns[attr].type;
+    }
+
+    // Decodes a block of an Integer column into out
+    void decodeBlock(unsigned attr, size_t block, std::vector<int64_t>& out);
+
+    // Decodes a block of a Char column into out
+    void decodeBlock(unsigned attr, size_t block, std::vector<std::string>& out);
+
+  private:
+    // the first page of the segment holds the metadata
+    static const uint32_t metadataPage = 0;
+
+    // identifies the metadata page of a column segment
+    static const uint64_t magic = 0x436F6C756D6E0001ull;
+
+    // followed by a ColumnInfo for every attribute
+    struct Metadata {
+        uint64_t magic;
+        uint32_t blocksize;
+        uint32_t columnCount;
+        uint64_t rowCount;
+    };
+
+    struct ColumnInfo {
+        uint32_t type;
+        uint32_t len;
+        uint32_t first; // first page of the chain, none if empty
+        uint32_t reserved;
+    };
+
+    struct Column {
+        Types::Tag            type;
+        size_t                len;
+        std::vector<uint32_t> pages; // the page chain
+    };
+
+    std::vector<Column> columns;
+    size_t              rowLen;
+    uint64_t            rowCount;
+
+    // writes the integers (or dictionary codes) as blocks of the column
+    void appendInts(Column& col, const std::vector<int64_t>& values);
+    void appendChars(Column& col, const std::vector<std::string>& values);
+
+    // encodes values[0..count) into page after its header and dictionary.
+    // Returns false if the encoded block does not fit into the page
+    bool encode(char* page, size_t offset, const int64_t* values, size_t count, size_t& needed);
+
+    // decodes the integers of the block into out
+    void decode(const char* page, size_t offset, std::vector<int64_t>& out);
+
+    // fixes a new page and links it to the end of the column's page chain
+    BufferFrame& appendPage(Column& col);
+
+    // reads the metadata and follows the page chains of the columns, after
+    // checking that the segment holds the columns of the relation
+    void readMetadata();
+
+    void writeMetadata();
+};
+
+#endif  // COLUMNSEGMENT_H_
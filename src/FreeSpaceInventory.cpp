@@ -0,0 +1,112 @@
+#include <cstring>
+
+#include "FreeSpaceInventory.hpp"
+
+const uint32_t FreeSpaceInventory::none;
+
+FreeSpaceInventory::FreeSpaceInventory() {
+    for (unsigned i = 0; i < classCount; i++)
+        heads[i] = none;
+    memset(nonEmpty, 0, sizeof(nonEmpty));
+}
+
+bool FreeSpaceInventory::find(size_t space, uint32_t& pageID) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    // every page of the class space rounded up to and of the higher classes
+    // is large enough. Pages of the class below which would still have room
+    // are not searched, so that finding a page takes constant time
+    unsigned cls = (space + classSize-1) / classSize;
+    if (cls >= classCount)
+        return false;
+
+    cls = nextClass(cls);
+    if (cls == classCount)
+        return false;
+
+    pageID = heads[cls];
+    return true;
+}
+
+void FreeSpaceInventory::update(uint32_t pageID, size_t space) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if (pageID >= freeSpace.size()) {
+        // new page(s), nothing to unlink
+        freeSpace.resize(pageID+1, 0);
+        prev.resize(pageID+1, none);
+        next.resize(pageID+1, none);
+        link(pageID, getClass(space));
+
+    } else {
+        unsigned oldCls = getClass(freeSpace[pageID]);
+        unsigned newCls = getClass(space);
+        if (oldCls != newCls) {
+            unlink(pageID, oldCls);
+            link(pageID, newCls);
+        }
+    }
+
+    freeSpace[pageID] = space;
+}
+
+void FreeSpaceInventory::truncate(uint32_t pages) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    for (uint32_t pageID = pages; pageID < freeSpace.size(); pageID++)
+        unlink(pageID, getClass(freeSpace[pageID]));
+
+    if (pages < freeSpace.size()) {
+        freeSpace.resize(pages);
+        prev.resize(pages);
+        next.resize(pages);
+    }
+}
+
+// insert the page at the front of the class list
+void FreeSpaceInventory::link(uint32_t pageID, unsigned cls) {
+    uint32_t head = heads[cls];
+
+    prev[pageID] = none;
+    next[pageID] = head;
+    if (head != none)
+        prev[head] = pageID;
+    heads[cls] = pageID;
+
+    nonEmpty[cls / 64] |= (uint64_t) 1 << (cls % 64);
+}
+
+// remove the page from the class list
+void FreeSpaceInventory::unlink(uint32_t pageID, unsigned cls) {
+    uint32_t p = prev[pageID];
+    uint32_t n = next[pageID];
+
+    if (p != none)
+        next[p] = n;
+    else
+        heads[cls] = n;
+
+    if (n != none)
+        prev[n] = p;
+
+    prev[pageID] = next[pageID] = none;
+
+    if (heads[cls] == none)
+        nonEmpty[cls / 64] &= ~((uint64_t) 1 << (cls % 64));
+}
+
+unsigned FreeSpaceInventory::nextClass(unsigned cls) {
+    unsigned word = cls / 64;
+    if (word >= wordCount)
+        return classCount;
+
+    // mask out the lower classes in the first word
+    uint64_t bits = nonEmpty[word] & (~(uint64_t) 0 << (cls % 64));
+    while (bits == 0) {
+        if (++word == wordCount)
+            return classCount;
+        bits = nonEmpty[word];
+    }
+
+    return word*64 + __builtin_ctzll(bits);
+}
@@ -0,0 +1,64 @@
+#ifndef FREESPACEINVENTORY_H_
+#define FREESPACEINVENTORY_H_
+
+#include <cstdint>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+
+#include "BufferManager.hpp"
+
+// A free space inventory (FSI) keeps track of the free space of every page of
+// a segment, so that a page with enough room for a new record can be found
+// without fixing and inspecting all pages of the segment.
+// Pages are grouped into fill classes of classSize bytes. Each class keeps a
+// doubly-linked list of its pages and a bitmap marks the non-empty classes.
+// All operations are synchronized by a mutex.
+class FreeSpaceInventory {
+  public:
+    FreeSpaceInventory();
+
+    // Looks for a page with at least space bytes of free space in constant
+    // time. Returns false if no such page exists; pages whose free space is
+    // less than space rounded up to the class size are not considered
+    bool find(size_t space, uint32_t& pageID);
+
+    // Records the current free space of the given page. Pages which are not
+    // yet known are added to the inventory
+    void update(uint32_t pageID, size_t freeSpace);
+
+    // Forgets all pages from the given page ID on, e.g. after the segment was
+    // truncated
+    void truncate(uint32_t pages);
+
+  private:
+    static const size_t   classSize  = 16;
+    static const unsigned classCount = blocksize / classSize + 1;
+    static const unsigned wordCount  = (classCount + 63) / 64;
+    static const uint32_t none       = ~0u;
+
+    inline static unsigned getClass(size_t freeSpace) {
+        return freeSpace / classSize;
+    }
+
+    void link(uint32_t pageID, unsigned cls);
+    void unlink(uint32_t pageID, unsigned cls);
+
+    // returns the first non-empty class >= cls or classCount
+    unsigned nextClass(unsigned cls);
+
+    // per page: exact free space and the links of the class list
+    std::vector<uint16_t> freeSpace;
+    std::vector<uint32_t> prev;
+    std::vector<uint32_t> next;
+
+    // per class: first page in the class list
+    uint32_t heads[classCount];
+
+    // bitmap of non-empty classes
+    uint64_t nonEmpty[wordCount];
+
+    std::mutex mutex;
+};
+
+#endif  // FREESPACEINVENTORY_H_
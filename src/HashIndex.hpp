@@ -0,0 +1,385 @@
+#ifndef HASHINDEX_H_
+#define HASHINDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <pthread.h>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "Segment.hpp"
+#include "TID.hpp"
+
+// Index for equality lookups with extendible hashing: the entries are stored
+// in bucket pages, a directory maps the lowest bits of the hash of a key to
+// the bucket of the key. The directory is kept in memory, thus a lookup fixes
+// a single page. A full bucket is split into two buckets which tell one more
+// bit of the hash apart; only if it was addressed by all bits the directory
+// uses, the directory is doubled, which copies the page numbers but no
+// entries. Buckets are not merged again. The directory is stored on pages of
+// its own by flush and when the index is destroyed, an index opened again must
+// be given a HASH which hashes keys the same way
+template <class K, class HASH = std::hash<K>, class EQUAL = std::equal_to<K>>
+class HashIndex : public Segment {
+    static_assert(std::is_trivially_copyable<K>::value, "HashIndex keys are stored as they are");
+
+    // calculate bucket capacity from page size
+    static const size_t capacity =
+        (blocksize - 2*sizeof(uint64_t)) / (sizeof(K) + sizeof(TID) + sizeof(uint32_t));
+
+    // number of hash bits a bucket may be addressed by at most
+    static const unsigned maxDepth = 32;
+
+    // the first page of the segment holds the metadata
+    static const uint64_t metadataPage = 0;
+
+    // identifies the metadata page of an index
+    static const uint64_t magic = 0x4861736849000002ull;
+
+    struct Metadata {
+        uint64_t magic;
+        uint32_t blocksize;
+        uint32_t keySize;
+        uint32_t globalDepth;
+        uint32_t reserved;
+        uint64_t size;      // pages of the metadata, the buckets and the directory
+        uint64_t directory; // first page of the directory
+    };
+
+    // number of directory entries per page
+    static const size_t directoryCapacity = (blocksize - sizeof(uint64_t)) / sizeof(uint64_t);
+
+    // The directory is stored on a chain of pages, which are kept and
+    // overwritten when the directory is stored again. The last page links to
+    // the metadata page
+    struct DirectoryPage {
+        uint64_t next;
+        uint64_t entries[directoryCapacity];
+    };
+
+    // A bucket holds the entries whose hashes end with the lowest depth bits
+    // of prefix. Every key has a tag, the upper bits of its hash, which is
+    // compared first
+    struct Bucket {
+        uint32_t depth;
+        uint32_t count;
+        uint64_t prefix;
+        K        keys[capacity];
+        TID      tids[capacity];
+        uint32_t tags[capacity];
+
+        Bucket(uint32_t depth, uint64_t prefix) : depth(depth), count(0), prefix(prefix) {};
+
+        // returns true if the bucket is addressed by the hash, otherwise the
+        // bucket was split since the directory was read
+        inline bool holds(uint64_t hash) {
+            return (hash & ((1ull << depth) - 1)) == prefix;
+        }
+
+        // returns the index of the key or count
+        unsigned find(const K& key, uint64_t hash) {
+            EQUAL    equal;
+            uint32_t tag = getTag(hash);
+            for (unsigned i = 0; i < count; i++) {
+                if (tags[i] == tag && equal(keys[i], key)) {
+                    return i;
+                }
+            }
+            return count;
+        }
+
+        inline void append(const K& key, TID tid, uint32_t tag) {
+            keys[count] = key;
+            tids[count] = tid;
+            tags[count] = tag;
+            count++;
+        }
+
+        // moves the last entry into the gap
+        inline void remove(unsigned i) {
+            count--;
+            keys[i] = keys[count];
+            tids[i] = tids[count];
+            tags[i] = tags[count];
+        }
+    };
+
+  public:
+    // Creates an empty index or opens the index stored on the segment
+    HashIndex(BufferManager& bm, uint64_t id, TreeMode mode = TreeMode::Create) :
+            Segment(bm, id), globalDepth(0) {
+        static_assert(sizeof(Bucket) <= blocksize, "Bucket size exceeds page size");
+        static_assert(sizeof(Metadata) <= blocksize, "Metadata size exceeds page size");
+        static_assert(sizeof(DirectoryPage) <= blocksize, "DirectoryPage size exceeds page size");
+
+        if (mode == TreeMode::Open) {
+            readMetadata();
+        } else {
+            // a single bucket for all hashes
+            BufferFrame& bf = fixPage(1, true);
+            new (bf.getData()) Bucket(0, 0);
+            bm.unfixPage(bf, true);
+            size = 2;
+            directory.push_back(1);
+        }
+
+        pthread_rwlock_init(&latch, NULL);
+    }
+
+    ~HashIndex() {
+        flush();
+        pthread_rwlock_destroy(&latch);
+    }
+
+    // Writes the metadata and the directory, so that the index can be opened
+    // again as it is now even if this object is never destroyed. Lookups may
+    // run concurrently, but no inserts, which might split a bucket, and no
+    // other flush
+    void flush() {
+        writeMetadata();
+    }
+
+    bool lookup(K key, TID& tid) {
+        uint64_t     hash = getHash(key);
+        BufferFrame& bf   = fixBucket(hash, false);
+        Bucket*      b    = static_cast<Bucket*>(bf.getData());
+
+        unsigned i     = b->find(key, hash);
+        bool     found = i < b->count;
+        if (found) {
+            tid = b->tids[i];
+        }
+        bm.unfixPage(bf, false);
+        return found;
+    }
+
+    // Inserts the entry, the TID of an existing key is overwritten
+    void insert(K key, TID tid) {
+        uint64_t hash = getHash(key);
+        while (true) {
+            BufferFrame& bf = fixBucket(hash, true);
+            Bucket*      b  = static_cast<Bucket*>(bf.getData());
+
+            unsigned i = b->find(key, hash);
+            if (i < b->count) {
+                b->tids[i] = tid; // overwrite existing value
+                bm.unfixPage(bf, true);
+                return;
+            }
+            if (b->count < capacity) {
+                b->append(key, tid, getTag(hash));
+                bm.unfixPage(bf, true);
+                return;
+            }
+
+            // splitting does not help if all hashes are the same
+            if (b->depth == maxDepth || allHashesEqual(b, hash)) {
+                bm.unfixPage(bf, false);
+                throw std::overflow_error("Too many keys with the same hash");
+            }
+
+            // the entries might all stay in one of the buckets, which is
+            // split again then
+            split(bf);
+            bm.unfixPage(bf, true);
+        }
+    }
+
+    // Returns false if the key was not found
+    bool erase(K key) {
+        uint64_t     hash = getHash(key);
+        BufferFrame& bf   = fixBucket(hash, true);
+        Bucket*      b    = static_cast<Bucket*>(bf.getData());
+
+        unsigned i     = b->find(key, hash);
+        bool     found = i < b->count;
+        if (found) {
+            b->remove(i);
+        }
+        bm.unfixPage(bf, found);
+        return found;
+    }
+
+  private:
+    // the bucket pages by the lowest globalDepth bits of the hashes
+    std::vector<uint64_t> directory;
+    unsigned              globalDepth;
+    pthread_rwlock_t      latch; // protects the directory
+
+    // the pages the directory was stored on, in chain order
+    std::vector<uint64_t> directoryPages;
+
+    inline BufferFrame& fixPage(uint64_t pageID, bool exclusive) {
+        return bm.fixPage((id << 48) | pageID, exclusive);
+    }
+
+    // std::hash of integers is the identity, the bits are mixed so that the
+    // buckets are used evenly by all kinds of keys
+    inline static uint64_t getHash(const K& key) {
+        HASH     hasher;
+        uint64_t hash = hasher(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    inline uint64_t getDirectoryPageCount() const {
+        return (directory.size() + directoryCapacity-1) / directoryCapacity;
+    }
+
+    // Reads the metadata and the directory, after checking that the segment
+    // holds an index with the same key size
+    void readMetadata() {
+        BufferFrame& bf   = fixPage(metadataPage, false);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        bool valid = meta->magic == magic && meta->blocksize == blocksize &&
+            meta->keySize == sizeof(K) && meta->globalDepth <= maxDepth && meta->size > 2;
+        globalDepth     = meta->globalDepth;
+        size            = meta->size;
+        uint64_t pageID = meta->directory;
+        bm.unfixPage(bf, false);
+
+        if (!valid) {
+            throw std::runtime_error("Segment does not hold an index with this key size");
+        }
+
+        directory.resize(1ull << globalDepth);
+        for (uint64_t page = 0; page < getDirectoryPageCount(); page++) {
+            if (pageID == metadataPage || pageID >= size) {
+                throw std::runtime_error("Directory of the index is corrupted");
+            }
+            directoryPages.push_back(pageID);
+
+            BufferFrame&   bfDir = fixPage(pageID, false);
+            DirectoryPage* dir   = static_cast<DirectoryPage*>(bfDir.getData());
+            uint64_t       first = page*directoryCapacity;
+            uint64_t       count = std::min<uint64_t>(directoryCapacity, directory.size() - first);
+            std::copy(dir->entries, dir->entries + count, directory.begin() + first);
+            pageID = dir->next;
+            bm.unfixPage(bfDir, false);
+        }
+        if (pageID != metadataPage) {
+            throw std::runtime_error("Directory of the index is corrupted");
+        }
+
+        std::vector<uint64_t> sortedPages(directoryPages);
+        std::sort(sortedPages.begin(), sortedPages.end());
+        for (uint64_t entry : directory) {
+            if (entry == metadataPage || entry >= size ||
+                    std::binary_search(sortedPages.begin(), sortedPages.end(), entry)) {
+                throw std::runtime_error("Directory of the index is corrupted");
+            }
+        }
+    }
+
+    // Writes the directory on its pages, which are allocated when it grew,
+    // and then the metadata which refers to them
+    void writeMetadata() {
+        pthread_rwlock_rdlock(&latch);
+        std::vector<uint64_t> entries(directory);
+        unsigned              depth = globalDepth;
+        pthread_rwlock_unlock(&latch);
+
+        uint64_t pageCount = (entries.size() + directoryCapacity-1) / directoryCapacity;
+        while (directoryPages.size() < pageCount) {
+            directoryPages.push_back(size++);
+        }
+
+        for (uint64_t page = 0; page < pageCount; page++) {
+            BufferFrame&   bfDir = fixPage(directoryPages[page], true);
+            DirectoryPage* dir   = static_cast<DirectoryPage*>(bfDir.getData());
+            uint64_t       first = page*directoryCapacity;
+            uint64_t       count = std::min<uint64_t>(directoryCapacity, entries.size() - first);
+            dir->next = page+1 < pageCount ? directoryPages[page+1] : metadataPage;
+            std::copy(entries.begin() + first, entries.begin() + first + count, dir->entries);
+            bm.unfixPage(bfDir, true);
+        }
+
+        BufferFrame& bf   = fixPage(metadataPage, true);
+        Metadata*    meta = static_cast<Metadata*>(bf.getData());
+        meta->magic       = magic;
+        meta->blocksize   = blocksize;
+        meta->keySize     = sizeof(K);
+        meta->globalDepth = depth;
+        meta->reserved    = 0;
+        meta->size        = size;
+        meta->directory   = directoryPages[0];
+        bm.unfixPage(bf, true);
+    }
+
+    inline static uint32_t getTag(uint64_t hash) {
+        return static_cast<uint32_t>(hash >> 32);
+    }
+
+    static bool allHashesEqual(Bucket* b, uint64_t hash) {
+        for (unsigned i = 0; i < b->count; i++) {
+            if (b->tags[i] != getTag(hash) || getHash(b->keys[i]) != hash) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Fixes the bucket of the hash. The directory is not latched while the
+    // page is fixed, the bucket is looked up again if it was split meanwhile
+    BufferFrame& fixBucket(uint64_t hash, bool exclusive) {
+        while (true) {
+            pthread_rwlock_rdlock(&latch);
+            uint64_t pageID = directory[hash & ((1ull << globalDepth) - 1)];
+            pthread_rwlock_unlock(&latch);
+
+            BufferFrame& bf = fixPage(pageID, exclusive);
+            if (static_cast<Bucket*>(bf.getData())->holds(hash)) {
+                return bf;
+            }
+            bm.unfixPage(bf, false);
+        }
+    }
+
+    // Splits the exclusively fixed bucket: the entries whose hashes have the
+    // next bit set move to a new bucket on a new page. The directory is
+    // updated before the bucket is released, so that the moved entries are
+    // found through the new bucket once they are gone from the old one
+    void split(BufferFrame& bf) {
+        Bucket* b = static_cast<Bucket*>(bf.getData());
+
+        uint64_t     bit    = 1ull << b->depth;
+        uint64_t     pageID = size++;
+        BufferFrame& bfNew  = fixPage(pageID, true);
+        Bucket*      newB   = new (bfNew.getData()) Bucket(b->depth+1, b->prefix | bit);
+
+        for (unsigned i = 0; i < b->count;) {
+            if (getHash(b->keys[i]) & bit) {
+                newB->append(b->keys[i], b->tids[i], b->tags[i]);
+                b->remove(i);
+            } else {
+                i++;
+            }
+        }
+        b->depth++;
+
+        pthread_rwlock_wrlock(&latch);
+        if (b->depth > globalDepth) {
+            // both halves of the doubled directory point to the same buckets
+            size_t n = directory.size();
+            directory.resize(2*n);
+            std::copy(directory.begin(), directory.begin()+n, directory.begin()+n);
+            globalDepth++;
+        }
+        // redirect every entry with the prefix of the new bucket
+        for (uint64_t i = newB->prefix; i < directory.size(); i += bit << 1) {
+            directory[i] = pageID;
+        }
+        pthread_rwlock_unlock(&latch);
+
+        bm.unfixPage(bfNew, true);
+    }
+};
+
+#endif  // HASHINDEX_H_
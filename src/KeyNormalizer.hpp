@@ -0,0 +1,91 @@
+#ifndef KEYNORMALIZER_H_
+#define KEYNORMALIZER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "Types.hpp"
+
+// Encodes keys as byte strings of a fixed size whose memcmp order is the
+// order of the compare function LESS, so that they can be compared, truncated
+// and searched without calling LESS. The encoding must be reversible.
+// BTree stores keys normalized if the normalizer of K and LESS is enabled.
+// Specializations must provide:
+//   static const bool     enabled = true;
+//   static const unsigned size;          // size of an encoded key
+//   static void normalize(const K& key, uint8_t* out);
+//   static K    denormalize(const uint8_t* in);
+template <class K, class LESS>
+struct KeyNormalizer {
+    static const bool     enabled = false;
+    static const unsigned size    = sizeof(K);
+};
+
+// Integers are stored big-endian, signed ones with the sign bit flipped, so
+// that negative numbers come first
+template <class T>
+inline void normalizeInteger(T value, uint8_t* out) {
+    typedef typename std::make_unsigned<T>::type U;
+    U u = static_cast<U>(value);
+    if (std::is_signed<T>::value)
+        u ^= static_cast<U>(1) << (sizeof(T)*8 - 1);
+
+    for (unsigned i = 0; i < sizeof(T); i++)
+        out[i] = static_cast<uint8_t>(u >> ((sizeof(T)-1-i) * 8));
+}
+
+template <class T>
+inline T denormalizeInteger(const uint8_t* in) {
+    typedef typename std::make_unsigned<T>::type U;
+    U u = 0;
+    for (unsigned i = 0; i < sizeof(T); i++)
+        u = static_cast<U>((u << 8) | in[i]);
+
+    if (std::is_signed<T>::value)
+        u ^= static_cast<U>(1) << (sizeof(T)*8 - 1);
+    return static_cast<T>(u);
+}
+
+// Normalizer for integer keys in their natural order. BTree does not use it,
+// its leaves search integer keys as they are, see NodeSearch
+template <class T>
+struct IntegerNormalizer {
+    static const bool     enabled = true;
+    static const unsigned size    = sizeof(T);
+
+    static void normalize(T key, uint8_t* out) {
+        normalizeInteger(key, out);
+    }
+
+    static T denormalize(const uint8_t* in) {
+        return denormalizeInteger<T>(in);
+    }
+};
+
+// Orders fixed-length strings bytewise, like memcmp
+template <unsigned len>
+struct CharLess {
+    bool operator()(const Char<len>& a, const Char<len>& b) const {
+        return memcmp(a.data, b.data, len) < 0;
+    }
+};
+
+// The bytes of a fixed-length string already are in the order of CharLess
+template <unsigned len>
+struct KeyNormalizer<Char<len>, CharLess<len>> {
+    static const bool     enabled = true;
+    static const unsigned size    = len;
+
+    static void normalize(const Char<len>& key, uint8_t* out) {
+        memcpy(out, key.data, len);
+    }
+
+    static Char<len> denormalize(const uint8_t* in) {
+        Char<len> key;
+        memcpy(key.data, in, len);
+        return key;
+    }
+};
+
+#endif  // KEYNORMALIZER_H_
@@ -0,0 +1,159 @@
+#ifndef MULTIBTREE_H_
+#define MULTIBTREE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BTree.hpp"
+#include "KeyNormalizer.hpp"
+#include "TID.hpp"
+
+// Entry of a MultiBTree, which is stored as key of a BTree
+template <class K>
+struct KeyTID {
+    K   key;
+    TID tid;
+};
+
+// Orders the entries of a MultiBTree by key and the entries with equal keys
+// by TID
+template <class K, class LESS>
+struct KeyTIDLess {
+    LESS less;
+
+    bool operator()(const KeyTID<K>& a, const KeyTID<K>& b) const {
+        if (less(a.key, b.key))
+            return true;
+        return !less(b.key, a.key) && a.tid < b.tid;
+    }
+};
+
+// The TID is part of the entry, thus the leaves do not store it again
+template <class K>
+struct EmbeddedTID<KeyTID<K>> {
+    static const bool enabled = true;
+
+    static TID get(const KeyTID<K>& entry) {
+        return entry.tid;
+    }
+};
+
+// Entries are normalized if their keys are: the normalized key is followed
+// by the TID. The entries of a key share the normalized key as prefix, which
+// prefix truncated leaves store only once, like a posting list
+template <class K, class LESS>
+struct KeyNormalizer<KeyTID<K>, KeyTIDLess<K, LESS>> {
+    typedef KeyNormalizer<K, LESS> KeyNorm;
+
+    static const bool     enabled = KeyNorm::enabled;
+    static const unsigned size    = KeyNorm::size + 2*sizeof(uint32_t);
+
+    static void normalize(const KeyTID<K>& entry, uint8_t* out) {
+        KeyNorm::normalize(entry.key, out);
+        normalizeInteger(entry.tid.pageID, out+KeyNorm::size);
+        normalizeInteger(entry.tid.slotID, out+KeyNorm::size+sizeof(uint32_t));
+    }
+
+    static KeyTID<K> denormalize(const uint8_t* in) {
+        KeyTID<K> entry;
+        entry.key        = KeyNorm::denormalize(in);
+        entry.tid.pageID = denormalizeInteger<uint32_t>(in+KeyNorm::size);
+        entry.tid.slotID = denormalizeInteger<uint32_t>(in+KeyNorm::size+sizeof(uint32_t));
+        return entry;
+    }
+};
+
+// Index which allows several entries with the same key, e.g. a secondary
+// index on a non-unique column. The entries are stored in a BTree as
+// composite keys of key and TID, thus an entry is unique and can be erased
+// on its own, and the entries of a key are returned in TID order
+template <class K, class LESS = std::less<K>>
+class MultiBTree {
+    static_assert(!std::is_same<K, std::string>::value,
+        "MultiBTree does not support keys of varying size");
+
+    typedef KeyTID<K>                         Entry;
+    typedef BTree<Entry, KeyTIDLess<K, LESS>> Tree;
+
+    Tree tree;
+
+  public:
+    // Iterates over the entries of a key or a key range, see
+    // BTree::RangeIterator
+    class Iterator {
+      public:
+        // Moves to the next entry. Returns false when there is none
+        bool next() {
+            return it.next();
+        }
+
+        K getKey() {
+            return it.getKey().key;
+        }
+
+        TID getTID() {
+            return it.getKey().tid;
+        }
+
+      private:
+        Iterator(typename Tree::RangeIterator it) : it(it) {}
+
+        typename Tree::RangeIterator it;
+
+      friend class MultiBTree;
+    };
+
+    // Creates an empty index on the segment or opens the index stored on it,
+    // see BTree
+    MultiBTree(BufferManager& bm, uint64_t id, TreeMode mode = TreeMode::Create) :
+        tree(bm, id, mode) {}
+
+    uint64_t getID() {
+        return tree.getID();
+    }
+
+    size_t getSize() {
+        return tree.getSize();
+    }
+
+    // Adds an entry, other entries with the same key are kept. Adding an
+    // existing entry again has no effect. The TID is only stored in the key
+    void insert(K key, TID tid) {
+        tree.insert(Entry{key, tid}, tid);
+    }
+
+    // Builds the index from the entries of [begin, end), which must be sorted
+    // by key and TID without duplicate entries. Iterators must yield
+    // std::pair<K, TID>, see BTree::bulkLoad
+    template <class EntryIterator>
+    void bulkLoad(EntryIterator begin, EntryIterator end, double fillFactor = 1.0) {
+        std::vector<std::pair<Entry, TID>> entries;
+        for (EntryIterator it = begin; it != end; ++it) {
+            entries.push_back(std::make_pair(Entry{it->first, it->second}, it->second));
+        }
+        tree.bulkLoad(entries.begin(), entries.end(), fillFactor);
+    }
+
+    // Returns all entries with the given key
+    Iterator lookup(K key, bool reverse = false) {
+        return lookupRange(key, key, reverse);
+    }
+
+    // Returns all entries with keys within [lo, hi]
+    Iterator lookupRange(K lo, K hi, bool reverse = false) {
+        TID first = {0, 0};
+        TID last  = {UINT32_MAX, UINT32_MAX};
+        return Iterator(tree.lookupRange(Entry{lo, first}, Entry{hi, last}, reverse));
+    }
+
+    // Removes the entry, returns false if it does not exist
+    bool erase(K key, TID tid) {
+        return tree.erase(Entry{key, tid});
+    }
+};
+
+#endif  // MULTIBTREE_H_
@@ -0,0 +1,99 @@
+#ifndef NODESEARCH_H_
+#define NODESEARCH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Searches the sorted keys of a B-tree node. lowerBound returns the index of
+// the first key which is not less than the search key, like std::lower_bound.
+// Keys with a custom compare function use std::lower_bound
+template <class K, class LESS, class Enable = void>
+struct NodeSearch {
+    static unsigned lowerBound(const K* keys, unsigned n, const K& key) {
+        LESS less;
+        return std::lower_bound(keys, keys+n, key, less) - keys;
+    }
+};
+
+// Integer keys compared with std::less are searched without branches: a
+// binary search with conditional moves narrows the keys down to a window of
+// two cache lines, which is then scanned by counting the keys less than the
+// search key, with AVX2 compares if available. Both possible next probes of
+// the binary search are prefetched, the CPU cannot speculate on them
+template <class K>
+struct NodeSearch<K, std::less<K>, typename std::enable_if<std::is_integral<K>::value>::type> {
+    static const unsigned window = 128 / sizeof(K);
+
+    static unsigned lowerBound(const K* keys, unsigned n, const K& key) {
+        // all keys before base are less than the key and the result lies
+        // within [base, base+n]
+        const K* base = keys;
+        while (n > window) {
+            unsigned half = n / 2;
+            // both possible next probes are loaded while this one is compared
+            __builtin_prefetch(base + half/2);
+            __builtin_prefetch(base + half + half/2);
+            base = (base[half] < key) ? base+half : base;
+            n   -= half;
+        }
+
+        return (base - keys) + countLess(base, n, key);
+    }
+
+  private:
+    // the compiler turns the loop into SIMD code if possible
+    static unsigned countScalar(const K* keys, unsigned n, K key) {
+        unsigned count = 0;
+        for (unsigned i = 0; i < n; i++) {
+            count += keys[i] < key;
+        }
+        return count;
+    }
+
+#ifdef __AVX2__
+    // AVX2 only compares signed integers, unsigned ones are compared with
+    // their sign bits flipped
+    static unsigned countLess(const K* keys, unsigned n, K key) {
+        if (sizeof(K) == 8) {
+            const __m256i flip   = _mm256_set1_epi64x(std::is_signed<K>::value ? 0 : INT64_MIN);
+            const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(key), flip);
+
+            unsigned count = 0;
+            unsigned i     = 0;
+            for (; i+4 <= n; i += 4) {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys+i));
+                __m256i less  = _mm256_cmpgt_epi64(needle, _mm256_xor_si256(block, flip));
+                count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+            }
+            return count + countScalar(keys+i, n-i, key);
+
+        } else if (sizeof(K) == 4) {
+            const __m256i flip   = _mm256_set1_epi32(std::is_signed<K>::value ? 0 : INT32_MIN);
+            const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(key), flip);
+
+            unsigned count = 0;
+            unsigned i     = 0;
+            for (; i+8 <= n; i += 8) {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys+i));
+                __m256i less  = _mm256_cmpgt_epi32(needle, _mm256_xor_si256(block, flip));
+                count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+            }
+            return count + countScalar(keys+i, n-i, key);
+        }
+
+        return countScalar(keys, n, key);
+    }
+#else
+    static unsigned countLess(const K* keys, unsigned n, K key) {
+        return countScalar(keys, n, key);
+    }
+#endif
+};
+
+#endif  // NODESEARCH_H_
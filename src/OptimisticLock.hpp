@@ -0,0 +1,78 @@
+#ifndef OPTIMISTICLOCK_H_
+#define OPTIMISTICLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Optimistic latch of a tree node, see BTree and ART. Readers remember the
+// version before reading a node and validate it afterwards, everything read
+// in between must be discarded if the validation fails. Writers lock the
+// node, which increases the version when it is unlocked again
+class OptimisticLock {
+  protected:
+    // bit 0 is set once the node was removed from the tree, bit 1 while the
+    // node is locked, the bits above count the modifications of the node
+    std::atomic<uint64_t> version;
+
+    static const uint64_t obsoleteBit = 1;
+    static const uint64_t lockedBit   = 2;
+
+    // the version is left untouched, see setVersion
+    OptimisticLock() {}
+
+  public:
+    // Returns false if the node is currently locked or obsolete
+    inline bool readLock(uint64_t& v) {
+        v = version.load(std::memory_order_acquire);
+        return (v & (lockedBit | obsoleteBit)) == 0;
+    }
+
+    inline static bool isObsolete(uint64_t v) {
+        return (v & obsoleteBit) != 0;
+    }
+
+    // Returns false if the node was modified since the version was read
+    inline bool validate(uint64_t v) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_relaxed) == v;
+    }
+
+    // Locks the node unless it was modified since the version was read
+    inline bool upgrade(uint64_t v) {
+        return version.compare_exchange_strong(v, v + lockedBit);
+    }
+
+    // Waits until the node can be locked
+    inline void writeLock() {
+        uint64_t v;
+        while (!readLock(v) || !upgrade(v)) {}
+    }
+
+    inline void writeUnlock() {
+        version.fetch_add(lockedBit, std::memory_order_release);
+    }
+
+    // Unlocks a node which was removed from the tree
+    inline void writeUnlockObsolete() {
+        version.fetch_add(lockedBit | obsoleteBit, std::memory_order_release);
+    }
+
+    inline uint64_t getVersion() {
+        return version.load();
+    }
+
+    // The constructors do not initialize the version: a node constructed in
+    // place of a locked node keeps being locked, a node constructed in the
+    // memory of a removed node must continue with a greater version, so that
+    // optimistic readers of the removed node fail to validate
+    inline void setVersion(uint64_t v) {
+        version.store(v);
+    }
+
+    // returns the first unlocked version greater than v
+    inline static uint64_t nextVersion(uint64_t v) {
+        return ((v >> 2) + 1) << 2;
+    }
+};
+
+#endif  // OPTIMISTICLOCK_H_
@@ -0,0 +1,106 @@
+#include <new>
+#include <stdexcept>
+
+#include "PAXSegment.hpp"
+
+PAXSegment::PAXSegment(BufferManager& bm, uint64_t id, const Schema::Relation& rel) :
+    Segment(bm, id), rowLen(0) {
+    for (auto& attr : rel.attributes) {
+        lens.push_back(attr.len);
+        rowLen += attr.len;
+    }
+    if (rowLen == 0)
+        throw std::invalid_argument("relation without attributes");
+
+    // every minipage starts 8 byte aligned, which wastes up to 7 bytes each.
+    // Each tuple needs its values plus one bit in the bitmap
+    size_t available = blocksize - sizeof(Header) - 8*(lens.size()+1);
+    capacity = (available * 8) / (rowLen * 8 + 1);
+    if (capacity == 0)
+        throw std::invalid_argument("tuple exceeds page size");
+
+    // minipages follow the bitmap in attribute order
+    size_t offset = sizeof(Header) + (capacity+7) / 8;
+    for (size_t len : lens) {
+        offset = (offset + 7) & ~(size_t) 7;
+        offsets.push_back(offset);
+        offset += capacity * len;
+    }
+}
+
+// Appends r to the last page of the segment or to a new page
+TID PAXSegment::insert(const Record& r) {
+    if (r.getLen() != rowLen)
+        throw std::invalid_argument("record does not match the relation");
+
+    // try the last page first
+    uint32_t pageID = size;
+    BufferFrame* bf = NULL;
+    Header*  header;
+    char*    data;
+    if (pageID > 0) {
+        bf     = &bm.fixPage((id << 48) | (pageID-1), true);
+        data   = static_cast<char*>(bf->getData());
+        header = reinterpret_cast<Header*>(data);
+
+        if (header->count < capacity) {
+            pageID--;
+        } else {
+            bm.unfixPage(*bf, false);
+            bf = NULL;
+        }
+    }
+
+    // the last page is full, start a new one
+    if (bf == NULL) {
+        size++;
+        bf     = &bm.fixPage((id << 48) | pageID, true);
+        data   = static_cast<char*>(bf->getData());
+        header = new (data) Header();
+        memset(data+sizeof(Header), 0, (capacity+7) / 8);
+    }
+
+    // scatter the values into the minipages
+    unsigned    slot = header->count++;
+    const char* src  = r.getData();
+    for (size_t attr = 0; attr < lens.size(); attr++) {
+        memcpy(data + offsets[attr] + slot*lens[attr], src, lens[attr]);
+        src += lens[attr];
+    }
+    setValid(data, slot, true);
+
+    bm.unfixPage(*bf, true);
+    return TID{pageID, slot};
+}
+
+// Deletes the tuple pointed to by tid by marking its slot as invalid
+bool PAXSegment::remove(TID tid) {
+    BufferFrame& bf     = bm.fixPage((id << 48) | tid.pageID, true);
+    char*        data   = static_cast<char*>(bf.getData());
+    Header*      header = reinterpret_cast<Header*>(data);
+
+    if (tid.slotID >= header->count || !isValid(data, tid.slotID)) {
+        bm.unfixPage(bf, false);
+        return false;
+    }
+
+    setValid(data, tid.slotID, false);
+    bm.unfixPage(bf, true);
+    return true;
+}
+
+// Returns the tuple associated with TID tid, gathered from the minipages
+Record PAXSegment::lookup(TID tid) {
+    BufferFrame& bf   = bm.fixPage((id << 48) | tid.pageID, false);
+    char*        data = static_cast<char*>(bf.getData());
+
+    std::vector<char> row(rowLen);
+    char* dst = row.data();
+    for (size_t attr = 0; attr < lens.size(); attr++) {
+        memcpy(dst, data + offsets[attr] + tid.slotID*lens[attr], lens[attr]);
+        dst += lens[attr];
+    }
+
+    bm.unfixPage(bf, false);
+    return Record(rowLen, row.data());
+}
@@ -0,0 +1,76 @@
+#ifndef PAXSEGMENT_H_
+#define PAXSEGMENT_H_
+
+#include <vector>
+
+#include "Record.hpp"
+#include "Schema.hpp"
+#include "Segment.hpp"
+#include "TID.hpp"
+
+// A PAX (partition attributes across) page holds whole tuples like a slotted
+// page, but groups their values by attribute: every attribute has its own
+// minipage containing the values of all tuples on the page. Scans only touch
+// the minipages of the attributes they actually need.
+// All attributes must have a fixed length. A bitmap right after the header
+// marks the slots holding a valid tuple. Records are passed in row format,
+// i.e. the values of all attributes concatenated
+class PAXSegment : public Segment {
+  public:
+    struct Header {
+        // LSN for recovery
+        uint16_t count; // number of used slots (valid or removed)
+        Header() : count(0) {}
+    };
+
+    PAXSegment(BufferManager& bm, uint64_t id, const Schema::Relation& rel);
+
+    // Appends r to the last page of the segment or to a new page, if the last
+    // page is full. Returns the TID identifying the location where r was stored
+    TID insert(const Record& r);
+
+    // Deletes the tuple pointed to by tid by marking its slot as invalid
+    bool remove(TID tid);
+
+    // Returns the tuple associated with TID tid in row format
+    Record lookup(TID tid);
+
+    // Returns the number of tuples a page can hold
+    unsigned getCapacity() {
+        return capacity;
+    }
+
+    // Returns the length of the given attribute
+    size_t getAttributeLength(unsigned attr) {
+        return lens[attr];
+    }
+
+    // Checks whether the given slot of the page holds a valid tuple
+    inline bool isValid(const char* page, unsigned slot) {
+        const uint8_t* bitmap = reinterpret_cast<const uint8_t*>(page+sizeof(Header));
+        return bitmap[slot / 8] & (1 << (slot % 8));
+    }
+
+    // Returns the start of the minipage of the given attribute
+    inline const char* getMinipage(const char* page, unsigned attr) {
+        return page+offsets[attr];
+    }
+
+  private:
+    std::vector<size_t> lens;     // length of each attribute
+    std::vector<size_t> offsets;  // start of each minipage within a page
+    size_t              rowLen;   // length of a tuple in row format
+    unsigned            capacity; // number of tuples per page
+
+    inline void setValid(char* page, unsigned slot, bool valid) {
+        uint8_t* bitmap = reinterpret_cast<uint8_t*>(page+sizeof(Header));
+        if (valid)
+            bitmap[slot / 8] |= (1 << (slot % 8));
+        else
+            bitmap[slot / 8] &= ~(1 << (slot % 8));
+    }
+
+  friend class PAXScan;
+};
+
+#endif  // PAXSEGMENT_H_
@@ -0,0 +1,87 @@
+#ifndef RECORDVIEW_H_
+#define RECORDVIEW_H_
+
+#include <cstdint>
+#include <stdlib.h>
+
+#include "BufferManager.hpp"
+
+// A read-only view on a record stored on a page. Unlike Record, the data is
+// not copied: the view points directly into the page and keeps the page fixed
+// until it is released or destroyed.
+// Records which span several pages are assembled in a buffer owned by the view
+class RecordView {
+    BufferManager* bm;
+    BufferFrame*   bf;
+    char*          buffer;
+    const char*    data;
+    uint64_t       len;
+
+  public:
+    // Assignment Operator: deleted
+    RecordView& operator=(RecordView& rhs) = delete;
+
+    // Copy Constructor: deleted
+    RecordView(RecordView& t) = delete;
+
+    // Move Constructor
+    RecordView(RecordView&& t) : bm(t.bm), bf(t.bf), buffer(t.buffer), data(t.data), len(t.len) {
+        t.bf     = nullptr;
+        t.buffer = nullptr;
+        t.data   = nullptr;
+        t.len    = 0;
+    }
+
+    // Move Assignment, releases the data viewed so far
+    RecordView& operator=(RecordView&& t) {
+        if (this != &t) {
+            release();
+            bm       = t.bm;
+            bf       = t.bf;
+            buffer   = t.buffer;
+            data     = t.data;
+            len      = t.len;
+            t.bf     = nullptr;
+            t.buffer = nullptr;
+            t.data   = nullptr;
+            t.len    = 0;
+        }
+        return *this;
+    }
+
+    // Constructor, takes over the fix of the given frame
+    RecordView(BufferManager& bm, BufferFrame& bf, const char* ptr, uint64_t len) :
+        bm(&bm), bf(&bf), buffer(nullptr), data(ptr), len(len) {}
+
+    // Constructor, takes over the given malloc'ed buffer
+    RecordView(char* buffer, uint64_t len) :
+        bm(nullptr), bf(nullptr), buffer(buffer), data(buffer), len(len) {}
+
+    // Destructor
+    ~RecordView() {
+        release();
+    }
+
+    // Unfixes the page. The data must not be accessed afterwards
+    void release() {
+        if (bf != nullptr) {
+            bm->unfixPage(*bf, false);
+            bf = nullptr;
+        }
+        free(buffer);
+        buffer = nullptr;
+        data   = nullptr;
+    }
+
+    // Get pointer to data
+    const char* getData() const {
+        return data;
+    }
+
+    // Get data size in bytes
+    uint64_t getLen() const {
+        return len;
+    }
+};
+
+#endif // RECORDVIEW_H_
@@ -1,144 +1,314 @@
+#include <algorithm>
+#include <limits>
 #include <new>
-#include <queue>
+#include <stdexcept>
 #include <vector>
 
 #include "SPSegment.hpp"
 
-// Searches through the segment's pages looking for a page with enough space to
-// store r. Returns the TID identifying the location where r was stored
+// Creates a new, empty segment
+SPSegment::SPSegment(BufferManager& bm, uint64_t id) : Segment(bm, id), maintenanceStop(false) {
+    pthread_rwlock_init(&latch, NULL);
+}
+
+// Opens an existing segment consisting of the given number of pages
+SPSegment::SPSegment(BufferManager& bm, uint64_t id, size_t pages, std::vector<unsigned> summarized)
+        : Segment(bm, id), zones(summarized), maintenanceStop(false) {
+    pthread_rwlock_init(&latch, NULL);
+    size = pages;
+
+    // rebuild the free space inventory and the zone map, legacy pages are
+    // converted on the way
+    for (uint32_t pageID = 0; pageID < pages; pageID++) {
+        BufferFrame& bf     = fixPage(pageID, false);
+        char*        data   = static_cast<char*>(bf.getData());
+        Header*      header = reinterpret_cast<Header*>(data);
+        Slot*        slots  = reinterpret_cast<Slot*>(data+sizeof(Header));
+        fsi.update(pageID, getContiguousSpace(*header));
+        if (!summarized.empty())
+            summarizePage(pageID, data);
+
+        // leave fragmented pages and indirections to the next vacuum run
+        bool dirty = header->slotCount > 0
+            && header->dataStart-sizeof(Header)-header->slotCount*sizeof(Slot) != header->freeSpace;
+        for (uint32_t slotID = 0; !dirty && slotID < header->slotCount; slotID++)
+            dirty = slots[slotID].isIndirection();
+        if (dirty)
+            markForMaintenance(pageID);
+
+        bm.unfixPage(bf, false);
+    }
+}
+
+SPSegment::~SPSegment() {
+    stopMaintenance();
+    pthread_rwlock_destroy(&latch);
+}
+
+// Asks the free space inventory for a page with enough space to store r or
+// appends a new page. Returns the TID identifying the location where r was
+// stored
 TID SPSegment::insert(const Record& r) {
-    char*    data;
-    Header*  header;
-    Slot*    slot;
+    pthread_rwlock_rdlock(&latch);
+
+    TID tid;
+    if (fitsOnPage(r.getLen())) {
+        tid = insertInline(r.getData(), r.getLen(), false, r.getData(), r.getLen());
+    } else {
+        // large records are stored out of line, only the reference is inserted
+        OverflowRef ref = writeOverflow(r.getData(), r.getLen());
+        tid = insertInline(reinterpret_cast<const char*>(&ref), sizeof(ref), true, r.getData(), r.getLen());
+    }
+
+    pthread_rwlock_unlock(&latch);
+    return tid;
+}
+
+// Stores len bytes of data in a new slot
+TID SPSegment::insertInline(const char* recData, uint64_t recLen, bool overflow, const char* record, uint64_t recordLen) {
+    size_t   space = std::max<uint64_t>(recLen, sizeof(TID));
     uint32_t pageID;
     uint32_t slotID;
-    size_t   recLen = r.getLen();
-
-    // segmentID prefix for the pageID
-    uint64_t segPfx = (id << 48);
-
-    // try all existing pages
-    for (pageID=0; pageID < size; pageID++) {
-        // open page for read only and read the header
-        BufferFrame& rbf = bm.fixPage(segPfx | pageID, false);
-        data   = static_cast<char*>(rbf.getData());
-        header = reinterpret_cast<Header*>(data);
-        size_t freeSpace = header->freeSpace;
-
-        // enough free space in the current page?
-        if(recLen+sizeof(Slot) <= freeSpace) {
-            off_t headEnd   = sizeof(Header) + (header->slotCount+1)*sizeof(Slot);
-            off_t dataStart = header->dataStart;
-            bm.unfixPage(rbf, false);
-
-            if (dataStart <= headEnd || recLen > (dataStart - headEnd)) {
-                //must compact the page
-                compactPage(pageID);
-            }
-            break; // found a page with enough space
-        }
-        bm.unfixPage(rbf, false);
+
+    while (true) {
+        // find a page with enough space, otherwise use a new page
+        BufferFrame* bf;
+        if (fsi.find(space+sizeof(Slot), pageID))
+            bf = &fixPage(pageID, true);
+        else
+            bf = &allocatePage(pageID);
+
+        char*   data   = static_cast<char*>(bf->getData());
+        Header* header = reinterpret_cast<Header*>(data);
+
+        // a concurrent insert might have used up the space meanwhile
+        bool inserted = insertIntoPage(data, recData, recLen, overflow, slotID);
+        if (inserted)
+            zones.add(pageID, record, recordLen);
+        fsi.update(pageID, getContiguousSpace(*header));
+        bm.unfixPage(*bf, inserted);
+
+        if (inserted)
+            return TID{pageID, slotID};
     }
+}
 
-    // open page for writing
-    BufferFrame& bf = bm.fixPage(segPfx | pageID, true);
-    data = static_cast<char*>(bf.getData());
+// Stores the data item in a new slot of the page if it has enough space
+bool SPSegment::insertIntoPage(char* data, const char* recData, uint64_t recLen, bool overflow, uint32_t& slotID) {
+    Header*  header    = reinterpret_cast<Header*>(data);
+    uint32_t slotCount = header->slotCount;
+    size_t   space     = std::max<uint64_t>(recLen, sizeof(TID));
+
+    // reuse an existing free slot or append a new one
+    bool   reuse = header->firstFreeSlot < slotCount;
+    size_t need  = space + (reuse ? 0 : sizeof(Slot));
+    if (header->freeSpace < need)
+        return false;
+
+    // fragmented pages are not compacted here but left to vacuum
+    off_t headEnd   = sizeof(Header) + (slotCount + (reuse ? 0 : 1))*sizeof(Slot);
+    off_t dataStart = header->dataStart;
+    if (dataStart < headEnd || space > (size_t) (dataStart - headEnd))
+        return false;
+
+    if (reuse) {
+        slotID = header->firstFreeSlot;
+
+        // search for the next free slot
+        uint32_t i = slotID+1;
+        for(; i < slotCount; i++) {
+            Slot& otherSlot = reinterpret_cast<Slot*>(data+sizeof(Header))[i];
+            if (otherSlot.isFree())
+                break;
+        }
+        header->firstFreeSlot = i;
 
-    if (pageID == size) { // new page
-        size++;
+    // insert new Slot
+    } else {
+        slotID = slotCount;
 
-        // insert new Header
-        header = new (data) Header();
+        header->slotCount++;
+        header->firstFreeSlot = header->slotCount;
+    }
 
-        // insert new Slot
-        slotID = 0;
-        slot   = new (data+sizeof(Header)) Slot();
-        header->slotCount     = 1;
-        header->firstFreeSlot = 1;
+    // update free space
+    header->freeSpace -= need;
 
-        // update free space
-        header->freeSpace -= sizeof(Slot) + recLen;
+    // Insert Record Data
+    Slot* slot = new (data + sizeof(Header) + slotID*sizeof(Slot)) Slot();
+    header->dataStart -= space;
+    slot->offset = header->dataStart;
+    slot->length = recLen | (overflow ? Slot::overflowFlag : 0);
+    memcpy(data+slot->offset, recData, recLen);
+    return true;
+}
 
-    } else { // existing page
-        uint32_t slotCount = header->slotCount;
+// Inserts a record into the append page of this inserter
+TID SPSegment::Inserter::insert(const Record& r) {
+    // large records are stored out of line
+    if (!fitsOnPage(r.getLen()))
+        return seg.insert(r);
 
-        // look for a existing free slot
-        if (header->firstFreeSlot < slotCount) {
-            slotID = header->firstFreeSlot;
+    pthread_rwlock_rdlock(&seg.latch);
 
-            // search for the next free slot
-            uint32_t i = slotID+1;
-            for(; i < slotCount; i++) {
-                Slot& otherSlot = reinterpret_cast<Slot*>(data+sizeof(Header))[i];
-                if (otherSlot.isFree())
-                    break;
-            }
-            header->firstFreeSlot = i;
+    TID tid;
+    while (true) {
+        // the append page might have been cut off by vacuum
+        BufferFrame* bf;
+        if (owning && pageID < seg.size) {
+            bf = &seg.fixPage(pageID, true);
+        } else {
+            bf     = &seg.allocatePage(pageID);
+            owning = true;
+        }
 
-            // update free space
-            header->freeSpace -= recLen;
+        char*   data   = static_cast<char*>(bf->getData());
+        Header* header = reinterpret_cast<Header*>(data);
 
-        // insert new Slot
+        bool inserted = seg.insertIntoPage(data, r.getData(), r.getLen(), false, tid.slotID);
+        if (inserted) {
+            seg.zones.add(pageID, r.getData(), r.getLen());
         } else {
-            slotID = slotCount;
-
-            header->slotCount++;
-            header->firstFreeSlot = header->slotCount;
+            // the page is full, hand it over to the free space inventory
+            seg.fsi.update(pageID, getContiguousSpace(*header));
+            owning = false;
+        }
+        seg.bm.unfixPage(*bf, inserted);
 
-            // update free space
-            header->freeSpace -= sizeof(Slot) + recLen;
+        if (inserted) {
+            tid.pageID = pageID;
+            break;
         }
+    }
+
+    pthread_rwlock_unlock(&seg.latch);
+    return tid;
+}
 
-        slot = new (data + sizeof(Header) + slotID*sizeof(Slot)) Slot();
+// Hands the append page over to the free space inventory
+void SPSegment::Inserter::release() {
+    if (!owning)
+        return;
+
+    pthread_rwlock_rdlock(&seg.latch);
+    if (pageID < seg.size) {
+        BufferFrame& bf     = seg.fixPage(pageID, false);
+        Header*      header = static_cast<Header*>(bf.getData());
+        seg.fsi.update(pageID, getContiguousSpace(*header));
+        seg.bm.unfixPage(bf, false);
     }
+    pthread_rwlock_unlock(&seg.latch);
 
-    // Insert Record Data
-    header->dataStart -= recLen;
-    slot->offset = header->dataStart;
-    slot->length = recLen;
-    char* recPtr = data + slot->offset;
-    memcpy(recPtr, r.getData(), recLen);
+    owning = false;
+}
+
+// Appends count records stored back to back in data to fresh pages at the end
+// of the segment. Returns the TIDs of the records in input order
+std::vector<TID> SPSegment::insertBatch(const char* data, const unsigned* lens, size_t count) {
+    std::vector<TID> tids;
+    tids.reserve(count);
+
+    pthread_rwlock_rdlock(&latch);
+
+    size_t i = 0;
+    while (i < count) {
+        // large records are stored out of line one by one
+        if (!fitsOnPage(lens[i])) {
+            OverflowRef ref = writeOverflow(data, lens[i]);
+            TID tid = insertInline(reinterpret_cast<const char*>(&ref), sizeof(ref), true, data, lens[i]);
+            tids.push_back(tid);
+            data += lens[i];
+            i++;
+            continue;
+        }
+
+        // determine how many of the remaining records fit on a fresh page
+        size_t first    = i;
+        size_t freeLeft = blocksize - sizeof(Header);
+        while (i < count) {
+            size_t need = std::max<size_t>(lens[i], sizeof(TID)) + sizeof(Slot);
+            if (need > freeLeft)
+                break;
+            freeLeft -= need;
+            i++;
+        }
 
-    bm.unfixPage(bf, true);
-    return TID{pageID, slotID};
+        uint32_t slotCount = i - first;
+        uint32_t pageID;
+
+        // open new page for writing
+        BufferFrame& bf   = allocatePage(pageID);
+        char*        page = static_cast<char*>(bf.getData());
+
+        // write the header once
+        Header* header = reinterpret_cast<Header*>(page);
+        header->slotCount     = slotCount;
+        header->firstFreeSlot = slotCount;
+        header->dataStart     = sizeof(Header) + slotCount*sizeof(Slot) + freeLeft;
+        header->freeSpace     = freeLeft;
+
+        // the records are copied in input order, thus the offsets of the
+        // slots are ascending
+        Slot*    slots  = reinterpret_cast<Slot*>(page+sizeof(Header));
+        uint16_t offset = header->dataStart;
+        for (uint32_t slotID = 0; slotID < slotCount; slotID++) {
+            Slot& slot = slots[slotID];
+            slot.offset = offset;
+            slot.length = lens[first+slotID];
+            memcpy(page+offset, data, slot.length);
+            zones.add(pageID, data, slot.length);
+            offset += slot.getSpace();
+            data   += slot.length;
+
+            tids.push_back(TID{pageID, slotID});
+        }
+
+        fsi.update(pageID, getContiguousSpace(*header));
+        bm.unfixPage(bf, true);
+    }
+
+    pthread_rwlock_unlock(&latch);
+    return tids;
 }
 
 // Deletes the record pointed to by tid and updates the page header accordingly
 bool SPSegment::remove(TID tid) {
+    pthread_rwlock_rdlock(&latch);
+    bool removed = removeRecord(tid);
+    pthread_rwlock_unlock(&latch);
+    return removed;
+}
+
+bool SPSegment::removeRecord(TID tid) {
     // open page for writing
-    BufferFrame& bf = bm.fixPage((id << 48) | tid.pageID, true);
+    BufferFrame& bf = fixPage(tid.pageID, true);
     char* data = static_cast<char*>(bf.getData());
 
     // read page
     Header& header = reinterpret_cast<Header*>(data)[0];
     Slot&   slot   = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
 
-    // update the first free slot cache
-    if (tid.slotID < header.firstFreeSlot)
-        header.firstFreeSlot = tid.slotID;
-
     if(slot.isIndirection()) {
-        TID itid = slot.getIndirectionTID();
+        TID itid = slot.getIndirectionTID(data);
 
         // mark this slot as empty
-        slot.length = 0;
-        slot.offset = 0;
+        freeSlot(data, tid.slotID);
+        fsi.update(tid.pageID, getContiguousSpace(header));
+        markForMaintenance(tid.pageID);
 
         // close page and recursively remove the indirected TID
         bm.unfixPage(bf, true);
-        return remove(itid);
+        return removeRecord(itid);
 
     } else {
-        // if this slots contains the last data block, adjust header->dataStart
-        if (slot.offset == header.dataStart)
-            header.dataStart += slot.length;
-
-        // update free space
-        header.freeSpace += slot.length;
+        // release the overflow pages of large records
+        if (slot.isOverflow())
+            freeOverflow(getOverflowRef(data, slot));
 
-        // mark this slot as empty
-        slot.length = 0;
-        slot.offset = 0;
+        // mark this slot as empty and update free space
+        freeSlot(data, tid.slotID);
+        fsi.update(tid.pageID, getContiguousSpace(header));
+        markForMaintenance(tid.pageID);
 
         // close page and return
         bm.unfixPage(bf, true);
@@ -148,45 +318,136 @@ bool SPSegment::remove(TID tid) {
 
 // Returns the read-only record associated with TID tid
 Record SPSegment::lookup(TID tid) {
-    // open page for reading
-    BufferFrame& bf = bm.fixPage((id << 48) | tid.pageID, false);
-    char* data = static_cast<char*>(bf.getData());
+    RecordView view = lookupView(tid);
+    if (view.getLen() > std::numeric_limits<unsigned>::max())
+        throw std::length_error("Record exceeds the size of a Record");
+    return Record(view.getLen(), view.getData());
+}
 
-    // read page
-    Slot& slot = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
+// Returns a view on the record associated with TID tid, which keeps the page
+// fixed
+RecordView SPSegment::lookupView(TID tid) {
+    bool latched = false;
+    while (true) {
+        // open page for reading
+        BufferFrame& bf = fixPage(tid.pageID, false);
+        char* data = static_cast<char*>(bf.getData());
+
+        // read page
+        Slot& slot = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
+
+        if (slot.isOverflow()) {
+            // large records are assembled from their overflow pages
+            OverflowRef ref = getOverflowRef(data, slot);
+            bm.unfixPage(bf, false);
+            RecordView view = readOverflow(ref);
+            if (latched)
+                pthread_rwlock_unlock(&latch);
+            return view;
+        }
 
-    if(slot.isIndirection()) {
-        // recursively lookup
-        TID itid = slot.getIndirectionTID();
+        if (!slot.isIndirection()) {
+            if (latched)
+                pthread_rwlock_unlock(&latch);
+            return RecordView(bm, bf, data+slot.offset, slot.getLength());
+        }
+
+        // vacuum must not move the record while the indirection is followed,
+        // thus start over holding the latch
+        if (!latched) {
+            bm.unfixPage(bf, false);
+            pthread_rwlock_rdlock(&latch);
+            latched = true;
+            continue;
+        }
+
+        // follow the indirection
+        tid = slot.getIndirectionTID(data);
         bm.unfixPage(bf, false);
-        return lookup(itid);
+    }
+}
 
-    } else {
-        Record r(slot.length, data+slot.offset);
+// Looks up the records of n TIDs, fixing every page only once
+void SPSegment::lookupBatch(const TID* tids, size_t n, const LookupCallback& callback) {
+    std::vector<std::pair<TID, size_t>> batch;
+    batch.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        batch.push_back(std::make_pair(tids[i], i));
+
+    std::sort(batch.begin(), batch.end());
+    batch = lookupSorted(batch, callback);
+    if (batch.empty())
+        return;
+
+    // vacuum must not move records while indirections are followed, thus
+    // the remaining TIDs are resolved from scratch holding the latch
+    for (auto& entry : batch)
+        entry.first = tids[entry.second];
+
+    pthread_rwlock_rdlock(&latch);
+    while (!batch.empty()) {
+        std::sort(batch.begin(), batch.end());
+        batch = lookupSorted(batch, callback);
+    }
+    pthread_rwlock_unlock(&latch);
+}
+
+std::vector<std::pair<TID, size_t>> SPSegment::lookupSorted(
+        const std::vector<std::pair<TID, size_t>>& batch, const LookupCallback& callback) {
+    std::vector<std::pair<TID, size_t>> indirections;
+
+    size_t i = 0;
+    while (i < batch.size()) {
+        uint32_t pageID = batch[i].first.pageID;
+
+        // open page for reading
+        BufferFrame& bf    = fixPage(pageID, false);
+        char*        data  = static_cast<char*>(bf.getData());
+        Slot*        slots = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+        // handle all TIDs on this page
+        for (; i < batch.size() && batch[i].first.pageID == pageID; i++) {
+            Slot& slot = slots[batch[i].first.slotID];
+            if (slot.isIndirection()) {
+                indirections.push_back(std::make_pair(slot.getIndirectionTID(data), batch[i].second));
+            } else if (slot.isOverflow()) {
+                RecordView large = readOverflow(getOverflowRef(data, slot));
+                callback(batch[i].second, large.getData(), large.getLen());
+            } else {
+                callback(batch[i].second, data+slot.offset, slot.getLength());
+            }
+        }
 
-        // close page and return
         bm.unfixPage(bf, false);
-        return std::move(r);
     }
+
+    return indirections;
 }
 
 // Updates the record pointed to by tid with the content of record r
 bool SPSegment::update(TID tid, const Record& r) {
+    pthread_rwlock_rdlock(&latch);
+    bool updated = updateRecord(tid, r);
+    pthread_rwlock_unlock(&latch);
+    return updated;
+}
+
+bool SPSegment::updateRecord(TID tid, const Record& r) {
     // open page for writing
-    BufferFrame& bf = bm.fixPage((id << 48) | tid.pageID, true);
+    BufferFrame& bf = fixPage(tid.pageID, true);
     char* data = static_cast<char*>(bf.getData());
     Slot& slot = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
 
     if (slot.isIndirection()) {
-        TID itid = slot.getIndirectionTID();
+        TID itid = slot.getIndirectionTID(data);
         bm.unfixPage(bf, false);
 
         // update recursively
-        if(!update(itid, r))
+        if(!updateRecord(itid, r))
             return false;
 
         // handle double indirections
-        BufferFrame& ibf = bm.fixPage((id << 48) | itid.pageID, true);
+        BufferFrame& ibf = fixPage(itid.pageID, true);
         char* idata = static_cast<char*>(ibf.getData());
         Slot& islot = reinterpret_cast<Slot*>(idata+sizeof(Header))[itid.slotID];
 
@@ -195,77 +456,100 @@ bool SPSegment::update(TID tid, const Record& r) {
             return true;
 
         } else { // double indirected
-            // skip first indirection
-            BufferFrame& bf = bm.fixPage((id << 48) | tid.pageID, true);
-            data = static_cast<char*>(bf.getData());
-            Slot& slot = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
-            slot.setIndirection(islot.getIndirectionTID());
-            bm.unfixPage(bf, true);
+            TID target = islot.getIndirectionTID(idata);
 
             // mark first indirection slot as free
-            islot.offset = 0;
-            islot.length = 0;
-
-            // update first free slot cache
             Header& iheader = reinterpret_cast<Header*>(idata)[0];
-            if (itid.slotID < iheader.firstFreeSlot)
-                iheader.firstFreeSlot = itid.slotID;
-
+            freeSlot(idata, itid.slotID);
+            fsi.update(itid.pageID, getContiguousSpace(iheader));
+            markForMaintenance(itid.pageID);
+
+            // skip first indirection. Both slots might be on the same page,
+            // which must not be fixed twice
+            if (itid.pageID == tid.pageID) {
+                Slot& slot = reinterpret_cast<Slot*>(idata+sizeof(Header))[tid.slotID];
+                slot.setIndirection(idata, target);
+                bm.unfixPage(ibf, true);
+                return true;
+            }
             bm.unfixPage(ibf, true);
+
+            BufferFrame& bf = fixPage(tid.pageID, true);
+            data = static_cast<char*>(bf.getData());
+            Slot& slot = reinterpret_cast<Slot*>(data+sizeof(Header))[tid.slotID];
+            slot.setIndirection(data, target);
+            bm.unfixPage(bf, true);
             return true;
         }
     } else {
         Header& header = reinterpret_cast<Header*>(data)[0];
 
-        unsigned newLen = r.getLen();
-        unsigned oldLen = slot.length;
+        // release the overflow pages of the old record
+        if (slot.isOverflow())
+            freeOverflow(getOverflowRef(data, slot));
+
+        // large records are stored out of line, only the reference is kept
+        OverflowRef ref;
+        const char* newData  = r.getData();
+        uint64_t    newLen   = r.getLen();
+        bool        overflow = !fitsOnPage(newLen);
+        if (overflow) {
+            ref     = writeOverflow(newData, newLen);
+            newData = reinterpret_cast<const char*>(&ref);
+            newLen  = sizeof(ref);
+        }
+
+        size_t oldSpace = slot.getSpace();
+        size_t newSpace = std::max<uint64_t>(newLen, sizeof(TID));
 
         // check if able to replace in-place
-        if (newLen <= oldLen) {
+        if (newSpace <= oldSpace) {
             // update length and free space
-            slot.length = newLen;
-            header.freeSpace += oldLen - newLen;
+            slot.length = newLen | (overflow ? Slot::overflowFlag : 0);
+            header.freeSpace += oldSpace - newSpace;
+            fsi.update(tid.pageID, getContiguousSpace(header));
+            if (newSpace < oldSpace)
+                markForMaintenance(tid.pageID);
 
             // copy the data
             char* recPtr = data + slot.offset;
-            memcpy(recPtr, r.getData(), newLen);
+            memcpy(recPtr, newData, newLen);
+            zones.add(tid.pageID, r.getData(), r.getLen());
 
             // close page and return
             bm.unfixPage(bf, true);
             return true;
 
         } else {
-            // remove current record
-            slot.length = 0;
-            header.freeSpace += oldLen;
+            // remove current record, but keep enough space for an indirection
+            slot.length = sizeof(TID);
+            header.freeSpace += oldSpace - sizeof(TID);
+            fsi.update(tid.pageID, getContiguousSpace(header));
+            markForMaintenance(tid.pageID);
 
             // not in the mood for deadlocks today?
             bm.unfixPage(bf, true);
 
             // insert again
-            TID newtid = insert(r);
+            TID newtid = insertInline(newData, newLen, overflow, r.getData(), r.getLen());
 
             // open same page again for writing
-            BufferFrame& bf2 = bm.fixPage((id << 48) | tid.pageID, true);
+            BufferFrame& bf2 = fixPage(tid.pageID, true);
             char* data2 = static_cast<char*>(bf2.getData());
             Slot& slot2 = reinterpret_cast<Slot*>(data2+sizeof(Header))[tid.slotID];
 
             // handle indirection to same page
             if (newtid.pageID == tid.pageID) {
+                // take over the new slot and release the space kept for the
+                // indirection
                 Slot& newslot = reinterpret_cast<Slot*>(data2+sizeof(Header))[newtid.slotID];
-                slot2.offset = newslot.offset;
-                slot2.length = newslot.length;
+                std::swap(slot2, newslot);
 
-                // mark new slot as free
-                newslot.offset = 0;
-                newslot.length = 0;
-
-                // update first free slot cache
-                Header& header = reinterpret_cast<Header*>(data2)[0];
-                if (newtid.slotID < header.firstFreeSlot)
-                    header.firstFreeSlot = newtid.slotID;
+                Header& header2 = reinterpret_cast<Header*>(data2)[0];
+                freeSlot(data2, newtid.slotID);
+                fsi.update(tid.pageID, getContiguousSpace(header2));
             } else {
-                slot2.setIndirection(newtid);
+                slot2.setIndirection(data2, newtid);
             }
 
             // close page and return
@@ -277,48 +561,623 @@ bool SPSegment::update(TID tid, const Record& r) {
     return false;
 }
 
-void SPSegment::compactPage(uint32_t pageID) {
-    // open the page for writing
-    BufferFrame& bf     = bm.fixPage((id << 48) | pageID, true);
-    char*        data   = static_cast<char*>(bf.getData());
-    Header*      header = reinterpret_cast<Header*>(data);
+// Maintains per-page summaries of the integer attributes at the given offsets
+// and summarizes the records already stored
+void SPSegment::summarize(std::vector<unsigned> offsets) {
+    zones.reset(offsets);
 
-    uint32_t slotCount = header->slotCount;
-    Slot*    slots     = reinterpret_cast<Slot*>(data+sizeof(Header));
+    uint32_t pageCount = size;
+    for (uint32_t pageID = 0; pageID < pageCount; pageID++) {
+        // open page for reading
+        BufferFrame& bf = fixPage(pageID, false);
+        summarizePage(pageID, static_cast<char*>(bf.getData()));
+        bm.unfixPage(bf, false);
+    }
+}
 
-    // put all non-free and non-indirection slots in a priority queue
-    struct SlotPtrCmpOffst {
-        bool operator() (Slot* const &a, Slot* const &b) {
-            return a->offset < b->offset;
-        }
-    };
-    std::priority_queue<Slot*, std::vector<Slot*>, SlotPtrCmpOffst> slotPtrs;
-    for(uint32_t slotID = 0; slotID < slotCount; slotID++) {
+// Widens the zones of the fixed page by all records stored on it
+void SPSegment::summarizePage(uint32_t pageID, char* data) {
+    Header* header = reinterpret_cast<Header*>(data);
+    Slot*   slots  = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+    // indirections are summarized on the page holding the record
+    for (uint32_t slotID = 0; slotID < header->slotCount; slotID++) {
         Slot& slot = slots[slotID];
+        if (slot.isOverflow()) {
+            RecordView large = readOverflow(getOverflowRef(data, slot), zones.getPrefixLen());
+            zones.add(pageID, large.getData(), large.getLen());
+        } else if (slot.isRecord()) {
+            zones.add(pageID, data+slot.offset, slot.getLength());
+        }
+    }
+}
+
+// Appends an empty page, which is initialized before the segment grows
+BufferFrame& SPSegment::allocatePage(uint32_t& pageID) {
+    std::lock_guard<std::mutex> guard(allocMutex);
 
-        if (!slot.isIndirection() && !slot.isFree())
-            slotPtrs.push(&slot);
+    // nobody else can fix the page before size is increased
+    pageID = size;
+    BufferFrame& bf = bm.fixPage((id << 48) | pageID, true);
+    new (bf.getData()) Header();
+    size = pageID+1;
+
+    return bf;
+}
+
+// Fixes a page of this segment. Legacy pages are converted to the compact
+// format. If the caller unfixes the page without changes, the conversion is
+// simply repeated the next time the page is loaded
+BufferFrame& SPSegment::fixPage(uint32_t pageID, bool exclusive) {
+    uint64_t     fullID = (id << 48) | pageID;
+    BufferFrame& bf     = bm.fixPage(fullID, exclusive);
+    Header*      header = static_cast<Header*>(bf.getData());
+
+    if (header->version == pageVersion)
+        return bf;
+
+    if (exclusive) {
+        convertPage(static_cast<char*>(bf.getData()));
+        return bf;
     }
 
-    off_t offset = blocksize;
+    // converting requires an exclusive fix
+    bm.unfixPage(bf, false);
 
-    // move records
-    while (!slotPtrs.empty()) {
-        Slot* slot = slotPtrs.top();
-        slotPtrs.pop();
+    BufferFrame& xbf = bm.fixPage(fullID, true);
+    header = static_cast<Header*>(xbf.getData());
+    if (header->version != pageVersion)
+        convertPage(static_cast<char*>(xbf.getData()));
+    bm.unfixPage(xbf, true);
 
-        // nothing to move, if the record length is 0 bytes
-        if (slot->length == 0)
+    return bm.fixPage(fullID, false);
+}
+
+// Converts a legacy page in place to the compact format. The compact page is
+// never larger: slots shrink from 16 to 4 bytes and an indirection only needs
+// additional 8 bytes in the data area
+void SPSegment::convertPage(char* data) {
+    char old[blocksize];
+    memcpy(old, data, blocksize);
+
+    LegacyHeader* oldHeader = reinterpret_cast<LegacyHeader*>(old);
+    LegacySlot*   oldSlots  = reinterpret_cast<LegacySlot*>(old+sizeof(LegacyHeader));
+    Header*       header    = new (data) Header();
+
+    // overflow pages have neither slots nor free space. Their data stays in
+    // place right after the legacy header
+    if (oldHeader->slotCount == 0 && oldHeader->freeSpace == 0) {
+        header->dataStart = sizeof(LegacyHeader);
+        header->freeSpace = 0;
+        return;
+    }
+
+    uint32_t slotCount = oldHeader->slotCount;
+    Slot*    slots     = reinterpret_cast<Slot*>(data+sizeof(Header));
+    uint16_t offset    = blocksize;
+
+    header->slotCount     = slotCount;
+    header->firstFreeSlot = std::min(oldHeader->firstFreeSlot, slotCount);
+
+    // rewrite the slots and copy the data items compactly to the page end
+    for (uint32_t slotID = 0; slotID < slotCount; slotID++) {
+        LegacySlot& oldSlot = oldSlots[slotID];
+        Slot&       slot    = slots[slotID];
+        slot = Slot();
+
+        if (oldSlot.offset == 0) { // free
             continue;
 
+        } else if (oldSlot.offset == 1) { // indirection
+            offset -= sizeof(TID);
+            slot.offset = offset;
+            slot.setIndirection(data, TID{(uint32_t) (oldSlot.length >> 32), (uint32_t) oldSlot.length});
+
+        } else { // record
+            bool     overflow = oldSlot.length & LegacySlot::overflowFlag;
+            uint64_t length   = oldSlot.length & ~LegacySlot::overflowFlag;
+
+            slot.length = length | (overflow ? Slot::overflowFlag : 0);
+            offset -= slot.getSpace();
+            slot.offset = offset;
+            memcpy(data+offset, old+oldSlot.offset, length);
+        }
+    }
+
+    header->dataStart = offset;
+    header->freeSpace = offset - (sizeof(Header) + slotCount*sizeof(Slot));
+}
+
+// Marks the slot as free and releases its data item
+void SPSegment::freeSlot(char* data, uint16_t slotID) {
+    Header* header = reinterpret_cast<Header*>(data);
+    Slot&   slot   = reinterpret_cast<Slot*>(data+sizeof(Header))[slotID];
+
+    // update the first free slot cache
+    if (slotID < header->firstFreeSlot)
+        header->firstFreeSlot = slotID;
+
+    // if this slots contains the last data block, adjust header->dataStart
+    if (slot.offset == header->dataStart)
+        header->dataStart += slot.getSpace();
+
+    // update free space
+    header->freeSpace += slot.getSpace();
+
+    slot.offset = 0;
+    slot.length = 0;
+}
+
+// compacts the given (exclusively fixed) page by moving records
+void SPSegment::compactPage(char* data) {
+    Header* header = reinterpret_cast<Header*>(data);
+
+    uint32_t slotCount = header->slotCount;
+    Slot*    slots     = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+    // order the non-free slots by descending offset, so that data items are
+    // only moved towards the end of the page
+    uint16_t order[blocksize/sizeof(Slot)];
+    uint32_t count = 0;
+    for(uint32_t slotID = 0; slotID < slotCount; slotID++) {
+        if (!slots[slotID].isFree())
+            order[count++] = slotID;
+    }
+    std::sort(order, order+count, [slots](uint16_t a, uint16_t b) {
+        return slots[a].offset > slots[b].offset;
+    });
+
+    uint16_t offset = blocksize;
+
+    // move data items
+    for (uint32_t i = 0; i < count; i++) {
+        Slot* slot = &slots[order[i]];
+
         // move the data
-        offset -= slot->length;
-        memmove(data+offset, data+slot->offset, slot->length);
+        uint16_t space = slot->getSpace();
+        offset -= space;
+        memmove(data+offset, data+slot->offset, space);
         slot->offset = offset;
     }
 
     header->dataStart = offset;
+}
+
+// Writes a large record to a run of new overflow pages
+SPSegment::OverflowRef SPSegment::writeOverflow(const char* data, uint64_t len) {
+    const size_t capacity = blocksize - sizeof(Header);
+
+    OverflowRef ref;
+    ref.length    = len;
+    ref.pageCount = (len + capacity - 1) / capacity;
+    {
+        // like allocatePage, the pages are initialized before the segment
+        // grows, so that scans and vacuum never see them uninitialized. The
+        // header has no slots and no free space, the data follows right
+        // after it
+        std::lock_guard<std::mutex> guard(allocMutex);
+        ref.firstPage = size;
+        for (uint32_t i = 0; i < ref.pageCount; i++) {
+            BufferFrame& bf     = bm.fixPage((id << 48) | (ref.firstPage+i), true);
+            Header*      header = new (bf.getData()) Header();
+            header->dataStart = sizeof(Header);
+            header->freeSpace = 0;
+            bm.unfixPage(bf, true);
+        }
+        size = ref.firstPage + ref.pageCount;
+    }
+
+    // the record is not referenced yet, thus nobody else reads the data
+    for (uint32_t i = 0; i < ref.pageCount; i++) {
+        size_t chunk = std::min<uint64_t>(len, capacity);
+
+        // open page for writing
+        BufferFrame& bf   = bm.fixPage((id << 48) | (ref.firstPage+i), true);
+        char*        page = static_cast<char*>(bf.getData());
+        memcpy(page+sizeof(Header), data, chunk);
+
+        bm.unfixPage(bf, true);
+        data += chunk;
+        len  -= chunk;
+    }
+
+    return ref;
+}
+
+// Reads the first bytes of a large record from its overflow pages into a
+// buffer owned by the returned view. The pages after the prefix are not read
+RecordView SPSegment::readOverflow(OverflowRef ref, uint64_t prefix) {
+    uint64_t length = std::min(prefix, ref.length);
+    char*    buffer = static_cast<char*>(malloc(std::max<uint64_t>(length, 1)));
+    uint64_t off    = 0;
+    for (uint32_t i = 0; i < ref.pageCount && off < length; i++) {
+        // open page for reading
+        BufferFrame& bf     = fixPage(ref.firstPage+i, false);
+        char*        page   = static_cast<char*>(bf.getData());
+        Header*      header = reinterpret_cast<Header*>(page);
+
+        // the data fills the page after dataStart
+        size_t chunk = std::min<uint64_t>(length-off, blocksize-header->dataStart);
+        memcpy(buffer+off, page+header->dataStart, chunk);
+        bm.unfixPage(bf, false);
+
+        off += chunk;
+    }
+
+    return RecordView(buffer, length);
+}
+
+// Turns the overflow pages of a large record into empty slotted pages, which
+// can then be used by regular inserts
+void SPSegment::freeOverflow(OverflowRef ref) {
+    for (uint32_t i = 0; i < ref.pageCount; i++) {
+        uint32_t pageID = ref.firstPage+i;
+
+        // open page for writing
+        BufferFrame& bf = bm.fixPage((id << 48) | pageID, true);
+        Header* header = new (bf.getData()) Header();
+        fsi.update(pageID, getContiguousSpace(*header));
+        markForMaintenance(pageID);
+        bm.unfixPage(bf, true);
+    }
+}
+
+// Drops the free slots at the end of the page
+bool SPSegment::trimSlots(char* data) {
+    Header* header = reinterpret_cast<Header*>(data);
+    Slot*   slots  = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+    uint16_t slotCount = header->slotCount;
+    while (slotCount > 0 && slots[slotCount-1].isFree())
+        slotCount--;
+
+    if (slotCount == header->slotCount)
+        return false;
+
+    header->freeSpace    += (header->slotCount - slotCount) * sizeof(Slot);
+    header->slotCount     = slotCount;
+    header->firstFreeSlot = std::min(header->firstFreeSlot, slotCount);
+    return true;
+}
+
+void SPSegment::markForMaintenance(uint32_t pageID) {
+    std::lock_guard<std::mutex> guard(candidatesMutex);
+    candidates.insert(pageID);
+}
+
+// Cleans up the pages changed since the last run
+void SPSegment::vacuum() {
+    std::set<uint32_t> pages;
+    {
+        std::lock_guard<std::mutex> guard(candidatesMutex);
+        pages.swap(candidates);
+    }
+
+    // the pages from which records were moved back are cleaned up in further
+    // rounds
+    while (!pages.empty()) {
+        // pages are compacted holding only their own latch, so modifications
+        // of other pages can go on meanwhile
+        std::vector<uint32_t> indirections;
+        for (uint32_t pageID : pages) {
+            if (pageID < size && vacuumPage(pageID))
+                indirections.push_back(pageID);
+        }
+
+        std::set<uint32_t> targets;
+        bool trailing = *pages.rbegin()+1 >= size;
+        if (!indirections.empty() || trailing) {
+            // moving records between pages and cutting off pages requires that
+            // no other operation is in progress
+            pthread_rwlock_wrlock(&latch);
+            for (uint32_t pageID : indirections) {
+                if (pageID < size)
+                    collapseIndirections(pageID, targets);
+            }
+            if (trailing)
+                trimPages();
+            pthread_rwlock_unlock(&latch);
+        }
+
+        pages.swap(targets);
+    }
+}
+
+// Compacts the page and drops its trailing free slots
+bool SPSegment::vacuumPage(uint32_t pageID) {
+    // open page for writing
+    BufferFrame& bf     = fixPage(pageID, true);
+    char*        data   = static_cast<char*>(bf.getData());
+    Header*      header = reinterpret_cast<Header*>(data);
+    Slot*        slots  = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+    // overflow pages have neither slots nor free space
+    if (header->slotCount == 0 && header->freeSpace == 0) {
+        bm.unfixPage(bf, false);
+        return false;
+    }
+
+    bool changed = trimSlots(data);
+
+    // only compact if the free space is fragmented
+    size_t headEnd = sizeof(Header) + header->slotCount*sizeof(Slot);
+    if (header->dataStart - headEnd != header->freeSpace) {
+        compactPage(data);
+        changed = true;
+    }
+
+    bool indirections = false;
+    for (uint32_t slotID = 0; slotID < header->slotCount; slotID++) {
+        if (slots[slotID].isIndirection()) {
+            indirections = true;
+            break;
+        }
+    }
+
+    fsi.update(pageID, getContiguousSpace(*header));
+    bm.unfixPage(bf, changed);
+    return indirections;
+}
+
+// Moves the records referenced by the indirections of the page back to it
+void SPSegment::collapseIndirections(uint32_t pageID, std::set<uint32_t>& targets) {
+    // open page for writing
+    BufferFrame& bf     = fixPage(pageID, true);
+    char*        data   = static_cast<char*>(bf.getData());
+    Header*      header = reinterpret_cast<Header*>(data);
+    Slot*        slots  = reinterpret_cast<Slot*>(data+sizeof(Header));
+
+    bool moved = false;
+    for (uint32_t slotID = 0; slotID < header->slotCount; slotID++) {
+        Slot& slot = slots[slotID];
+        if (!slot.isIndirection())
+            continue;
+
+        TID target = slot.getIndirectionTID(data);
+
+        // take over the target slot on the same page, like update does
+        if (target.pageID == pageID) {
+            std::swap(slot, slots[target.slotID]);
+            freeSlot(data, target.slotID);
+            moved = true;
+            continue;
+        }
+
+        // open target page for writing
+        BufferFrame& tbf     = fixPage(target.pageID, true);
+        char*        tdata   = static_cast<char*>(tbf.getData());
+        Header*      theader = reinterpret_cast<Header*>(tdata);
+        Slot&        tslot   = reinterpret_cast<Slot*>(tdata+sizeof(Header))[target.slotID];
+
+        // the space of the indirection is reused for the record
+        uint16_t space = tslot.getSpace();
+        if (!tslot.isRecord() || space > header->freeSpace+sizeof(TID)) {
+            bm.unfixPage(tbf, false);
+            continue;
+        }
+
+        // release the indirection, compacting the page if necessary
+        if (slot.offset == header->dataStart)
+            header->dataStart += sizeof(TID);
+        header->freeSpace += sizeof(TID);
+        slot = Slot();
+
+        size_t headEnd = sizeof(Header) + header->slotCount*sizeof(Slot);
+        if (header->dataStart - headEnd < space)
+            compactPage(data);
+
+        // copy the record
+        header->dataStart -= space;
+        header->freeSpace -= space;
+        slot.offset = header->dataStart;
+        slot.length = tslot.length;
+        memcpy(data+slot.offset, tdata+tslot.offset, slot.getLength());
+
+        if (slot.isOverflow()) {
+            RecordView large = readOverflow(getOverflowRef(data, slot), zones.getPrefixLen());
+            zones.add(pageID, large.getData(), large.getLen());
+        } else {
+            zones.add(pageID, data+slot.offset, slot.getLength());
+        }
+
+        // release the target slot
+        freeSlot(tdata, target.slotID);
+        fsi.update(target.pageID, getContiguousSpace(*theader));
+        targets.insert(target.pageID);
+        bm.unfixPage(tbf, true);
+        moved = true;
+    }
+
+    // released indirections leave gaps behind
+    if (moved) {
+        trimSlots(data);
+        compactPage(data);
+    }
+
+    fsi.update(pageID, getContiguousSpace(*header));
+    bm.unfixPage(bf, moved);
+}
+
+// Cuts off the empty pages at the end of the segment
+void SPSegment::trimPages() {
+    uint32_t pageCount = size;
+    while (pageCount > 0) {
+        // open page for writing
+        BufferFrame& bf     = fixPage(pageCount-1, true);
+        char*        data   = static_cast<char*>(bf.getData());
+        Header*      header = reinterpret_cast<Header*>(data);
+
+        bool changed = trimSlots(data);
+        bool empty   = header->slotCount == 0 && header->freeSpace == blocksize-sizeof(Header);
+        bm.unfixPage(bf, changed);
+
+        if (!empty)
+            break;
+        pageCount--;
+    }
 
-    // close page and return
-    bm.unfixPage(bf, true);
+    if (pageCount < size) {
+        size = pageCount;
+        fsi.truncate(pageCount);
+    }
+}
+
+void SPSegment::startMaintenance(std::chrono::milliseconds interval) {
+    stopMaintenance();
+
+    maintenanceStop   = false;
+    maintenanceThread = std::thread([this, interval] {
+        std::unique_lock<std::mutex> lock(maintenanceMutex);
+        while (!maintenanceStop) {
+            maintenanceCV.wait_for(lock, interval);
+            if (maintenanceStop)
+                break;
+
+            lock.unlock();
+            vacuum();
+            lock.lock();
+        }
+    });
+}
+
+void SPSegment::stopMaintenance() {
+    if (!maintenanceThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(maintenanceMutex);
+        maintenanceStop = true;
+    }
+    maintenanceCV.notify_all();
+    maintenanceThread.join();
+}
+
+SPSegment::PageIterator::PageIterator(SPSegment& seg, unsigned readAhead, PageFilter filter) :
+    seg(seg), window(readAhead), filter(filter), bf(NULL), data(NULL), pageID(0),
+    nextPageID(0), pageCount(0), prefetched(0), started(false) {}
+
+// Moves to the next page which passes the filter
+bool SPSegment::PageIterator::next() {
+    if (bf != NULL) {
+        seg.bm.unfixPage(*bf, false);
+        bf   = NULL;
+        data = NULL;
+    }
+
+    if (!started) {
+        nextPageID = 0;
+        pageCount  = seg.size;
+        prefetched = 0;
+        started    = true;
+    }
+
+    while (nextPageID < pageCount) {
+        pageID = nextPageID++;
+        if (filter && !filter(pageID))
+            continue;
+
+        readAhead();
+
+        // open page for reading
+        bf   = &seg.fixPage(pageID, false);
+        data = static_cast<const char*>(bf->getData());
+        return true;
+    }
+
+    return false;
+}
+
+// Keeps at least half of the window prefetched ahead of the current page
+void SPSegment::PageIterator::readAhead() {
+    if (window == 0 || pageID+window/2 < prefetched)
+        return;
+
+    uint32_t first = std::max(pageID, prefetched);
+    uint32_t end   = std::min<uint64_t>((uint64_t) pageID+window, pageCount);
+    uint64_t segPfx = seg.id << 48;
+
+    // skip the pages which will not be fixed
+    uint32_t runStart = first;
+    for (uint32_t p = first; p < end; p++) {
+        if (filter && !filter(p)) {
+            if (runStart < p)
+                seg.bm.prefetchPages(segPfx | runStart, p-runStart);
+            runStart = p+1;
+        }
+    }
+    if (runStart < end)
+        seg.bm.prefetchPages(segPfx | runStart, end-runStart);
+
+    prefetched = end;
+}
+
+void SPSegment::PageIterator::reset() {
+    if (bf != NULL) {
+        seg.bm.unfixPage(*bf, false);
+        bf   = NULL;
+        data = NULL;
+    }
+    started = false;
+}
+
+// Moves to the next record of the current or one of the following pages
+bool SPSegment::TupleIterator::next() {
+    large.release();
+
+    while (true) {
+        // loop over the slots of the current page
+        while (slotID < slotCount) {
+            Slot slot = pages.getSlot(slotID);
+            ++slotID;
+
+            // skip free and indirection slots
+            if (!slot.isRecord())
+                continue;
+
+            if (slot.isOverflow()) {
+                // read on demand by getPrefix
+                ref       = getOverflowRef(pages.getData(), slot);
+                data      = NULL;
+                len       = ref.length;
+                available = 0;
+            } else {
+                data      = pages.getData()+slot.offset;
+                len       = slot.getLength();
+                available = len;
+            }
+            return true;
+        }
+
+        // load the next page
+        if (!pages.next()) {
+            data      = NULL;
+            len       = 0;
+            available = 0;
+            return false;
+        }
+        slotID    = 0;
+        slotCount = pages.getSlotCount();
+    }
+}
+
+void SPSegment::TupleIterator::reset() {
+    large.release();
+    pages.reset();
+    slotID    = 0;
+    slotCount = 0;
+    data      = NULL;
+    len       = 0;
+    available = 0;
+}
+
+// Reads the overflow pages of a large record up to the prefix. A record
+// which is already read far enough is not read again
+const char* SPSegment::TupleIterator::getPrefix(uint64_t n) const {
+    n = std::min(n, len);
+    if (n > available) {
+        large     = seg.readOverflow(ref, n);
+        data      = large.getData();
+        available = large.getLen();
+    }
+    return data;
 }
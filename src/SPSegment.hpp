@@ -1,28 +1,51 @@
 #ifndef SPSEGMENT_H_
 #define SPSEGMENT_H_
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "FreeSpaceInventory.hpp"
 #include "Record.hpp"
+#include "RecordView.hpp"
 #include "Segment.hpp"
 #include "TID.hpp"
+#include "ZoneMap.hpp"
 
 // A slotted page consists of three parts: A header, the slots and the
 // (variable-length) records. Records are addressed by TIDs (tuple identifier),
 // consisting of a page ID and a slotID
 class SPSegment : public Segment {
   public:
+    // tag of the compact page format. The highest bit is never set in the
+    // (lower half of the) slot count of legacy pages, which start without tag
+    static const uint16_t pageVersion = 0x8001;
+
     // exported for the test
     struct Header {
         // LSN for recovery
-        uint32_t slotCount;     // number of used slots
-        uint32_t firstFreeSlot; // cache to speed up locating free slots
-        off_t    dataStart;     // lower end of the data
-        size_t   freeSpace;     // space that would be available after compaction
-        Header() : slotCount(0), firstFreeSlot(0), dataStart(blocksize), freeSpace(blocksize-sizeof(Header)) {}
+        uint16_t version;       // page format, always pageVersion
+        uint16_t slotCount;     // number of used slots
+        uint16_t firstFreeSlot; // cache to speed up locating free slots
+        uint16_t dataStart;     // lower end of the data
+        uint16_t freeSpace;     // space that would be available after compaction
+        Header() : version(pageVersion), slotCount(0), firstFreeSlot(0), dataStart(blocksize), freeSpace(blocksize-sizeof(Header)) {}
     };
 
     struct Slot {
-        off_t    offset; // start of the data item
-        uint64_t length; // length of the data item
+        uint16_t offset; // start of the data item
+        uint16_t length; // length of the data item and flags
+
+        // flags stored in the upper bits of the length
+        static const uint16_t indirectionFlag = 1 << 15; // data item is a TID
+        static const uint16_t overflowFlag    = 1 << 14; // data item is an OverflowRef
+        static const uint16_t lengthMask      = overflowFlag - 1;
 
         Slot() : offset(0), length(0) {}
 
@@ -31,49 +54,383 @@ class SPSegment : public Segment {
             return (offset == 0);
         }
 
-        // offset = 1 => indirection
         inline bool isIndirection() {
-            return (offset == 1);
+            return (offset != 0 && (length & indirectionFlag));
         }
 
         inline bool isRecord() {
-            return (offset >= 2);
+            return (offset != 0 && !(length & indirectionFlag));
+        }
+
+        inline bool isOverflow() {
+            return isRecord() && (length & overflowFlag);
+        }
+
+        inline uint16_t getLength() {
+            return length & lengthMask;
+        }
+
+        // space occupied in the data area. Every data item occupies at least
+        // the size of a TID, so that it can always be turned into an
+        // indirection in place
+        inline uint16_t getSpace() {
+            return std::max<uint16_t>(getLength(), sizeof(TID));
+        }
+
+        inline TID getIndirectionTID(const char* page) {
+            TID tid;
+            memcpy(&tid, page+offset, sizeof(TID));
+            return tid;
+        }
+
+        // the slot must occupy at least sizeof(TID) bytes
+        inline void setIndirection(char* page, TID tid) {
+            memcpy(page+offset, &tid, sizeof(TID));
+            length = sizeof(TID) | indirectionFlag;
+        }
+    };
+
+    static_assert(blocksize <= Slot::lengthMask+1, "page size exceeds slot length encoding");
+
+    // The page format used before the compact encoding: 64 bit header fields
+    // and 16 byte slots, which held indirections directly (offset = 1).
+    // Legacy pages are converted to the compact format when they are fixed
+    struct LegacyHeader {
+        uint32_t slotCount;
+        uint32_t firstFreeSlot;
+        off_t    dataStart;
+        size_t   freeSpace;
+    };
+
+    struct LegacySlot {
+        off_t    offset;
+        uint64_t length;
+
+        static const uint64_t overflowFlag = (uint64_t) 1 << 63;
+    };
+
+    // Records which do not fit into an empty page are stored out of line on a
+    // run of consecutive overflow pages. The page holding the slot only
+    // stores a reference to them.
+    // Overflow pages have a header without any slots, so they are empty to
+    // scans and only read when the record itself is accessed
+    struct OverflowRef {
+        uint64_t length;    // length of the record
+        uint32_t firstPage; // first overflow page
+        uint32_t pageCount; // number of overflow pages
+    };
+
+    // number of pages prefetched ahead of a scan by default
+    static const unsigned defaultReadAhead = 16;
+
+    // Iterates over the pages of the segment in order. Only the current page
+    // is fixed (shared) and the following pages are prefetched, so that the
+    // disk reads overlap with the processing of the current page.
+    // The segment size is read when the iteration starts
+    class PageIterator {
+      public:
+        // Returns false for pages which are skipped without fixing them
+        typedef std::function<bool(uint32_t)> PageFilter;
+
+        PageIterator(SPSegment& seg, unsigned readAhead = defaultReadAhead, PageFilter filter = PageFilter());
+
+        // Unfixes the current page
+        ~PageIterator() {
+            reset();
+        }
+
+        // Moves to the next page. Returns false at the end of the segment
+        bool next();
+
+        // Unfixes the current page and starts over with the first page
+        void reset();
+
+        uint32_t getPageID() const {
+            return pageID;
+        }
+
+        const char* getData() const {
+            return data;
+        }
+
+        uint16_t getSlotCount() const {
+            return reinterpret_cast<const Header*>(data)->slotCount;
+        }
+
+        Slot getSlot(uint16_t slotID) const {
+            return reinterpret_cast<const Slot*>(data+sizeof(Header))[slotID];
+        }
+
+      private:
+        // prefetches the pages after the current one
+        void readAhead();
+
+        SPSegment&   seg;
+        unsigned     window;     // number of pages to read ahead
+        PageFilter   filter;
+        BufferFrame* bf;         // current page or NULL
+        const char*  data;
+        uint32_t     pageID;     // current page
+        uint32_t     nextPageID; // next page to look at
+        uint32_t     pageCount;
+        uint32_t     prefetched; // end of the pages prefetched so far
+        bool         started;
+    };
+
+    // Iterates over the records of the segment in page order. Free slots and
+    // indirections are skipped: a record moved by an update is returned on
+    // the page it was moved to. The overflow pages of large records are only
+    // read when the data of the record is asked for
+    class TupleIterator {
+      public:
+        TupleIterator(SPSegment& seg, unsigned readAhead = defaultReadAhead,
+                PageIterator::PageFilter filter = PageIterator::PageFilter()) :
+            seg(seg), pages(seg, readAhead, filter), slotID(0), slotCount(0),
+            large(nullptr, 0), data(NULL), len(0), available(0) {}
+
+        // Moves to the next record. Returns false at the end of the segment
+        bool next();
+
+        // Releases the current record and starts over with the first page
+        void reset();
+
+        // The location of the current record
+        TID getTID() const {
+            return TID{pages.getPageID(), slotID-1};
         }
 
-        inline TID getIndirectionTID() {
-            return TID{(uint32_t) (length >> 32), (uint32_t) length};
+        // The current record, valid until next is called
+        const char* getData() const {
+            return getPrefix(len);
         }
 
-        inline void setIndirection(TID tid) {
-            offset = 1;
-            length = (uint64_t) (tid.pageID) << 32 | tid.slotID;
+        // Returns at least the first n bytes of the current record, valid
+        // until next is called. Of a large record, only the overflow pages
+        // holding them are read
+        const char* getPrefix(uint64_t n) const;
+
+        // The length of the current record, which does not read it
+        uint64_t getLen() const {
+            return len;
         }
+
+      private:
+        SPSegment&          seg;
+        PageIterator        pages;
+        uint32_t            slotID;    // next slot on the current page
+        uint32_t            slotCount; // slots of the current page
+        OverflowRef         ref;       // the current record, if it is large
+        mutable RecordView  large;     // the part of the large record read so far
+        mutable const char* data;
+        uint64_t            len;
+        mutable uint64_t    available; // bytes of the current record at data
     };
 
-    SPSegment(BufferManager& bm, uint64_t id) : Segment(bm, id) {};
+    // Creates a new, empty segment
+    SPSegment(BufferManager& bm, uint64_t id);
+
+    // Opens an existing segment consisting of the given number of pages and
+    // rebuilds its free space inventory. The attributes at the given record
+    // offsets are summarized again, like by summarize
+    SPSegment(BufferManager& bm, uint64_t id, size_t pages,
+        std::vector<unsigned> summarized = std::vector<unsigned>());
 
-    // Searches through the segment's pages looking for a page with enough space
-    // to store r. Returns the TID identifying the location where r was stored
+    // Stops the background maintenance
+    ~SPSegment();
+
+    // Asks the free space inventory for a page with enough space to store r or
+    // appends a new page. Returns the TID identifying the location where r was
+    // stored
     TID insert(const Record& r);
 
+    // Inserts records on behalf of a single thread. Each inserter fills its
+    // own append page, which is not handed out by the free space inventory
+    // until it is full, so that concurrent inserters do not contend for the
+    // same pages. Large records are inserted like with SPSegment::insert
+    class Inserter {
+      public:
+        Inserter(SPSegment& seg) : seg(seg), pageID(0), owning(false) {}
+
+        // Hands the current append page over to the free space inventory
+        ~Inserter() {
+            release();
+        }
+
+        TID insert(const Record& r);
+        void release();
+
+      private:
+        SPSegment& seg;
+        uint32_t   pageID; // current append page
+        bool       owning; // whether pageID is valid
+    };
+
+    // Appends count records to fresh pages at the end of the segment. The
+    // records are stored back to back in data, record i being lens[i] bytes
+    // long. Each page is filled sequentially and its header and slots are
+    // written only once. Returns the TIDs of the records in input order
+    std::vector<TID> insertBatch(const char* data, const unsigned* lens, size_t count);
+
     // Deletes the record pointed to by tid and updates the page header
     // accordingly
     bool remove(TID tid);
 
-    // Returns the read-only record associated with TID tid
+    // Returns the read-only record associated with TID tid. Records of 4 GiB
+    // or more do not fit into a Record, they are only read by lookupView
     Record lookup(TID tid);
 
+    // Returns a view on the record associated with TID tid without copying
+    // it. The page stays fixed as long as the view is alive
+    RecordView lookupView(TID tid);
+
+    // Called by lookupBatch for each record with the index of its TID in the
+    // input array. The data is only valid during the call
+    typedef std::function<void(size_t, const char*, uint64_t)> LookupCallback;
+
+    // Looks up the records of n TIDs. The TIDs are grouped by page, so that
+    // every page is fixed only once; indirections are resolved in further
+    // batched passes. The callback is invoked in page order, not input order
+    void lookupBatch(const TID* tids, size_t n, const LookupCallback& callback);
+
     // Updates the record pointed to by tid with the content of record r
     bool update(TID tid, const Record& r);
 
+    // Maintains the minimum and maximum of the 64 bit integer attributes at
+    // the given record offsets for every page from now on. The records
+    // already stored are summarized right away
+    void summarize(std::vector<unsigned> offsets);
+
+    // Returns the per-page summaries maintained since summarize was called
+    const ZoneMap& getZoneMap() const {
+        return zones;
+    }
+
+    // Cleans up the pages changed by removes and updates since the last run:
+    // fragmented pages are compacted, free slots at the end of a page are
+    // dropped, records are moved back to the page of their TID if it has
+    // room again and empty pages at the end of the segment are cut off.
+    // Moving records and cutting off pages waits until all other
+    // modifications of the segment are finished. Meanwhile, a thread must
+    // not hold views on several pages of the segment at once
+    void vacuum();
+
+    // Runs vacuum in a background thread every interval until
+    // stopMaintenance is called or the segment is destroyed
+    void startMaintenance(std::chrono::milliseconds interval);
+    void stopMaintenance();
+
   private:
-    // compacts the given page by moving records
-    void compactPage(uint32_t pageID);
+    // checks whether a record of the given length can be stored in a page
+    inline static bool fitsOnPage(uint64_t len) {
+        return std::max<uint64_t>(len, sizeof(TID))+sizeof(Slot) <= blocksize-sizeof(Header);
+    }
 
-  friend class TableScan;
-};
+    inline static OverflowRef getOverflowRef(const char* page, Slot& slot) {
+        OverflowRef ref;
+        memcpy(&ref, page+slot.offset, sizeof(OverflowRef));
+        return ref;
+    }
 
-#endif  // SPSEGMENT_H_
+    // fixes a page of this segment, converting legacy pages to the compact
+    // format
+    BufferFrame& fixPage(uint32_t pageID, bool exclusive);
+
+    // appends an empty page to the segment and returns it fixed exclusively.
+    // The segment size is only increased once the page is initialized
+    BufferFrame& allocatePage(uint32_t& pageID);
+
+    // widens the zone map by the records of the fixed page
+    void summarizePage(uint32_t pageID, char* data);
+
+    // converts a legacy page in place to the compact format
+    void convertPage(char* data);
 
+    // stores len bytes of data in a new slot. If overflow is set, data is an
+    // OverflowRef. The zone map is widened by the record before the page is
+    // released, so that scans never prune a page holding it
+    TID insertInline(const char* data, uint64_t len, bool overflow, const char* record, uint64_t recordLen);
 
+    // stores the data item in a new slot of the given (exclusively fixed)
+    // page. Returns false if the page has not enough contiguous free space,
+    // fragmented pages are only compacted by vacuum
+    bool insertIntoPage(char* page, const char* data, uint64_t len, bool overflow, uint32_t& slotID);
 
+    // marks the slot as free and releases its data item
+    void freeSlot(char* data, uint16_t slotID);
+
+    // remove and update, called while holding the maintenance latch
+    bool removeRecord(TID tid);
+    bool updateRecord(TID tid, const Record& r);
+
+    // writes a large record to new overflow pages
+    OverflowRef writeOverflow(const char* data, uint64_t len);
+
+    // reads the first prefix bytes of a large record from its overflow
+    // pages, by default the whole record
+    RecordView readOverflow(OverflowRef ref, uint64_t prefix = ~(uint64_t) 0);
+
+    // turns the overflow pages of a large record into empty slotted pages
+    void freeOverflow(OverflowRef ref);
+
+    // resolves a batch of (TID, input index) pairs sorted by TID. Entries
+    // pointing to an indirection are returned with the indirected TID
+    std::vector<std::pair<TID, size_t>> lookupSorted(
+        const std::vector<std::pair<TID, size_t>>& batch, const LookupCallback& callback);
+
+    // keeps track of the free space of each page
+    FreeSpaceInventory fsi;
+
+    // min/max summaries of some attributes of each page
+    ZoneMap zones;
+
+    // Returns the free space between the slots and the data, which inserts
+    // can use without compacting the page. The free space inventory only
+    // offers this space, the rest is reclaimed by vacuum
+    static inline uint16_t getContiguousSpace(const Header& header) {
+        return header.dataStart - sizeof(Header) - header.slotCount*sizeof(Slot);
+    }
+
+    // compacts the given (exclusively fixed) page by moving records
+    void compactPage(char* data);
+
+    // drops the free slots at the end of the given (exclusively fixed) page.
+    // Returns whether the page was changed
+    bool trimSlots(char* data);
+
+    // remembers a page for the next vacuum run
+    void markForMaintenance(uint32_t pageID);
+
+    // compacts a page and drops its trailing free slots. Returns whether the
+    // page holds indirections
+    bool vacuumPage(uint32_t pageID);
+
+    // moves the records referenced by the indirections of the page back to
+    // it as far as there is room and collects the pages they were moved
+    // from. The maintenance latch must be held exclusively
+    void collapseIndirections(uint32_t pageID, std::set<uint32_t>& targets);
+
+    // cuts off the empty pages at the end of the segment. The maintenance
+    // latch must be held exclusively
+    void trimPages();
+
+    // Held shared by all modifications and while following indirections,
+    // held exclusively by vacuum to move records between pages and to cut
+    // off pages
+    pthread_rwlock_t latch;
+
+    // serializes the growth of the segment
+    std::mutex allocMutex;
+
+    // pages changed since the last vacuum run
+    std::set<uint32_t> candidates;
+    std::mutex         candidatesMutex;
+
+    // background maintenance
+    std::thread             maintenanceThread;
+    std::mutex              maintenanceMutex;
+    std::condition_variable maintenanceCV;
+    bool                    maintenanceStop;
+
+};
+
+#endif  // SPSEGMENT_H_
@@ -5,6 +5,10 @@
 
 #include "BufferManager.hpp"
 
+// Tells the constructor of a persistent index, like BTree, whether to
+// initialize an empty index on the segment or to open the index stored on it
+enum class TreeMode { Create, Open };
+
 class Segment {
   protected:
     uint64_t            id;
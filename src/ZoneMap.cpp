@@ -0,0 +1,76 @@
+#include <cstring>
+
+#include "ZoneMap.hpp"
+
+void ZoneMap::reset(std::vector<unsigned> offsets) {
+    std::lock_guard<std::mutex> guard(mutex);
+    this->offsets = offsets;
+    zones.clear();
+}
+
+int ZoneMap::find(unsigned offset) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (unsigned attr = 0; attr < offsets.size(); attr++) {
+        if (offsets[attr] == offset)
+            return attr;
+    }
+    return -1;
+}
+
+uint64_t ZoneMap::getPrefixLen() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    uint64_t prefix = 0;
+    for (unsigned offset : offsets) {
+        if (offset+sizeof(int64_t) > prefix)
+            prefix = offset+sizeof(int64_t);
+    }
+    return prefix;
+}
+
+void ZoneMap::add(uint32_t pageID, const char* record, uint64_t len) {
+    // reset may change the offsets concurrently
+    std::lock_guard<std::mutex> guard(mutex);
+
+    size_t attrCount = offsets.size();
+    if (attrCount == 0)
+        return;
+
+    if ((pageID+1)*attrCount > zones.size())
+        zones.resize((pageID+1)*attrCount);
+
+    Zone* pageZones = &zones[pageID*attrCount];
+    for (size_t attr = 0; attr < attrCount; attr++) {
+        if (offsets[attr]+sizeof(int64_t) > len)
+            continue;
+
+        int64_t value;
+        memcpy(&value, record+offsets[attr], sizeof(int64_t));
+
+        Zone& zone = pageZones[attr];
+        if (value < zone.min)
+            zone.min = value;
+        if (value > zone.max)
+            zone.max = value;
+    }
+}
+
+bool ZoneMap::mayContain(uint32_t pageID, unsigned attr, int64_t lo, int64_t hi) const {
+    Zone zone = getZone(pageID, attr);
+    return zone.min <= hi && zone.max >= lo;
+}
+
+int64_t ZoneMap::getMin(uint32_t pageID, unsigned attr) const {
+    return getZone(pageID, attr).min;
+}
+
+int64_t ZoneMap::getMax(uint32_t pageID, unsigned attr) const {
+    return getZone(pageID, attr).max;
+}
+
+ZoneMap::Zone ZoneMap::getZone(uint32_t pageID, unsigned attr) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t index = (size_t) pageID*offsets.size() + attr;
+    if (index >= zones.size())
+        return Zone(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    return zones[index];
+}
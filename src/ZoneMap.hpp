@@ -0,0 +1,71 @@
+#ifndef ZONEMAP_H_
+#define ZONEMAP_H_
+
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+// A zone map keeps the minimum and maximum value of some 64 bit integer
+// attributes for every page of a segment. Scans with a range predicate on
+// such an attribute can skip all pages whose range does not overlap it,
+// without fixing them.
+// The summaries are only widened: removing or overwriting a record leaves
+// them unchanged, thus they may be too wide but never too narrow.
+// All operations are synchronized by a mutex
+class ZoneMap {
+  public:
+    ZoneMap() {}
+
+    // Summarizes the attributes stored at the given offsets of a record
+    explicit ZoneMap(std::vector<unsigned> offsets) : offsets(offsets) {}
+
+    // Drops all summaries and summarizes the attributes at the given offsets
+    // from now on
+    void reset(std::vector<unsigned> offsets);
+
+    // Returns the index of the attribute stored at the given record offset or
+    // -1 if it is not summarized
+    int find(unsigned offset) const;
+
+    // Returns the number of leading bytes of a record which hold all
+    // summarized attributes, so that large records need not be read entirely
+    uint64_t getPrefixLen() const;
+
+    // Widens the summaries of the page to include the attributes of the
+    // record. Attributes beyond the end of the record are ignored
+    void add(uint32_t pageID, const char* record, uint64_t len);
+
+    // Returns false if no record on the page can have a value within [lo, hi]
+    // for the attribute with the given index. Pages which were never
+    // summarized may contain any value
+    bool mayContain(uint32_t pageID, unsigned attr, int64_t lo, int64_t hi) const;
+
+    // Returns the bounds of the attribute on the page. If the page holds no
+    // record, min is larger than max. The bounds of a page which was never
+    // summarized span all values
+    int64_t getMin(uint32_t pageID, unsigned attr) const;
+    int64_t getMax(uint32_t pageID, unsigned attr) const;
+
+  private:
+    struct Zone {
+        int64_t min;
+        int64_t max;
+        Zone() : min(std::numeric_limits<int64_t>::max()), max(std::numeric_limits<int64_t>::min()) {}
+        Zone(int64_t min, int64_t max) : min(min), max(max) {}
+    };
+
+    // returns the zone of the attribute on the page or a zone spanning all
+    // values if the page is unknown
+    Zone getZone(uint32_t pageID, unsigned attr) const;
+
+    // record offsets of the summarized attributes
+    std::vector<unsigned> offsets;
+
+    // zone of attribute a on page p at index p*offsets.size()+a
+    std::vector<Zone> zones;
+
+    mutable std::mutex mutex;
+};
+
+#endif  // ZONEMAP_H_
@@ -0,0 +1,104 @@
+#ifndef COLUMNSCAN_H_
+#define COLUMNSCAN_H_
+
+#include <string>
+#include <vector>
+
+#include "../ColumnSegment.hpp"
+#include "../Operator.hpp"
+
+// Scans the requested columns of a ColumnSegment. Each column is decoded a
+// whole block at a time into a vector; only the blocks of the requested
+// columns are read. The output registers are in the order of the given
+// attribute IDs
+class ColumnScan: public Operator {
+    // decoding state of one column
+    struct Cursor {
+        unsigned                 attr;
+        Types::Tag               type;
+        size_t                   block; // next block to decode
+        size_t                   pos;   // next value in the decoded block
+        std::vector<int64_t>     ints;
+        std::vector<std::string> strings;
+
+        size_t decoded() {
+            return (type == Types::Tag::Integer) ? ints.size() : strings.size();
+        }
+    };
+
+    ColumnSegment&         seg;
+    std::vector<Cursor>    cursors;
+    std::vector<Register*> regs;
+
+  public:
+    ColumnScan(ColumnSegment& seg, std::vector<unsigned> IDs);
+    void                   open();
+    bool                   next();
+    std::vector<Register*> getOutput();
+    void                   close();
+};
+
+ColumnScan::ColumnScan(ColumnSegment& seg, std::vector<unsigned> IDs) : seg(seg) {
+    for (unsigned id : IDs) {
+        Cursor cursor;
+        cursor.attr  = id;
+        cursor.type  = seg.getType(id);
+        cursor.block = 0;
+        cursor.pos   = 0;
+        cursors.push_back(cursor);
+    }
+    regs.resize(IDs.size());
+}
+
+void ColumnScan::open() {
+    for (Cursor& cursor : cursors) {
+        cursor.block = 0;
+        cursor.pos   = 0;
+        cursor.ints.clear();
+        cursor.strings.clear();
+    }
+}
+
+bool ColumnScan::next() {
+    for (unsigned i = 0; i < cursors.size(); ++i) {
+        Cursor& cursor = cursors[i];
+
+        // decode the next block of the column if necessary
+        while (cursor.pos == cursor.decoded()) {
+            if (cursor.block == seg.getBlockCount(cursor.attr)) {
+                return false;
+            }
+
+            if (cursor.type == Types::Tag::Integer) {
+                seg.decodeBlock(cursor.attr, cursor.block, cursor.ints);
+            } else {
+                seg.decodeBlock(cursor.attr, cursor.block, cursor.strings);
+            }
+            cursor.block++;
+            cursor.pos = 0;
+        }
+
+        Register* reg = new Register;
+        if (cursor.type == Types::Tag::Integer) {
+            reg->setInteger(cursor.ints[cursor.pos]);
+        } else {
+            reg->setString(cursor.strings[cursor.pos]);
+        }
+        regs[i] = reg;
+        cursor.pos++;
+    }
+    return true;
+}
+
+std::vector<Register*> ColumnScan::getOutput() {
+    return regs;
+}
+
+void ColumnScan::close() {
+    for (Cursor& cursor : cursors) {
+        cursor.ints.clear();
+        cursor.strings.clear();
+    }
+}
+
+#endif  // COLUMNSCAN_H_
@@ -0,0 +1,121 @@
+#ifndef PAXSCAN_H_
+#define PAXSCAN_H_
+
+#include <vector>
+
+#include "../Operator.hpp"
+#include "../PAXSegment.hpp"
+#include "../Schema.hpp"
+
+// Scans a PAXSegment, but only reads the minipages of the requested
+// attributes. The output registers are in the order of the given attribute IDs
+class PAXScan: public Operator {
+    PAXSegment&              seg;
+    BufferManager&           bm;
+    BufferFrame*             bf;
+    char*                    data;
+    uint32_t                 pageID;
+    uint32_t                 pageCount;
+    unsigned                 count;
+    unsigned                 slotID;
+    std::vector<unsigned>    IDs;
+    std::vector<Types::Tag>  types;
+    std::vector<const char*> minipages;
+    std::vector<Register*>   regs;
+
+  public:
+    PAXScan(Schema::Relation& rel, PAXSegment& seg);
+    PAXScan(Schema::Relation& rel, PAXSegment& seg, std::vector<unsigned> IDs);
+    void                   open();
+    bool                   next();
+    std::vector<Register*> getOutput();
+    void                   close();
+};
+
+PAXScan::PAXScan(Schema::Relation& rel, PAXSegment& seg) :
+    seg(seg), bm(seg.bm), bf(NULL) {
+        for (unsigned i = 0; i < rel.attributes.size(); ++i) {
+            IDs.push_back(i);
+            types.push_back(rel.attributes[i].type);
+        }
+        minipages.resize(IDs.size());
+        regs.resize(IDs.size());
+    }
+
+PAXScan::PAXScan(Schema::Relation& rel, PAXSegment& seg, std::vector<unsigned> IDs) :
+    seg(seg), bm(seg.bm), bf(NULL), IDs(IDs) {
+        for (unsigned id : IDs) {
+            types.push_back(rel.attributes.at(id).type);
+        }
+        minipages.resize(IDs.size());
+        regs.resize(IDs.size());
+    }
+
+void PAXScan::open() {
+    assert(bf == NULL);
+
+    pageID    = 0;
+    pageCount = seg.size;
+}
+
+bool PAXScan::next() {
+    // loop over pages
+    while (true) {
+        // load a new page if necessary
+        if (bf == NULL) {
+            // check if we reached the end of the segment
+            if (pageID >= pageCount) {
+                return false;
+            }
+
+            bf   = &bm.fixPage((seg.id << 48) | pageID, false);
+            data = static_cast<char*>(bf->getData());
+            auto header = reinterpret_cast<PAXSegment::Header*>(data);
+
+            count  = header->count;
+            slotID = 0;
+
+            // locate the minipages of the requested attributes
+            for (unsigned i = 0; i < IDs.size(); ++i) {
+                minipages[i] = seg.getMinipage(data, IDs[i]);
+            }
+
+            ++pageID;
+        }
+
+        // loop over the slots of the current page
+        while (slotID < count) {
+            unsigned slot = slotID++;
+
+            // skip removed tuples
+            if (!seg.isValid(data, slot)) {
+                continue;
+            }
+
+            for (unsigned i = 0; i < IDs.size(); ++i) {
+                size_t len = seg.lens[IDs[i]];
+                Register* reg = new Register;
+                reg->load(types[i], const_cast<char*>(minipages[i] + slot*len));
+                regs[i] = reg;
+            }
+            return true;
+        }
+
+        // reached the end of the page, unload
+        bm.unfixPage(*bf, false);
+        bf = NULL;
+    }
+}
+
+std::vector<Register*> PAXScan::getOutput() {
+    return regs;
+}
+
+void PAXScan::close() {
+    if (bf != NULL) {
+        bm.unfixPage(*bf, false);
+        bf = NULL;
+    }
+}
+
+#endif  // PAXSCAN_H_
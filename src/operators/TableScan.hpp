@@ -9,19 +9,27 @@
 
 class TableScan: public Operator {
     SPSegment&                               seg;
-    BufferManager&                           bm;
-    BufferFrame*                             bf;
-    char*                                    data;
-    uint64_t                                 pageID;
-    uint64_t                                 lastID;
-    uint32_t                                 slotCount;
-    uint32_t                                 slotID;
-    SPSegment::Slot*                         slots;
+    SPSegment::TupleIterator                 it;
     std::vector<Register*>                   regs;
     std::vector<Schema::Relation::Attribute> attributes;
 
+    // optional range predicate lo <= attribute <= hi on an integer attribute
+    bool                                     filtered;
+    unsigned                                 filterOff;
+    int                                      filterZone;
+    int64_t                                  lo;
+    int64_t                                  hi;
+
+    void loadRegisters(const char* recordPtr, uint64_t recordLen);
+    bool matches(const char* recordPtr, uint64_t recordLen);
+
   public:
     TableScan(Schema::Relation& rel, SPSegment& seg);
+
+    // Only returns the tuples whose integer attribute attrID lies within
+    // [lo, hi]. If the segment summarizes the attribute, pages outside of the
+    // range are skipped without reading them
+    TableScan(Schema::Relation& rel, SPSegment& seg, unsigned attrID, int64_t lo, int64_t hi);
     void                   open();
     bool                   next();
     std::vector<Register*> getOutput();
@@ -29,8 +37,24 @@ class TableScan: public Operator {
 };
 
 TableScan::TableScan(Schema::Relation& rel, SPSegment& seg) :
-    seg(seg), bm(seg.bm), bf(NULL), attributes(rel.attributes) {
+    seg(seg), it(seg), attributes(rel.attributes), filtered(false) {
+        regs.resize(attributes.size());
+    }
+
+TableScan::TableScan(Schema::Relation& rel, SPSegment& seg, unsigned attrID, int64_t lo, int64_t hi) :
+    seg(seg), it(seg, SPSegment::defaultReadAhead, [this](uint32_t pageID) {
+        // skip pages which can not contain a matching tuple
+        return filterZone < 0 || this->seg.getZoneMap().mayContain(pageID, filterZone, this->lo, this->hi);
+    }), attributes(rel.attributes), filtered(true), lo(lo), hi(hi) {
+        assert(attrID < attributes.size());
+        assert(attributes[attrID].type == Types::Tag::Integer);
         regs.resize(attributes.size());
+
+        filterOff = 0;
+        for (unsigned i = 0; i < attrID; ++i) {
+            filterOff += attributes[i].len;
+        }
+        filterZone = seg.getZoneMap().find(filterOff);
     }
 
 void TableScan::open() {
@@ -39,62 +63,42 @@ void TableScan::open() {
     // Opening all pages at the start of the scan is not an option since there
     // might be more pages than free slots in the buffer manager.
     // TODO: Use e.g. locking
-
-    assert(bf == NULL);
-
-    pageID = (seg.id << 48);
-    lastID = pageID+seg.size-1;
+    it.reset();
 }
 
 bool TableScan::next() {
-    // loop over pages
-    while (true) {
-        // load a new page if necessary
-        if (bf == NULL) {
-            // check if we reached the end of the segment
-            if (pageID > lastID) {
-                return false;
-            }
-
-            // TODO: implement and use an SPSegment iterator instead
-            bf   = &bm.fixPage(pageID, false);
-            data = static_cast<char*>(bf->getData());
-            auto  header = reinterpret_cast<SPSegment::Header*>(data);
-
-            slotCount = header->slotCount;
-            slotID    = 0;
-            slots     = reinterpret_cast<SPSegment::Slot*>(data+sizeof(SPSegment::Header));
-
-            ++pageID;
-        }
-
-        // loop over the slots of the current page
-        while(slotID < slotCount) {
-            auto slot = slots[slotID];
-            ++slotID;
-
-            // skip free and indirection slots
-            if (!slot.isRecord()) {
-                continue;
-            }
-
-            // we assume that all types have a fixed length
-            char* recordPtr = data+slot.offset;
-            off_t recordOff = 0;
-            for (int i = 0; i < regs.size(); ++i) {
-                Register* reg = new Register;
-                reg->load(attributes[i].type, recordPtr+recordOff);
-                regs[i] = reg;
-                recordOff += attributes[i].len;
-            }
-            assert(recordOff == slot.length);
+    while (it.next()) {
+        // the predicate only needs the record up to the filtered attribute
+        const char* prefix = filtered ? it.getPrefix(filterOff+sizeof(int64_t)) : NULL;
+        if (matches(prefix, it.getLen())) {
+            loadRegisters(it.getData(), it.getLen());
             return true;
         }
+    }
+    return false;
+}
 
-        // reached the end of the page, unload
-        bm.unfixPage(*bf, false);
-        bf = NULL;
+void TableScan::loadRegisters(const char* recordPtr, uint64_t recordLen) {
+    // we assume that all types have a fixed length
+    off_t recordOff = 0;
+    for (int i = 0; i < regs.size(); ++i) {
+        Register* reg = new Register;
+        reg->load(attributes[i].type, const_cast<char*>(recordPtr+recordOff));
+        regs[i] = reg;
+        recordOff += attributes[i].len;
     }
+    assert(recordOff == recordLen);
+}
+
+bool TableScan::matches(const char* recordPtr, uint64_t recordLen) {
+    if (!filtered) {
+        return true;
+    }
+
+    int64_t value;
+    assert(filterOff+sizeof(value) <= recordLen);
+    memcpy(&value, recordPtr+filterOff, sizeof(value));
+    return value >= lo && value <= hi;
 }
 
 std::vector<Register*> TableScan::getOutput() {
@@ -102,10 +106,7 @@ std::vector<Register*> TableScan::getOutput() {
 }
 
 void TableScan::close() {
-    if (bf != NULL) {
-        bm.unfixPage(*bf, false);
-        bf = NULL;
-    }
+    it.reset();
 }
 
 #endif  // TABLESCAN_H_
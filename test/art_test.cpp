@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+// DEBUG
+#include <iostream>
+
+#include "../src/ART.hpp"
+
+typedef std::pair<uint32_t, uint32_t> IntPair;
+
+/* Comparator for IntPair */
+struct MyCustomIntPairCmp {
+   bool operator()(const IntPair& a, const IntPair& b) const {
+      if (a.first < b.first)
+         return true;
+      else
+         return (a.first == b.first) && (a.second < b.second);
+   }
+};
+
+/* Normalizer for IntPair */
+template <>
+struct KeyNormalizer<IntPair, MyCustomIntPairCmp> {
+   static const bool     enabled = true;
+   static const unsigned size    = 2*sizeof(uint32_t);
+
+   static void normalize(const IntPair& key, uint8_t* out) {
+      normalizeInteger(key.first, out);
+      normalizeInteger(key.second, out+sizeof(uint32_t));
+   }
+
+   static IntPair denormalize(const uint8_t* in) {
+      return std::make_pair(denormalizeInteger<uint32_t>(in), denormalizeInteger<uint32_t>(in+sizeof(uint32_t)));
+   }
+};
+
+template <class K>
+K getKey(uint64_t i);
+
+template <>
+uint64_t getKey(uint64_t i) { return i; }
+
+// negative and positive keys
+template <>
+int64_t getKey(uint64_t i) { return (i%2 == 0) ? -static_cast<int64_t>(i) : static_cast<int64_t>(i); }
+
+// keys sharing long prefixes
+template <>
+Char<20> getKey(uint64_t i) {
+   std::stringstream ss;
+   ss << i;
+   std::string s(std::string(20-ss.str().size(), '0')+ss.str());
+   Char<20> key;
+   memcpy(key.data, s.data(), 20);
+   return key;
+}
+
+template <>
+IntPair getKey(uint64_t i) { return std::make_pair(i/3, 3-(i%3)); }
+
+// Checks that a range scan returns exactly the keys within [lo, hi] of the
+// reference, in order
+template <class K, class CMP>
+void testRange(ART<K, CMP>& tree, const std::map<K, TID, CMP>& reference, K lo, K hi) {
+   CMP less;
+   for (int reverse=0; reverse<2; ++reverse) {
+      std::vector<std::pair<K, TID>> expected;
+      if (!less(hi, lo))
+         expected.assign(reference.lower_bound(lo), reference.upper_bound(hi));
+      if (reverse)
+         std::reverse(expected.begin(), expected.end());
+
+      auto it = tree.lookupRange(lo, hi, reverse);
+      size_t count = 0;
+      while (it.next()) {
+         assert(count < expected.size());
+         K key = it.getKey();
+         assert(!less(key, expected[count].first) && !less(expected[count].first, key));
+         assert(it.getTID()==expected[count].second);
+         count++;
+      }
+      assert(count == expected.size());
+   }
+}
+
+template <class K, class CMP>
+void test(uint64_t n) {
+   ART<K, CMP> tree;
+   std::map<K, TID, CMP> reference;
+
+   // Insert values
+   for (uint32_t i=0; i<n; ++i) {
+      tree.insert(getKey<K>(i),TID{i,i});
+      reference[getKey<K>(i)] = TID{i,i};
+   }
+
+   // Check if they can be retrieved
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(tree.lookup(getKey<K>(i),tid));
+      assert(tid==(TID{i,i}));
+   }
+   testRange(tree, reference, getKey<K>(n/4), getKey<K>(n/2));
+   testRange(tree, reference, reference.begin()->first, reference.rbegin()->first);
+   testRange(tree, reference, getKey<K>(n/2), getKey<K>(n/4));
+
+   // Overwrite every third value
+   for (uint32_t i=0; i<n; i+=3) {
+      tree.insert(getKey<K>(i),TID{i+1,i});
+      reference[getKey<K>(i)] = TID{i+1,i};
+   }
+
+   // Delete some values
+   for (uint32_t i=0; i<n; ++i)
+      if ((i%7)==0) {
+         assert(tree.erase(getKey<K>(i)));
+         reference.erase(getKey<K>(i));
+      }
+
+   // Check if the right ones have been deleted
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      if ((i%7)==0) {
+         assert(!tree.lookup(getKey<K>(i),tid));
+         assert(!tree.erase(getKey<K>(i)));
+      } else {
+         assert(tree.lookup(getKey<K>(i),tid));
+         assert(tid==(i%3 == 0 ? TID{i+1,i} : TID{i,i}));
+      }
+   }
+   testRange(tree, reference, reference.begin()->first, reference.rbegin()->first);
+
+   // Delete everything
+   for (uint32_t i=0; i<n; ++i)
+      assert(tree.erase(getKey<K>(i)) == ((i%7)!=0));
+   reference.clear();
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(!tree.lookup(getKey<K>(i),tid));
+   }
+   testRange(tree, reference, getKey<K>(0), getKey<K>(n-1));
+
+   // the removed nodes are reused
+   for (uint32_t i=0; i<n; ++i)
+      tree.insert(getKey<K>(i),TID{i,i});
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(tree.lookup(getKey<K>(i),tid));
+      assert(tid==(TID{i,i}));
+   }
+}
+
+// Random keys grow and shrink nodes of all types, the tree is compared with
+// a std::map after every round
+void testRandom(uint64_t n) {
+   ART<uint64_t> tree;
+   std::map<uint64_t, TID> reference;
+   std::mt19937_64 rng(42);
+
+   for (unsigned round=0; round<4; ++round) {
+      // dense and sparse keys
+      uint64_t mask = (round%2 == 0) ? 0xFFFF : ~0ull;
+      for (uint64_t i=0; i<n; ++i) {
+         uint64_t key = rng() & mask;
+         uint32_t value = static_cast<uint32_t>(i);
+         if (rng()%3 == 0) {
+            assert(tree.erase(key) == (reference.erase(key) == 1));
+         } else {
+            tree.insert(key, TID{value,round});
+            reference[key] = TID{value,round};
+         }
+      }
+
+      for (auto& entry : reference) {
+         TID tid;
+         assert(tree.lookup(entry.first, tid));
+         assert(tid==entry.second);
+      }
+      testRange(tree, reference, 0ul, ~0ul);
+      for (unsigned i=0; i<10; ++i) {
+         uint64_t lo = rng() & mask;
+         uint64_t hi = lo + (rng() & mask)/8;
+         testRange(tree, reference, lo, hi);
+      }
+   }
+}
+
+// Inserts, looks up and erases disjoint keys from several threads at once
+void testConcurrent(uint64_t n) {
+   const unsigned threadCount = 4;
+   ART<uint64_t> tree;
+
+   // every thread inserts the keys k with k%threadCount == t, spread over
+   // the key space, and looks them up again
+   std::vector<std::thread> threads;
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&tree, n, t]() {
+         for (uint32_t i=t; i<n; i+=threadCount)
+            tree.insert(i*0x9E3779B97F4A7C15ull, TID{i,i});
+         for (uint32_t i=t; i<n; i+=threadCount) {
+            TID tid;
+            assert(tree.lookup(i*0x9E3779B97F4A7C15ull, tid));
+            assert(tid==(TID{i,i}));
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   // erase the even keys while other threads scan and look up the odd keys
+   threads.clear();
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&tree, n, t]() {
+         if (t%2 == 0) {
+            for (uint32_t i=t; i<n; i+=threadCount)
+               assert(tree.erase(i*0x9E3779B97F4A7C15ull));
+         } else {
+            for (uint32_t i=1; i<n; i+=2) {
+               TID tid;
+               assert(tree.lookup(i*0x9E3779B97F4A7C15ull, tid));
+            }
+            auto it = tree.lookupRange(0, ~0ull, t == 3);
+            uint64_t odd = 0;
+            while (it.next())
+               odd += it.getTID().pageID%2;
+            assert(odd == n/2);
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(tree.lookup(i*0x9E3779B97F4A7C15ull, tid) == (i%2 == 1));
+   }
+}
+
+int main(int argc, char* argv[]) {
+   // Get command line argument
+   const uint64_t n = (argc==2) ? strtoul(argv[1], NULL, 10) : 100000;
+
+   // Test index with 64bit unsigned and signed integers
+   test<uint64_t, std::less<uint64_t>>(n);
+   test<int64_t, std::less<int64_t>>(n);
+
+   // Test index with 20 character strings
+   test<Char<20>, CharLess<20>>(n);
+
+   // Test index with compound key
+   test<IntPair, MyCustomIntPairCmp>(n);
+
+   // Test growing and shrinking nodes
+   testRandom(n);
+
+   // Test concurrent access
+   testConcurrent(n);
+
+   std::cout << "TEST SUCCESSFUL!" << std::endl;
+   return EXIT_SUCCESS;
+}
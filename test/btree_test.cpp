@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <cstdint>
 #include <cassert>
@@ -5,12 +6,17 @@
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <functional>
+#include <random>
+#include <stdexcept>
 
 // DEBUG
 #include <iostream>
 
 #include "../src/BufferManager.hpp"
 #include "../src/BTree.hpp"
+#include "../src/MultiBTree.hpp"
 
 /* Comparator functor for uint64_t*/
 struct MyCustomUInt64Cmp {
@@ -19,19 +25,19 @@ struct MyCustomUInt64Cmp {
    }
 };
 
-template <unsigned len>
-struct Char {
-   char data[len];
-};
+/* Filter hash for uint64_t, keys equal by the comparator have equal bytes */
+template <>
+struct KeyHash<uint64_t, MyCustomUInt64Cmp> {
+   static const bool enabled = true;
 
-/* Comparator functor for char */
-template <unsigned len>
-struct MyCustomCharCmp {
-   bool operator()(const Char<len>& a, const Char<len>& b) const {
-      return memcmp(a.data, b.data, len) < 0;
+   static uint64_t hash(uint64_t key) {
+      return BloomFilter::hashBytes(&key, sizeof(key));
    }
 };
 
+/* Comparator functor for char without a normalizer */
+struct MyPlainCharCmp : CharLess<20> {};
+
 typedef std::pair<uint32_t, uint32_t> IntPair;
 
 /* Comparator for IntPair */
@@ -44,6 +50,22 @@ struct MyCustomIntPairCmp {
    }
 };
 
+/* Normalizer for IntPair */
+template <>
+struct KeyNormalizer<IntPair, MyCustomIntPairCmp> {
+   static const bool     enabled = true;
+   static const unsigned size    = 2*sizeof(uint32_t);
+
+   static void normalize(const IntPair& key, uint8_t* out) {
+      normalizeInteger(key.first, out);
+      normalizeInteger(key.second, out+sizeof(uint32_t));
+   }
+
+   static IntPair denormalize(const uint8_t* in) {
+      return std::make_pair(denormalizeInteger<uint32_t>(in), denormalizeInteger<uint32_t>(in+sizeof(uint32_t)));
+   }
+};
+
 template <class K>
 const K& getKey(const uint64_t& i);
 
@@ -60,6 +82,18 @@ const Char<20>& getKey(const uint64_t& i) {
    return *reinterpret_cast<const Char<20>*>(char20.back().data());
 }
 
+// strings of varying length, some of them long
+std::vector<std::string> strings;
+template <>
+const std::string& getKey(const uint64_t& i) {
+   std::stringstream ss;
+   ss << std::string(i%50, 'k') << i;
+   if (i%97 == 0)
+      ss << std::string(400, 'z');
+   strings.push_back(ss.str());
+   return strings.back();
+}
+
 std::vector<IntPair> intPairs;
 template <>
 const IntPair& getKey(const uint64_t& i) {
@@ -68,6 +102,39 @@ const IntPair& getKey(const uint64_t& i) {
 }
 
 
+// Checks that a range scan returns exactly the keys within [lo, hi] which
+// were not deleted, in order
+template<class K, class CMP>
+void testRange(BTree<K, CMP>& bTree, uint64_t n, uint64_t loIdx, uint64_t hiIdx, unsigned deletedMod) {
+   CMP less;
+   K lo = getKey<K>(loIdx);
+   K hi = getKey<K>(hiIdx);
+
+   unsigned expected = 0;
+   for (uint32_t i=0; i<n; ++i) {
+      K key = getKey<K>(i);
+      if (!less(key, lo) && !less(hi, key) && (deletedMod == 0 || i%deletedMod != 0))
+         expected++;
+   }
+
+   for (int reverse=0; reverse<2; ++reverse) {
+      auto it = bTree.lookupRange(lo, hi, reverse);
+      unsigned count = 0;
+      K last;
+      while (it.next()) {
+         K key = it.getKey();
+         TID tid = it.getTID();
+         assert(!less(key, lo) && !less(hi, key));
+         assert(!less(key, getKey<K>(tid.pageID)) && !less(getKey<K>(tid.pageID), key));
+         if (count > 0)
+            assert(reverse ? less(key, last) : less(last, key));
+         last = key;
+         count++;
+      }
+      assert(count == expected);
+   }
+}
+
 template<class K, class CMP>
 void test(uint64_t n) {
    // Set up stuff, you probably have to change something here to match to your interfaces
@@ -90,6 +157,10 @@ void test(uint64_t n) {
       assert(tid==(TID{i,i}));
    }
 
+   // Range scans
+   testRange(bTree, n, n/4, n/2, 0);
+   testRange(bTree, n, 0, n-1, 0);
+
    // Delete some values
    for (uint32_t i=0; i<n; ++i)
       if ((i%7)==0)
@@ -106,10 +177,518 @@ void test(uint64_t n) {
       }
    }
 
+   testRange(bTree, n, n/4, n/2, 7);
+
    // Delete everything
+   size_t pages = bTree.getSize();
    for (uint32_t i=0; i<n; ++i)
       bTree.erase(getKey<K>(i));
    //assert(bTree.size()==0);
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(!bTree.lookup(getKey<K>(i),tid));
+   }
+   testRange(bTree, n, 0, n-1, 1);
+
+   // Insert everything again, the pages of merged nodes are reused
+   for (uint32_t i=0; i<n; i+=2)
+      bTree.insert(getKey<K>(i),TID{i,i});
+   for (uint32_t i=1; i<n; i+=2)
+      bTree.insert(getKey<K>(i),TID{i,i});
+   assert(bTree.getSize() == pages);
+   testRange(bTree, n, 0, n-1, 0);
+}
+
+// Compares the specialized node search with std::lower_bound
+template<class T>
+void testNodeSearch() {
+   std::vector<T> keys;
+   for (unsigned n=0; n<300; n+=7) {
+      // keys with the sign bit set and duplicates
+      keys.clear();
+      for (unsigned i=0; i<n; ++i)
+         keys.push_back(static_cast<T>(i/2*3 - 100));
+      std::sort(keys.begin(), keys.end());
+
+      for (unsigned i=0; i<n*2+2; ++i) {
+         T key = static_cast<T>(i*3/2 - 101);
+         unsigned expected = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+         assert((NodeSearch<T, std::less<T>>::lowerBound(keys.data(), n, key)) == expected);
+      }
+   }
+}
+
+// Loads a tree from sorted entries and keeps using it afterwards
+template<class K, class CMP>
+void testBulkLoad(uint64_t n, double fillFactor) {
+   BufferManager bm(100);
+   BTree<K, CMP> bTree(bm, 2);
+
+   // every other key is loaded, the remaining ones are inserted later
+   std::vector<std::pair<K, TID>> entries;
+   for (uint32_t i=0; i<n; i+=2)
+      entries.push_back(std::make_pair(getKey<K>(i), TID{i,i}));
+   CMP less;
+   std::sort(entries.begin(), entries.end(),
+      [&less](const std::pair<K, TID>& a, const std::pair<K, TID>& b) { return less(a.first, b.first); });
+   bTree.bulkLoad(entries.begin(), entries.end(), fillFactor);
+
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(bTree.lookup(getKey<K>(i),tid) == (i%2 == 0));
+   }
+
+   for (uint32_t i=1; i<n; i+=2)
+      bTree.insert(getKey<K>(i),TID{i,i});
+
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(bTree.lookup(getKey<K>(i),tid));
+      assert(tid==(TID{i,i}));
+   }
+   testRange(bTree, n, 0, n-1, 0);
+
+   // a populated tree is not loaded again
+   bool thrown = false;
+   try {
+      bTree.bulkLoad(entries.begin(), entries.end(), fillFactor);
+   } catch (const std::logic_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+   testRange(bTree, n, 0, n-1, 0);
+}
+
+// Normalized keys are stored without their common prefix, so that more of
+// them fit into a leaf
+void testPrefixCompression(uint64_t n) {
+   std::vector<std::pair<Char<20>, TID>> entries;
+   for (uint32_t i=0; i<n; ++i)
+      entries.push_back(std::make_pair(getKey<Char<20>>(i), TID{i,i}));
+
+   size_t plainPages;
+   {
+      BufferManager bm(100);
+      BTree<Char<20>, MyPlainCharCmp> plainTree(bm, 2);
+      plainTree.bulkLoad(entries.begin(), entries.end());
+      plainPages = plainTree.getSize();
+   }
+
+   BufferManager bm(100);
+   BTree<Char<20>, CharLess<20>> prefixTree(bm, 2);
+   prefixTree.bulkLoad(entries.begin(), entries.end());
+   assert(prefixTree.getSize() < plainPages);
+
+   // keys with a shorter common prefix are inserted into the full leaves
+   for (uint32_t i=0; i<n; ++i) {
+      Char<20> key = getKey<Char<20>>(i);
+      key.data[0] = 'x';
+      prefixTree.insert(key, TID{i+1,i});
+   }
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(prefixTree.lookup(getKey<Char<20>>(i), tid));
+      assert(tid==(TID{i,i}));
+   }
+   auto it = prefixTree.lookupRange(getKey<Char<20>>(0), getKey<Char<20>>(n-1));
+   uint64_t count = 0;
+   while (it.next())
+      assert(it.getTID() == (TID{uint32_t(count),uint32_t(count)}) && ++count);
+   assert(count == n);
+}
+
+// Keys of varying size are stored densely, keys up to the maximum key size
+// are accepted
+void testVarKeys() {
+   // short keys use less space than keys padded to a fixed size
+   const uint32_t n = 10000;
+   size_t fixedPages;
+   {
+      BufferManager bm(100);
+      BTree<Char<20>, MyPlainCharCmp> fixedTree(bm, 2);
+      for (uint32_t i=0; i<n; ++i) {
+         Char<20> key = {};
+         std::string s = std::to_string(i);
+         memcpy(key.data, s.data(), s.size());
+         fixedTree.insert(key, TID{i,i});
+      }
+      fixedPages = fixedTree.getSize();
+   }
+
+   BufferManager bm(100);
+   BTree<std::string> bTree(bm, 2);
+   for (uint32_t i=0; i<n; ++i)
+      bTree.insert(std::to_string(i), TID{i,i});
+   assert(bTree.getSize() < fixedPages);
+
+   const size_t maxKeySize = blocksize/16;
+   for (uint32_t size=1; size<=maxKeySize; ++size)
+      bTree.insert(std::string(size, 'x'), TID{size,size});
+   for (uint32_t size=1; size<=maxKeySize; ++size) {
+      TID tid;
+      assert(bTree.lookup(std::string(size, 'x'), tid));
+      assert(tid==(TID{size,size}));
+   }
+
+   bool thrown = false;
+   try {
+      bTree.insert(std::string(maxKeySize+1, 'x'), TID{0,0});
+   } catch (const std::length_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(bTree.lookup(std::to_string(i), tid));
+      assert(tid==(TID{i,i}));
+   }
+}
+
+// Stores several entries per key, like a secondary index on a column with
+// few distinct values
+template<class K, class CMP>
+void testDuplicates(uint64_t n, uint64_t distinct) {
+   BufferManager bm(100);
+   MultiBTree<K, CMP> index(bm, 2);
+
+   for (uint32_t i=0; i<n; ++i)
+      index.insert(getKey<K>(i%distinct), TID{i,i});
+   index.insert(getKey<K>(0), TID{0,0}); // existing entry
+
+   // the entries of a key are returned in TID order
+   CMP less;
+   for (uint32_t k=0; k<distinct; ++k) {
+      for (int reverse=0; reverse<2; ++reverse) {
+         auto it = index.lookup(getKey<K>(k), reverse);
+         uint32_t count = 0;
+         while (it.next()) {
+            uint32_t i = reverse ? k + (n/distinct - 1 - count + (k < n%distinct)) * distinct : k + count*distinct;
+            assert(!less(it.getKey(), getKey<K>(k)) && !less(getKey<K>(k), it.getKey()));
+            assert(it.getTID()==(TID{i,i}));
+            count++;
+         }
+         assert(count == n/distinct + (k < n%distinct));
+      }
+   }
+
+   // erase every other entry of each key
+   for (uint32_t i=0; i<n; i+=2)
+      assert(index.erase(getKey<K>(i%distinct), TID{i,i}));
+   assert(!index.erase(getKey<K>(0), TID{0,0}));
+
+   auto it = index.lookupRange(getKey<K>(0), getKey<K>(distinct-1));
+   uint64_t count = 0;
+   while (it.next()) {
+      assert(it.getTID().pageID%2 == 1);
+      count++;
+   }
+   assert(count == n/2);
+}
+
+// Entries of a key with a normalizer share their prefix, which is stored once
+// per leaf
+void testPostingLists(uint64_t n) {
+   size_t plainPages;
+   {
+      BufferManager bm(100);
+      MultiBTree<Char<20>, MyPlainCharCmp> index(bm, 2);
+      for (uint32_t i=0; i<n; ++i)
+         index.insert(getKey<Char<20>>(i%10), TID{i,i});
+      plainPages = index.getSize();
+
+      // the leaves hold the entries only, without another TID, and are at
+      // least half full; some more pages are inner nodes
+      size_t perLeaf = blocksize / (sizeof(Char<20>) + sizeof(TID));
+      assert(plainPages <= 2*n/perLeaf * 11/10 + 1);
+      for (unsigned key=0; key<10; ++key) {
+         auto it = index.lookup(getKey<Char<20>>(key));
+         uint32_t i = key;
+         while (it.next()) {
+            assert(it.getTID() == (TID{i,i}));
+            i += 10;
+         }
+         assert(i >= n);
+      }
+   }
+
+   BufferManager bm(100);
+   MultiBTree<Char<20>, CharLess<20>> index(bm, 2);
+   for (uint32_t i=0; i<n; ++i)
+      index.insert(getKey<Char<20>>(i%10), TID{i,i});
+   assert(index.getSize() < plainPages/2);
+}
+
+// Opens a tree stored by another buffer manager, as after a restart
+template<class K, class CMP>
+void testReopen(uint64_t n) {
+   size_t pages;
+   {
+      BufferManager bm(100);
+      BTree<K, CMP> bTree(bm, 7);
+      for (uint32_t i=0; i<n; ++i)
+         bTree.insert(getKey<K>(i),TID{i,i});
+      for (uint32_t i=0; i<n; i+=2)
+         bTree.erase(getKey<K>(i));
+      pages = bTree.getSize();
+   }
+
+   BufferManager bm(100);
+   BTree<K, CMP> bTree(bm, 7, TreeMode::Open);
+   assert(bTree.getSize() == pages);
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(bTree.lookup(getKey<K>(i),tid) == (i%2 == 1));
+   }
+
+   // the tree keeps working, the stored free pages are reused
+   for (uint32_t i=1; i<n; i+=2)
+      assert(bTree.erase(getKey<K>(i)));
+   for (uint32_t i=0; i<n; ++i)
+      bTree.insert(getKey<K>(i),TID{i,i});
+   assert(bTree.getSize() == pages);
+   testRange(bTree, n, 0, n-1, 0);
+
+   // segments holding another kind of tree are rejected
+   bool thrown = false;
+   try {
+      BTree<Char<20>, MyPlainCharCmp> other(bm, 7, TreeMode::Open);
+   } catch (const std::runtime_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   // a flushed tree is opened while the object which stored it is alive
+   BTree<K, CMP> writer(bm, 12);
+   for (uint32_t i=0; i<n; ++i)
+      writer.insert(getKey<K>(i),TID{i,i});
+   for (uint32_t i=0; i<n; i+=2)
+      writer.erase(getKey<K>(i));
+   writer.flush();
+
+   BTree<K, CMP> reader(bm, 12, TreeMode::Open);
+   assert(reader.getSize() == writer.getSize());
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(reader.lookup(getKey<K>(i),tid) == (i%2 == 1));
+   }
+   testRange(reader, n, 0, n-1, 2);
+}
+
+template<class K, class CMP>
+void testBatch(uint64_t n) {
+   BufferManager bm(100);
+   BTree<K, CMP> bTree(bm, 8);
+   std::mt19937 rng(42);
+
+   // the even keys in random order, some of them are inserted twice and the
+   // later entry is kept
+   std::vector<std::pair<K, TID>> entries;
+   for (uint32_t i=0; i<n; i+=6)
+      entries.push_back(std::make_pair(getKey<K>(i), TID{i+1,i+1}));
+   std::shuffle(entries.begin(), entries.end(), rng);
+   size_t stale = entries.size();
+   for (uint32_t i=0; i<n; i+=2)
+      entries.push_back(std::make_pair(getKey<K>(i), TID{i,i}));
+   std::shuffle(entries.begin()+stale, entries.end(), rng);
+   bTree.insertBatch(entries);
+
+   // all keys in random order, some of them twice
+   std::vector<K> keys;
+   std::vector<uint32_t> idx;
+   for (uint32_t i=0; i<n; ++i)
+      idx.push_back(i);
+   for (uint32_t i=0; i<n; i+=5)
+      idx.push_back(i);
+   std::shuffle(idx.begin(), idx.end(), rng);
+   for (uint32_t i : idx)
+      keys.push_back(getKey<K>(i));
+
+   std::vector<TID> tids;
+   std::vector<bool> found;
+   size_t count = bTree.lookupBatch(keys, tids, found);
+   size_t expected = 0;
+   for (size_t i=0; i<idx.size(); ++i) {
+      assert(found[i] == (idx[i]%2 == 0));
+      if (found[i])
+         assert(tids[i]==(TID{idx[i],idx[i]}));
+      expected += found[i];
+   }
+   assert(count == expected);
+
+   // the odd keys are inserted in small batches into the existing leaves
+   entries.clear();
+   for (uint32_t i=1; i<n; i+=2)
+      entries.push_back(std::make_pair(getKey<K>(i), TID{i,i}));
+   std::shuffle(entries.begin(), entries.end(), rng);
+   for (size_t i=0; i<entries.size(); i+=100)
+      bTree.insertBatch(std::vector<std::pair<K, TID>>(entries.begin()+i,
+         entries.begin()+std::min(i+100, entries.size())));
+
+   assert(bTree.lookupBatch(keys, tids, found) == idx.size());
+   for (size_t i=0; i<idx.size(); ++i)
+      assert(found[i] && tids[i]==(TID{idx[i],idx[i]}));
+   testRange(bTree, n, 0, n-1, 0);
+
+   // empty batches do nothing
+   bTree.insertBatch(std::vector<std::pair<K, TID>>());
+   assert(bTree.lookupBatch(std::vector<K>(), tids, found) == 0);
+   assert(tids.empty() && found.empty());
+}
+
+// Lookups of keys which were never inserted are answered by the filter
+template<class K, class CMP>
+void testFilter(uint64_t n) {
+   // counts the keys the filter can not tell apart from inserted ones
+   auto falsePositives = [n](BloomFilter& filter, uint32_t from) {
+      uint64_t count = 0;
+      for (uint32_t i=from; i<n; i+=2)
+         count += filter.mayContain(KeyHash<K, CMP>::hash(getKey<K>(i)));
+      return count;
+   };
+
+   uint64_t fp;
+   {
+      BufferManager bm(100);
+      BloomFilter filter(bm, 10, n);
+      BTree<K, CMP> bTree(bm, 9, TreeMode::Create, &filter);
+
+      // the even keys are inserted, some of them in a batch
+      for (uint32_t i=0; i<n/2; i+=2)
+         bTree.insert(getKey<K>(i),TID{i,i});
+      std::vector<std::pair<K, TID>> entries;
+      for (uint32_t i=n/2+(n/2)%2; i<n; i+=2)
+         entries.push_back(std::make_pair(getKey<K>(i), TID{i,i}));
+      bTree.insertBatch(entries);
+
+      fp = falsePositives(filter, 1);
+      assert(fp <= n/100 + 1);
+      for (uint32_t i=0; i<n; ++i) {
+         TID tid;
+         assert(bTree.lookup(getKey<K>(i),tid) == (i%2 == 0));
+      }
+
+      // erased keys are still in the filter
+      for (uint32_t i=0; i<n; i+=4)
+         assert(bTree.erase(getKey<K>(i)));
+      std::vector<K> keys;
+      std::vector<TID> tids;
+      std::vector<bool> found;
+      for (uint32_t i=0; i<n; ++i)
+         keys.push_back(getKey<K>(i));
+      assert(bTree.lookupBatch(keys, tids, found) == (n+1)/4);
+      for (uint32_t i=0; i<n; ++i)
+         assert(found[i] == (i%4 == 2) && (!found[i] || tids[i]==(TID{i,i})));
+   }
+
+   // the filter is stored with the tree
+   BufferManager bm(100);
+   {
+      BloomFilter filter(bm, 10, 0, TreeMode::Open);
+      BTree<K, CMP> bTree(bm, 9, TreeMode::Open, &filter);
+      assert(falsePositives(filter, 1) == fp);
+      for (uint32_t i=0; i<n; ++i) {
+         TID tid;
+         assert(bTree.lookup(getKey<K>(i),tid) == (i%4 == 2));
+      }
+   }
+
+   // a bulk load rebuilds the filter
+   {
+      BloomFilter filter(bm, 10, 0, TreeMode::Open);
+      BTree<K, CMP> bTree(bm, 9, TreeMode::Create, &filter);
+      std::vector<std::pair<K, TID>> entries;
+      for (uint32_t i=1; i<n; i+=2)
+         entries.push_back(std::make_pair(getKey<K>(i), TID{i,i}));
+      CMP less;
+      std::sort(entries.begin(), entries.end(),
+         [&less](const std::pair<K, TID>& a, const std::pair<K, TID>& b) { return less(a.first, b.first); });
+      bTree.bulkLoad(entries.begin(), entries.end());
+
+      assert(falsePositives(filter, 0) <= n/100 + 1);
+      for (uint32_t i=0; i<n; ++i) {
+         TID tid;
+         assert(bTree.lookup(getKey<K>(i),tid) == (i%2 == 1));
+      }
+   }
+
+   // segments holding something else are rejected
+   bool thrown = false;
+   try {
+      BloomFilter other(bm, 9, 0, TreeMode::Open);
+   } catch (const std::runtime_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   // keys which can not be hashed are not filtered
+   thrown = false;
+   try {
+      BloomFilter filter(bm, 10, 0, TreeMode::Open);
+      BTree<Char<20>, MyPlainCharCmp> other(bm, 11, TreeMode::Create, &filter);
+   } catch (const std::invalid_argument&) {
+      thrown = true;
+   }
+   assert(thrown);
+}
+
+// Inserts, looks up and erases disjoint keys from several threads at once
+void testConcurrent(uint64_t n) {
+   const unsigned threadCount = 4;
+
+   BufferManager bm(100);
+   BTree<uint64_t, MyCustomUInt64Cmp> bTree(bm, 3);
+
+   // every thread inserts the keys k with k%threadCount == t and looks them
+   // up again while the other threads keep splitting nodes
+   std::vector<std::thread> threads;
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&bTree, n, t]() {
+         for (uint32_t i=t; i<n; i+=threadCount)
+            bTree.insert(i, TID{i,i});
+         for (uint32_t i=t; i<n; i+=threadCount) {
+            TID tid;
+            assert(bTree.lookup(i, tid));
+            assert(tid==(TID{i,i}));
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   auto it = bTree.lookupRange(0, n-1);
+   uint64_t count = 0;
+   while (it.next())
+      assert(it.getKey() == count++);
+   assert(count == n);
+
+   // erase the even keys while other threads scan and look up the odd keys
+   threads.clear();
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&bTree, n, t]() {
+         if (t%2 == 0) {
+            for (uint32_t i=t; i<n; i+=threadCount)
+               assert(bTree.erase(i));
+         } else {
+            for (uint64_t i=1; i<n; i+=2) {
+               TID tid;
+               assert(bTree.lookup(i, tid));
+            }
+            auto it = bTree.lookupRange(0, n-1, true);
+            uint64_t odd = 0;
+            while (it.next())
+               odd += it.getKey()%2;
+            assert(odd == n/2);
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   for (uint64_t i=0; i<n; ++i) {
+      TID tid;
+      assert(bTree.lookup(i, tid) == (i%2 == 1));
+   }
 }
 
 int main(int argc, char* argv[]) {
@@ -119,12 +698,58 @@ int main(int argc, char* argv[]) {
    // Test index with 64bit unsigned integers
    test<uint64_t, MyCustomUInt64Cmp>(n);
 
+   // Test index with the integer key search
+   testNodeSearch<uint64_t>();
+   testNodeSearch<int64_t>();
+   testNodeSearch<uint32_t>();
+   testNodeSearch<int32_t>();
+   test<uint64_t, std::less<uint64_t>>(n);
+
    // Test index with 20 character strings
-   test<Char<20>, MyCustomCharCmp<20>>(n);
+   test<Char<20>, CharLess<20>>(n);
+
+   // Test index with strings of varying length
+   test<std::string, std::less<std::string>>(n);
+   testVarKeys();
 
    // Test index with compound key
    test<IntPair, MyCustomIntPairCmp>(n);
 
+   // Test bulk loading
+   testBulkLoad<uint64_t, MyCustomUInt64Cmp>(n, 1.0);
+   testBulkLoad<Char<20>, CharLess<20>>(n, 0.7);
+   testBulkLoad<IntPair, MyCustomIntPairCmp>(n, 0.5);
+   testBulkLoad<std::string, std::less<std::string>>(n, 0.8);
+   testBulkLoad<uint64_t, MyCustomUInt64Cmp>(100, 1.0);
+
+   // Test prefix compression of normalized keys
+   testPrefixCompression(n);
+
+   // Test duplicate keys
+   testDuplicates<uint64_t, MyCustomUInt64Cmp>(n, 7);
+   testDuplicates<Char<20>, CharLess<20>>(n, 10);
+   testPostingLists(n);
+
+   // Test reopening stored trees
+   testReopen<uint64_t, MyCustomUInt64Cmp>(n);
+   testReopen<std::string, std::less<std::string>>(n);
+   // more free pages than the metadata page holds
+   testReopen<std::string, std::less<std::string>>(10*n);
+
+   // Test batched inserts and lookups
+   testBatch<uint64_t, MyCustomUInt64Cmp>(n);
+   testBatch<Char<20>, CharLess<20>>(n);
+   testBatch<std::string, std::less<std::string>>(n);
+
+   // Test filtering lookups of missing keys
+   testFilter<uint64_t, MyCustomUInt64Cmp>(n);
+   testFilter<uint64_t, std::less<uint64_t>>(n);
+   testFilter<Char<20>, CharLess<20>>(n);
+   testFilter<std::string, std::less<std::string>>(n);
+
+   // Test concurrent access
+   testConcurrent(n);
+
    std::cout << "TEST SUCCESSFUL!" << std::endl;
    return EXIT_SUCCESS;
 }
@@ -0,0 +1,282 @@
+#include <cassert>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+// DEBUG
+#include <iostream>
+
+#include "../src/BufferManager.hpp"
+#include "../src/HashIndex.hpp"
+
+template <unsigned len>
+struct Char {
+   char data[len];
+};
+
+/* Hash functor for char */
+template <unsigned len>
+struct MyCustomCharHash {
+   size_t operator()(const Char<len>& key) const {
+      return std::hash<std::string>()(std::string(key.data, len));
+   }
+};
+
+/* Equality functor for char */
+template <unsigned len>
+struct MyCustomCharEqual {
+   bool operator()(const Char<len>& a, const Char<len>& b) const {
+      return memcmp(a.data, b.data, len) == 0;
+   }
+};
+
+/* Hash functor which maps all keys to few hashes */
+struct MyBadUInt64Hash {
+   size_t operator()(uint64_t key) const {
+      return key%3;
+   }
+};
+
+template <class K>
+K getKey(uint64_t i);
+
+template <>
+uint64_t getKey(uint64_t i) { return i; }
+
+template <>
+Char<20> getKey(uint64_t i) {
+   std::stringstream ss;
+   ss << i;
+   std::string s(std::string(20-ss.str().size(), '0')+ss.str());
+   Char<20> key;
+   memcpy(key.data, s.data(), 20);
+   return key;
+}
+
+template <class K, class HASH, class EQUAL>
+void test(uint64_t n) {
+   BufferManager bm(100);
+   HashIndex<K, HASH, EQUAL> index(bm, 4);
+
+   // Insert values
+   for (uint32_t i=0; i<n; ++i)
+      index.insert(getKey<K>(i),TID{i,i});
+
+   // Check if they can be retrieved
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(index.lookup(getKey<K>(i),tid));
+      assert(tid==(TID{i,i}));
+   }
+
+   // the buckets are split one at a time and are at least a quarter full,
+   // the first page holds the metadata
+   size_t perPage = blocksize / (sizeof(K) + sizeof(TID) + sizeof(uint32_t));
+   assert(index.getSize() <= 4*n/perPage + 2);
+
+   // Overwrite every third value
+   for (uint32_t i=0; i<n; i+=3)
+      index.insert(getKey<K>(i),TID{i+1,i});
+
+   // Delete some values
+   for (uint32_t i=0; i<n; ++i)
+      if ((i%7)==0)
+         assert(index.erase(getKey<K>(i)));
+
+   // Check if the right ones have been deleted
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      if ((i%7)==0) {
+         assert(!index.lookup(getKey<K>(i),tid));
+         assert(!index.erase(getKey<K>(i)));
+      } else {
+         assert(index.lookup(getKey<K>(i),tid));
+         assert(tid==(i%3 == 0 ? TID{i+1,i} : TID{i,i}));
+      }
+   }
+
+   // Delete everything
+   for (uint32_t i=0; i<n; ++i)
+      assert(index.erase(getKey<K>(i)) == ((i%7)!=0));
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(!index.lookup(getKey<K>(i),tid));
+   }
+}
+
+// More keys with the same hash than fit into a bucket are rejected
+void testCollisions() {
+   BufferManager bm(100);
+   HashIndex<uint64_t, MyBadUInt64Hash> index(bm, 5);
+
+   bool thrown = false;
+   uint32_t i = 0;
+   try {
+      for (; i<blocksize; ++i)
+         index.insert(i, TID{i,i});
+   } catch (const std::overflow_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   // the index keeps working
+   for (uint32_t j=0; j<i; ++j) {
+      TID tid;
+      assert(index.lookup(j, tid));
+      assert(tid==(TID{j,j}));
+   }
+}
+
+// Opens an index stored by another buffer manager, as after a restart
+template <class K, class HASH, class EQUAL>
+void testReopen(uint64_t n) {
+   size_t pages;
+   {
+      BufferManager bm(100);
+      HashIndex<K, HASH, EQUAL> index(bm, 7);
+      for (uint32_t i=0; i<n; ++i)
+         index.insert(getKey<K>(i),TID{i,i});
+      for (uint32_t i=0; i<n; i+=2)
+         assert(index.erase(getKey<K>(i)));
+      // the directory pages are allocated by the first flush
+      index.flush();
+      pages = index.getSize();
+   }
+
+   BufferManager bm(100);
+   {
+      HashIndex<K, HASH, EQUAL> index(bm, 7, TreeMode::Open);
+      assert(index.getSize() == pages);
+      for (uint32_t i=0; i<n; ++i) {
+         TID tid;
+         if (i%2 == 1) {
+            assert(index.lookup(getKey<K>(i),tid));
+            assert(tid==(TID{i,i}));
+         } else {
+            assert(!index.lookup(getKey<K>(i),tid));
+         }
+      }
+
+      // the index keeps working, the buckets are split further
+      for (uint32_t i=0; i<2*n; ++i)
+         index.insert(getKey<K>(i),TID{i+1,i});
+      for (uint32_t i=0; i<2*n; ++i) {
+         TID tid;
+         assert(index.lookup(getKey<K>(i),tid));
+         assert(tid==(TID{i+1,i}));
+      }
+   }
+
+   // the directory written over the old one is read back
+   {
+      HashIndex<K, HASH, EQUAL> index(bm, 7, TreeMode::Open);
+      for (uint32_t i=0; i<2*n; ++i) {
+         TID tid;
+         assert(index.lookup(getKey<K>(i),tid));
+         assert(tid==(TID{i+1,i}));
+      }
+   }
+
+   // segments holding an index with another key size are rejected
+   bool thrown = false;
+   try {
+      HashIndex<Char<20>, MyCustomCharHash<20>, MyCustomCharEqual<20>> other(bm, 7, TreeMode::Open);
+   } catch (const std::runtime_error&) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   // a flushed index is opened while the object which stored it is alive,
+   // the directory grows onto more pages between the flushes
+   HashIndex<K, HASH, EQUAL> writer(bm, 8);
+   for (uint32_t round=1; round<=2; ++round) {
+      uint32_t count = round == 1 ? n : 4*n;
+      for (uint32_t i=0; i<count; ++i)
+         writer.insert(getKey<K>(i),TID{i,round});
+      writer.flush();
+
+      HashIndex<K, HASH, EQUAL> reader(bm, 8, TreeMode::Open);
+      assert(reader.getSize() == writer.getSize());
+      for (uint32_t i=0; i<count; ++i) {
+         TID tid;
+         assert(reader.lookup(getKey<K>(i),tid));
+         assert(tid==(TID{i,round}));
+      }
+   }
+}
+
+// Inserts, looks up and erases disjoint keys from several threads at once
+void testConcurrent(uint64_t n) {
+   const unsigned threadCount = 4;
+
+   BufferManager bm(100);
+   HashIndex<uint64_t> index(bm, 6);
+
+   // every thread inserts the keys k with k%threadCount == t and looks them
+   // up again while the other threads keep splitting buckets
+   std::vector<std::thread> threads;
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&index, n, t]() {
+         for (uint32_t i=t; i<n; i+=threadCount)
+            index.insert(i, TID{i,i});
+         for (uint32_t i=t; i<n; i+=threadCount) {
+            TID tid;
+            assert(index.lookup(i, tid));
+            assert(tid==(TID{i,i}));
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   // erase the even keys while other threads look up the odd keys
+   threads.clear();
+   for (unsigned t=0; t<threadCount; ++t) {
+      threads.push_back(std::thread([&index, n, t]() {
+         if (t%2 == 0) {
+            for (uint32_t i=t; i<n; i+=threadCount)
+               assert(index.erase(i));
+         } else {
+            for (uint32_t i=1; i<n; i+=2) {
+               TID tid;
+               assert(index.lookup(i, tid));
+            }
+         }
+      }));
+   }
+   for (auto& thread : threads)
+      thread.join();
+
+   for (uint32_t i=0; i<n; ++i) {
+      TID tid;
+      assert(index.lookup(i, tid) == (i%2 == 1));
+   }
+}
+
+int main(int argc, char* argv[]) {
+   // Get command line argument
+   const uint64_t n = (argc==2) ? strtoul(argv[1], NULL, 10) : 100000;
+
+   // Test index with 64bit unsigned integers
+   test<uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>>(n);
+
+   // Test index with 20 character strings
+   test<Char<20>, MyCustomCharHash<20>, MyCustomCharEqual<20>>(n);
+
+   // Test keys with colliding hashes
+   testCollisions();
+
+   // Test reopening stored indexes
+   testReopen<uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>>(n);
+
+   // Test concurrent access
+   testConcurrent(n);
+
+   std::cout << "TEST SUCCESSFUL!" << std::endl;
+   return EXIT_SUCCESS;
+}
@@ -3,12 +3,16 @@
 #include <iostream>
 #include <string>
 
+#include "../src/operators/ColumnScan.hpp"
 #include "../src/operators/HashJoin.hpp"
+#include "../src/operators/PAXScan.hpp"
 #include "../src/operators/Print.hpp"
 #include "../src/operators/Projection.hpp"
 #include "../src/operators/Selection.hpp"
 #include "../src/operators/TableScan.hpp"
 #include "../src/BufferManager.hpp"
+#include "../src/ColumnSegment.hpp"
+#include "../src/PAXSegment.hpp"
 #include "../src/Register.hpp"
 #include "../src/Schema.hpp"
 #include "../src/SPSegment.hpp"
@@ -62,6 +66,7 @@ int main(int argc, char* argv[]) {
     rel.attributes.push_back(attr3);
 
     // Fill Relation with some values
+    PAXSegment    pax(bm, 2, rel);
     const size_t  recordSize  = 2*sizeof(int64_t)+32;
     const int64_t recordCount = 10;
     for (int64_t i = 0; i < recordCount; ++i) {
@@ -75,6 +80,7 @@ int main(int argc, char* argv[]) {
         memset(namePtr, '\0', 32);
         strcpy(namePtr, names[i%names.size()].c_str());
         sp.insert(Record(recordSize, data));
+        pax.insert(Record(recordSize, data));
     }
 
     // Test TableScan
@@ -95,6 +101,73 @@ int main(int argc, char* argv[]) {
     assert(j == recordCount);
     ts.close();
 
+    // Test TableScan with a range predicate on a time-ordered relation, whose
+    // pages are skipped by their zone maps
+    SPSegment             zsp(bm, 4);
+    const int64_t         zoneRecords = 5000;
+    std::vector<char>     zoneData(zoneRecords*recordSize, '\0');
+    std::vector<unsigned> zoneLens(zoneRecords, recordSize);
+    for (int64_t i = 0; i < zoneRecords; ++i) {
+        int64_t* intPtr = reinterpret_cast<int64_t*>(&zoneData[i*recordSize]);
+        intPtr[0] = i;
+        intPtr[1] = i % 7;
+    }
+    zsp.insert(Record(recordSize, zoneData.data()));
+    zsp.summarize({0, sizeof(int64_t)});
+    std::vector<TID> zoneTIDs = zsp.insertBatch(zoneData.data()+recordSize, zoneLens.data(), zoneRecords-1);
+
+    const ZoneMap& zm = zsp.getZoneMap();
+    assert(zm.find(0) == 0 && zm.find(sizeof(int64_t)) == 1 && zm.find(1) == -1);
+    assert(zm.getMin(0, 0) == 0 && zm.getMax(0, 0) == 0 && zm.getMax(1, 1) == 6);
+    size_t zonePages = 0;
+    for (uint32_t pageID = 0; pageID < zsp.getSize(); ++pageID) {
+        if (zm.mayContain(pageID, 0, 1000, 1009)) {
+            zonePages++;
+        }
+    }
+    assert(zsp.getSize() > 10 && zonePages <= 2);
+
+    // an update widens the zone of its page
+    std::vector<char> moved(zoneData.begin(), zoneData.begin()+recordSize);
+    *reinterpret_cast<int64_t*>(moved.data()) = 1005;
+    TID last = zoneTIDs.back();
+    assert(zsp.update(last, Record(recordSize, moved.data())));
+    assert(zm.getMax(last.pageID, 0) == zoneRecords-1 && zm.getMin(last.pageID, 0) <= 1005);
+
+    TableScan zts(rel, zsp, 0, 1000, 1009);
+    zts.open();
+    j = 0;
+    while (zts.next()) {
+        vector<Register*> regs = zts.getOutput();
+        int64_t value = regs[0]->getInteger();
+        assert(value >= 1000 && value <= 1009);
+        j++;
+    }
+    assert(j == 11);
+    zts.close();
+
+    // pages which were never summarized are not skipped
+    assert(zm.mayContain(zsp.getSize()+5, 0, 1000, 1009));
+
+    // the zones are rebuilt when the segment is opened again
+    {
+        SPSegment reopened(bm, 4, zsp.getSize(), {0, sizeof(int64_t)});
+        const ZoneMap& rzm = reopened.getZoneMap();
+        for (uint32_t pageID = 0; pageID < zsp.getSize(); ++pageID) {
+            assert(rzm.getMin(pageID, 0) == zm.getMin(pageID, 0));
+            assert(rzm.getMax(pageID, 1) == zm.getMax(pageID, 1));
+        }
+
+        TableScan rts(rel, reopened, 0, 1000, 1009);
+        rts.open();
+        j = 0;
+        while (rts.next()) {
+            j++;
+        }
+        assert(j == 11);
+        rts.close();
+    }
+
     // Test Print
     Print prt(ts, std::cout);
     prt.open();
@@ -154,6 +227,106 @@ int main(int argc, char* argv[]) {
     prthj.close();
     std::cout << std::endl;
 
+    // Test PAXScan
+    PAXScan ps(rel, pax);
+    ps.open();
+    j = 0;
+    while (ps.next()) {
+        vector<Register*> regs = ps.getOutput();
+        assert(regs.size() == 3);
+        assert(regs[0]->getInteger() == j);
+        assert(regs[1]->getInteger() == recordCount-1-j);
+        assert(regs[2]->getString().compare(names[j%names.size()]) == 0);
+        j++;
+    }
+    assert(j == recordCount);
+    ps.close();
+
+    // Test PAXScan reading only some attributes, after removing a tuple
+    Record rec = pax.lookup(TID{0, 3});
+    assert(rec.getLen() == recordSize);
+    assert(*reinterpret_cast<const int64_t*>(rec.getData()) == 3);
+    assert(pax.remove(TID{0, 3}));
+    assert(!pax.remove(TID{0, 3}));
+
+    std::vector<unsigned> paxIDs;
+    paxIDs.push_back(2);
+    paxIDs.push_back(0);
+    PAXScan ps2(rel, pax, paxIDs);
+    ps2.open();
+    j = 0;
+    while (ps2.next()) {
+        if (j == 3) {
+            j++;
+        }
+        vector<Register*> regs = ps2.getOutput();
+        assert(regs.size() == 2);
+        assert(regs[0]->getString().compare(names[j%names.size()]) == 0);
+        assert(regs[1]->getInteger() == j);
+        j++;
+    }
+    assert(j == recordCount);
+    ps2.close();
+
+    // Test ColumnScan over a column segment with many rows
+    ColumnSegment cs(bm, 3, rel);
+    const int64_t columnRows = 100000;
+    std::vector<char> rows(columnRows*recordSize, '\0');
+    for (int64_t i = 0; i < columnRows; ++i) {
+        char* row = &rows[i*recordSize];
+        int64_t* intPtr = reinterpret_cast<int64_t*>(row);
+        intPtr[0] = 1000000 + i;   // bit-packed
+        intPtr[1] = i / 1000;      // run-length encoded
+        strcpy(row+2*sizeof(int64_t), names[i%names.size()].c_str()); // dictionary
+    }
+    cs.append(rows.data(), columnRows);
+    assert(cs.getRowCount() == columnRows);
+    assert(cs.getSize() < columnRows*recordSize/blocksize/4);
+
+    ColumnScan cscan(cs, {2, 1, 0});
+    cscan.open();
+    j = 0;
+    while (cscan.next()) {
+        vector<Register*> regs = cscan.getOutput();
+        assert(regs.size() == 3);
+        assert(regs[0]->getString().compare(names[j%names.size()]) == 0);
+        assert(regs[1]->getInteger() == j / 1000);
+        assert(regs[2]->getInteger() == 1000000 + j);
+        j++;
+    }
+    assert(j == columnRows);
+    cscan.close();
+
+    // the column segment is opened again from its metadata
+    cs.append(rows.data(), 10);
+    {
+        ColumnSegment reopened(bm, 3, rel, TreeMode::Open);
+        assert(reopened.getRowCount() == columnRows+10 && reopened.getSize() == cs.getSize());
+        for (unsigned attr = 0; attr < 3; ++attr)
+            assert(reopened.getBlockCount(attr) == cs.getBlockCount(attr));
+
+        ColumnScan rscan(reopened, {0, 2});
+        rscan.open();
+        j = 0;
+        while (rscan.next()) {
+            vector<Register*> regs = rscan.getOutput();
+            assert(regs[0]->getInteger() == 1000000 + j%columnRows);
+            assert(regs[1]->getString().compare(names[j%columnRows%names.size()]) == 0);
+            j++;
+        }
+        assert(j == columnRows+10);
+        rscan.close();
+    }
+
+    // segments holding other columns are rejected
+    bool thrown = false;
+    try {
+        ColumnSegment other(bm, 4, rel, TreeMode::Open);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
     std::cout << "TEST SUCCESSFUL!" << std::endl;
     return EXIT_SUCCESS;
 }
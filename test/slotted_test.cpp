@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <cstdint>
 #include <cassert>
 #include <string.h>
+#include <thread>
 
 #include "../src/SPSegment.hpp"
 
@@ -41,6 +43,37 @@ int main(int argc, char** argv) {
    unordered_map<TID, unsigned> values; // TID -> testData entry
    unordered_map<unsigned, size_t> usage; // pageID -> bytes used within this page
 
+   // Free space inventory at the boundaries of the fill classes
+   {
+      FreeSpaceInventory fsi;
+      uint32_t pageID;
+      assert(!fsi.find(1, pageID));
+
+      fsi.update(0, 32);
+      fsi.update(1, 47);
+      fsi.update(2, 48);
+      assert(fsi.find(0, pageID));
+      assert(fsi.find(32, pageID) && fsi.find(16, pageID));
+      // page 1 would have room, but only the classes from 48 bytes on are searched
+      assert(fsi.find(33, pageID) && pageID == 2);
+      assert(fsi.find(48, pageID) && pageID == 2);
+      assert(!fsi.find(49, pageID));
+
+      // pages move between the classes
+      fsi.update(2, 15);
+      assert(!fsi.find(33, pageID));
+      fsi.update(1, 64);
+      assert(fsi.find(64, pageID) && pageID == 1);
+      assert(!fsi.find(blocksize, pageID));
+      fsi.update(3, blocksize);
+      assert(fsi.find(blocksize, pageID) && pageID == 3);
+
+      // truncated pages are forgotten
+      fsi.truncate(2);
+      assert(!fsi.find(65, pageID));
+      assert(fsi.find(64, pageID) && pageID == 1);
+   }
+
    // Setting everything
    BufferManager bm(100);
    SPSegment sp(bm, 1);
@@ -137,6 +170,340 @@ int main(int argc, char** argv) {
       Record rec = sp.lookup(tid);
       assert(rec.getLen() == len);
       assert(memcmp(rec.getData(), value.c_str(), len)==0);
+
+      // zero-copy lookup
+      RecordView view = sp.lookupView(tid);
+      assert(view.getLen() == len);
+      assert(memcmp(view.getData(), value.c_str(), len)==0);
+   }
+
+   // Batched lookups
+   {
+      vector<TID> tids;
+      vector<unsigned> expected;
+      for (auto p : values) {
+         tids.push_back(p.first);
+         expected.push_back(p.second);
+      }
+
+      vector<bool> seen(tids.size(), false);
+      sp.lookupBatch(tids.data(), tids.size(), [&](size_t i, const char* data, uint64_t len) {
+         const std::string& value = testData[expected[i]];
+         assert(!seen[i]);
+         assert(len == value.size());
+         assert(memcmp(data, value.c_str(), len)==0);
+         seen[i] = true;
+      });
+      for (bool s : seen)
+         assert(s);
+   }
+
+   // Scans with the segment iterators
+   {
+      vector<unsigned> expected(testData.size(), 0);
+      for (auto p : values)
+         expected[p.second]++;
+
+      SPSegment::TupleIterator it(sp);
+      unsigned count = 0;
+      while (it.next()) {
+         string value(it.getData(), it.getLen());
+         unsigned i = find(testData.begin(), testData.end(), value) - testData.begin();
+         assert(i < testData.size() && expected[i] > 0);
+         expected[i]--;
+         count++;
+      }
+      assert(count == values.size());
+
+      // pages rejected by the filter are skipped
+      SPSegment::PageIterator pit(sp, 4, [](uint32_t pageID) { return pageID % 2 == 0; });
+      unsigned pages = 0;
+      while (pit.next()) {
+         assert(pit.getPageID() == 2*pages);
+         pages++;
+      }
+      assert(pages == (sp.getSize()+1)/2);
+   }
+
+   // Bulk load into a second segment
+   {
+      SPSegment bulk(bm, 2);
+      const unsigned batchSize = 10000;
+
+      string buffer;
+      vector<unsigned> lens;
+      vector<unsigned> picks;
+      for (unsigned i=0; i<batchSize; ++i) {
+         uint64_t r = rnd.next()%testData.size();
+         buffer += testData[r];
+         lens.push_back(testData[r].size());
+         picks.push_back(r);
+      }
+
+      vector<TID> tids = bulk.insertBatch(buffer.data(), lens.data(), batchSize);
+      assert(tids.size() == batchSize);
+      for (unsigned i=0; i<batchSize; ++i) {
+         const string& value = testData[picks[i]];
+         Record rec = bulk.lookup(tids[i]);
+         assert(rec.getLen() == value.size());
+         assert(memcmp(rec.getData(), value.c_str(), value.size())==0);
+      }
+
+      // regular inserts, removes and updates still work on bulk loaded pages
+      assert(bulk.remove(tids[0]));
+      TID tid = bulk.insert(Record(testData[0].size(), testData[0].c_str()));
+      assert(bulk.update(tid, Record(testData[3].size(), testData[3].c_str())));
+      Record rec = bulk.lookup(tid);
+      assert(rec.getLen() == testData[3].size());
+      assert(memcmp(rec.getData(), testData[3].c_str(), rec.getLen())==0);
+   }
+
+   // Records larger than a page
+   {
+      SPSegment large(bm, 3);
+      string big(5*pageSize, 'x');
+      for (unsigned i=0; i<big.size(); ++i)
+         big[i] = 'a' + (i%26);
+
+      TID tid = large.insert(Record(big.size(), big.c_str()));
+      TID small = large.insert(Record(testData[0].size(), testData[0].c_str()));
+      Record rec = large.lookup(tid);
+      assert(rec.getLen() == big.size());
+      assert(memcmp(rec.getData(), big.c_str(), big.size())==0);
+
+      // shrink and grow again
+      assert(large.update(tid, Record(testData[1].size(), testData[1].c_str())));
+      RecordView view = large.lookupView(tid);
+      assert(view.getLen() == testData[1].size());
+      assert(memcmp(view.getData(), testData[1].c_str(), view.getLen())==0);
+      view.release();
+
+      assert(large.update(tid, Record(big.size(), big.c_str())));
+      TID tids[] = {tid, small};
+      large.lookupBatch(tids, 2, [&](size_t i, const char* data, uint64_t len) {
+         const string& value = (i == 0) ? big : testData[0];
+         assert(len == value.size());
+         assert(memcmp(data, value.c_str(), len)==0);
+      });
+
+      // scans read the overflow pages only as far as the data is asked for
+      SPSegment::TupleIterator it(large);
+      unsigned records = 0;
+      while (it.next()) {
+         const string& value = (it.getTID() == tid) ? big : testData[0];
+         assert(it.getLen() == value.size());
+         assert(memcmp(it.getPrefix(10), value.c_str(), 10)==0);
+         assert(memcmp(it.getPrefix(pageSize+10), value.c_str(), min<size_t>(pageSize+10, value.size()))==0);
+         assert(memcmp(it.getData(), value.c_str(), value.size())==0);
+         records++;
+      }
+      assert(records == 2);
+
+      assert(large.remove(tid));
+   }
+
+   // Open a segment written in the legacy page format
+   {
+      const unsigned legacySeg = 4;
+      for (uint64_t p=0; p<2; ++p) {
+         BufferFrame& bf = bm.fixPage((uint64_t(legacySeg) << 48) | p, true);
+         char* data = static_cast<char*>(bf.getData());
+         auto header = reinterpret_cast<SPSegment::LegacyHeader*>(data);
+         auto slots  = reinterpret_cast<SPSegment::LegacySlot*>(data+sizeof(SPSegment::LegacyHeader));
+         header->slotCount     = (p == 0) ? 3 : 1;
+         header->firstFreeSlot = (p == 0) ? 2 : 1;
+         header->dataStart     = pageSize;
+         header->freeSpace     = pageSize-sizeof(SPSegment::LegacyHeader)-header->slotCount*sizeof(SPSegment::LegacySlot);
+         for (unsigned i=0; i<header->slotCount; ++i) {
+            slots[i].offset = 0;
+            slots[i].length = 0;
+         }
+
+         // page 0: record, indirection to page 1, free slot
+         // page 1: record
+         const string& value = testData[p];
+         header->dataStart -= value.size();
+         header->freeSpace -= value.size();
+         memcpy(data+header->dataStart, value.c_str(), value.size());
+         slots[0].offset = header->dataStart;
+         slots[0].length = value.size();
+         if (p == 0) {
+            slots[1].offset = 1;
+            slots[1].length = uint64_t(1) << 32;
+         }
+         bm.unfixPage(bf, true);
+      }
+
+      SPSegment legacy(bm, legacySeg, 2);
+      Record rec0 = legacy.lookup(TID{0, 0});
+      assert(rec0.getLen() == testData[0].size());
+      assert(memcmp(rec0.getData(), testData[0].c_str(), rec0.getLen())==0);
+      Record rec1 = legacy.lookup(TID{0, 1});
+      assert(rec1.getLen() == testData[1].size());
+      assert(memcmp(rec1.getData(), testData[1].c_str(), rec1.getLen())==0);
+
+      // converted pages are writable
+      assert(legacy.update(TID{0, 0}, Record(testData[3].size(), testData[3].c_str())));
+      assert(legacy.remove(TID{0, 1}));
+      TID tid = legacy.insert(Record(testData[2].size(), testData[2].c_str()));
+      assert(tid.pageID < 2);
+      Record rec = legacy.lookup(TID{0, 0});
+      assert(rec.getLen() == testData[3].size());
+      assert(memcmp(rec.getData(), testData[3].c_str(), rec.getLen())==0);
+   }
+
+   // Vacuum compacts pages, moves records back to the page of their TID and
+   // cuts off empty pages
+   {
+      const unsigned vacuumSeg = 5;
+      SPSegment vac(bm, vacuumSeg);
+
+      // counts indirections and pages with fragmented free space
+      auto inspect = [&](unsigned& indirections, unsigned& fragmented) {
+         indirections = fragmented = 0;
+         for (uint64_t p=0; p<vac.getSize(); ++p) {
+            BufferFrame& bf = bm.fixPage((uint64_t(vacuumSeg) << 48) | p, false);
+            char* data = static_cast<char*>(bf.getData());
+            auto header = reinterpret_cast<SPSegment::Header*>(data);
+            auto slots  = reinterpret_cast<SPSegment::Slot*>(data+sizeof(SPSegment::Header));
+            for (unsigned i=0; i<header->slotCount; ++i)
+               indirections += slots[i].isIndirection();
+            if (header->slotCount > 0 && header->dataStart-sizeof(SPSegment::Header)-header->slotCount*sizeof(SPSegment::Slot) != header->freeSpace)
+               fragmented++;
+            bm.unfixPage(bf, false);
+         }
+      };
+
+      vector<TID> tids;
+      for (unsigned i=0; i<2000; ++i)
+         tids.push_back(vac.insert(Record(testData[i%4].size(), testData[i%4].c_str())));
+      size_t pages = vac.getSize();
+
+      // grown records move to new pages, then their pages are cleared
+      for (unsigned i=0; i<tids.size(); i+=4)
+         assert(vac.update(tids[i], Record(testData[3].size(), testData[3].c_str())));
+      for (unsigned i=0; i<tids.size(); ++i)
+         if (i%4 != 0)
+            assert(vac.remove(tids[i]));
+
+      unsigned indirections, fragmented;
+      inspect(indirections, fragmented);
+      assert(indirections > 0 && fragmented > 0 && vac.getSize() > pages);
+
+      vac.vacuum();
+      inspect(indirections, fragmented);
+      assert(indirections == 0 && fragmented == 0 && vac.getSize() == pages);
+      for (unsigned i=0; i<tids.size(); i+=4) {
+         Record rec = vac.lookup(tids[i]);
+         assert(rec.getLen() == testData[3].size());
+         assert(memcmp(rec.getData(), testData[3].c_str(), rec.getLen())==0);
+      }
+
+      // in the background while the segment is in use
+      vac.startMaintenance(chrono::milliseconds(1));
+      for (unsigned i=0; i<tids.size(); i+=4) {
+         if (i%8 == 0) {
+            assert(vac.remove(tids[i]));
+            continue;
+         }
+         assert(vac.update(tids[i], Record(testData[4].size(), testData[4].c_str())));
+         Record rec = vac.lookup(tids[i]);
+         assert(rec.getLen() == testData[4].size());
+         assert(memcmp(rec.getData(), testData[4].c_str(), rec.getLen())==0);
+      }
+      vac.stopMaintenance();
+      vac.vacuum();
+      for (unsigned i=4; i<tids.size(); i+=8) {
+         Record rec = vac.lookup(tids[i]);
+         assert(rec.getLen() == testData[4].size());
+         assert(memcmp(rec.getData(), testData[4].c_str(), rec.getLen())==0);
+      }
+   }
+
+   // Concurrent inserts, with per-thread append pages and through the free
+   // space inventory
+   {
+      const unsigned threadCount = 4;
+      const unsigned perThread = 20000;
+      SPSegment par(bm, 6);
+
+      vector<vector<TID>> tids(2*threadCount);
+      vector<thread> threads;
+      for (unsigned t=0; t<2*threadCount; ++t) {
+         threads.push_back(thread([&, t] {
+            SPSegment::Inserter inserter(par);
+            for (unsigned i=0; i<perThread; ++i) {
+               const string& value = testData[(t+i)%4];
+               Record rec(value.size(), value.c_str());
+               tids[t].push_back(t < threadCount ? inserter.insert(rec) : par.insert(rec));
+            }
+         }));
+      }
+      for (auto& th : threads)
+         th.join();
+
+      // all records are intact and the append pages are not shared
+      unordered_map<TID, unsigned> owner;
+      unordered_map<uint32_t, unsigned> pageOwner;
+      for (unsigned t=0; t<2*threadCount; ++t) {
+         for (unsigned i=0; i<perThread; ++i) {
+            TID tid = tids[t][i];
+            assert(owner.emplace(tid, t).second);
+            if (t < threadCount)
+               assert(pageOwner.emplace(tid.pageID, t).first->second == t);
+
+            const string& value = testData[(t+i)%4];
+            Record rec = par.lookup(tid);
+            assert(rec.getLen() == value.size());
+            assert(memcmp(rec.getData(), value.c_str(), rec.getLen())==0);
+         }
+      }
+   }
+
+   // Scans running concurrently with inserts of large records never see
+   // their overflow pages uninitialized
+   {
+      SPSegment mixed(bm, 7);
+      string big(3*pageSize, 'y');
+      thread writer([&] {
+         for (unsigned i=0; i<200; ++i) {
+            mixed.insert(Record(big.size(), big.c_str()));
+            mixed.insert(Record(testData[0].size(), testData[0].c_str()));
+         }
+      });
+      for (unsigned round=0; round<20; ++round) {
+         SPSegment::TupleIterator it(mixed);
+         while (it.next())
+            assert(it.getLen() == big.size() || it.getLen() == testData[0].size());
+      }
+      writer.join();
+   }
+
+   // Inserts do not compact fragmented pages, their space is reused once
+   // vacuum compacted them
+   {
+      SPSegment frag(bm, 8);
+      // records with their slot take an eighth of a page, the last one does
+      // not fit next to the header
+      string eighth(pageSize/8 - sizeof(SPSegment::Slot), 'f');
+      vector<TID> tids;
+      for (unsigned i=0; i<8; ++i)
+         tids.push_back(frag.insert(Record(eighth.size(), eighth.c_str())));
+      assert(tids[6].pageID == 0 && tids[7].pageID == 1);
+      assert(frag.remove(tids[1]));
+
+      TID tid = frag.insert(Record(eighth.size(), eighth.c_str()));
+      assert(tid.pageID == 1);
+      BufferFrame& bf = bm.fixPage((uint64_t(8) << 48) | 0, false);
+      auto header = static_cast<SPSegment::Header*>(bf.getData());
+      assert(header->dataStart == pageSize - 7*eighth.size());
+      bm.unfixPage(bf, false);
+
+      frag.vacuum();
+      tid = frag.insert(Record(eighth.size(), eighth.c_str()));
+      assert(tid.pageID == 0);
+      Record rec = frag.lookup(tids[6]);
+      assert(rec.getLen() == eighth.size() && memcmp(rec.getData(), eighth.c_str(), rec.getLen())==0);
    }
 
    cout << "TEST SUCCESSFUL!" << endl;